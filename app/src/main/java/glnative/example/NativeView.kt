@@ -13,6 +13,7 @@ class NativeView(val context: Context) {
     external fun nativeOnPause()
     external fun nativeOnStop()
     external fun nativeSetSurface(surface: Surface?)
+    external fun nativeSetRefreshRate(refreshRate: Float)
     val surfaceView: View?
     val surfaceHolderCallback: SurfaceHolderCallback?
     init {
@@ -41,6 +42,7 @@ class NativeView(val context: Context) {
 
     inner class SurfaceHolderCallback: SurfaceHolder.Callback {
         override fun surfaceChanged(holder: SurfaceHolder, format: Int, w: Int, h: Int) {
+            surfaceView?.display?.let { nativeSetRefreshRate(it.refreshRate) }
             nativeSetSurface(holder.surface)
         }
 
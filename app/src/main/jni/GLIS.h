@@ -17,14 +17,27 @@
 #include <cerrno>
 #include <unistd.h>
 #include <poll.h>
+#include <stdarg.h>
 
 #include "logger.h"
 #include "server.h"
+#include "sync_variable.h"
 #include "WINAPI/SDK/include/Windows/windows.h"
 #include "GLIS_IPC.h"
 
 #define LOG_TAG "EglSample"
 
+// a TRACE_echo_function writing records to the log, for clients, which never dump their trace
+void GLIS_trace_log(uint8_t level, const char *format, ...) {
+    char message[1024];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+    if (level == TRACE_LEVEL_ERROR) LOG_ERROR("%s", message);
+    else LOG_INFO("%s", message);
+}
+
 bool GLIS_LOG_PRINT_NON_ERRORS = false;
 bool GLIS_LOG_PRINT_VERTEX = false;
 bool GLIS_LOG_PRINT_CONVERSIONS = false;
@@ -1222,15 +1235,19 @@ GLuint GLIS_current_texture = 0;
 
 void GLIS_Sync_GPU() {
 //    LOG_INFO("synchronizing with GPU");
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
     double start = now_ms();
+#endif
     GLsync GPU = GLIS_error_to_string_exec_GL(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
     if (GPU == nullptr) LOG_ERROR("glFenceSync failed");
 //    LOG_INFO("synchronizing");
     GLIS_error_to_string_exec_GL(glWaitSync(GPU, 0, GL_TIMEOUT_IGNORED));
 //    LOG_INFO("synchronized");
     glDeleteSync(GPU);
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
     double end = now_ms();
-    LOG_INFO("synchronized with GPU in %G milliseconds", end - start);
+    TRACE_VERBOSE("synchronized with GPU in %G milliseconds", end - start);
+#endif
 }
 
 class STATE {
@@ -1251,7 +1268,9 @@ class STATE {
         int response_rendered = 12;
 } STATE;
 
-int SYNC_STATE = STATE.no_state;
+// the state of the main Compositor, shared by the thread that owns its surface and the thread
+// that renders to it, see SYNC_VARIABLE
+SYNC_VARIABLE SYNC_STATE = STATE.no_state;
 
 GLuint *TEXDATA = nullptr;
 size_t TEXDATA_LEN = 0;
@@ -5,25 +5,278 @@
 #ifndef GLNE_GLIS_COMMANDS_H
 #define GLNE_GLIS_COMMANDS_H
 
-struct {
-    int texture = 1;
-    int new_window = 2;
-    int modify_window = 3;
-    int close_window = 4;
-    int shm_texture = 5;
-    int shm_params = 6;
-    int new_connection = 7;
+#include "window_list.h"
+
+// the compositor dispatches on these through COMPOSITOR_COMMAND_TABLE, indexed by id
+struct GLIS_SERVER_COMMAND_IDS {
+    enum : int {
+        texture = 1,
+        new_window = 2,
+        modify_window = 3,
+        close_window = 4,
+        new_connection = 7,
+        shm_texture_damage = 8,
+        resize_window_frames = 9,
+        batch = 10,
+        register_window_frames = 11,
+        set_window_flags = 12,
+    };
 } GLIS_SERVER_COMMANDS;
 
-const char *GLIS_command_to_string(int &command) {
-    if (command == GLIS_SERVER_COMMANDS.texture) return "Texture Upload";
-    else if (command == GLIS_SERVER_COMMANDS.new_window) return "Create New Window";
-    else if (command == GLIS_SERVER_COMMANDS.modify_window) return "Modify Window";
-    else if (command == GLIS_SERVER_COMMANDS.close_window) return "Close Window";
-    else if (command == GLIS_SERVER_COMMANDS.shm_texture) return "Shared Memory Texture";
-    else if (command == GLIS_SERVER_COMMANDS.shm_params) return "Shared Memory Parameters";
-    else if (command == GLIS_SERVER_COMMANDS.new_connection) return "New Server Connection";
-    else return "unknown";
+// fixed layout payloads, every command is sent as its id followed by a single field holding
+// its payload, so both sides agree on the layout at compile time
+struct GLIS_new_window_payload {
+    int win[4]; // x, y, x + w, y + h
+};
+
+struct GLIS_new_window_reply {
+    size_t window_id;
+    // in shared memory mode the size of the window's frame slots, whose fd follows
+    // on the keep alive connection, 0 otherwise
+    size_t frames_size;
+};
+
+struct GLIS_modify_window_payload {
+    size_t window_id;
+    int win[4]; // x, y, x + w, y + h
+};
+
+struct GLIS_close_window_payload {
+    size_t window_id;
+};
+
+// in socket mode the pixels follow as an extra field unless the window has registered frame
+// slots, in shared memory mode and for those windows they are in the window's published
+// frame slot and this only tells the compositor there is a new frame to latch
+struct GLIS_texture_payload {
+    size_t window_id;
+    GLint width;
+    GLint height;
+};
+
+// shared memory mode only, the client asks for every frame slot of a window to be resized
+// to slot_size bytes while it holds none of them
+struct GLIS_resize_frames_payload {
+    size_t window_id;
+    uint32_t slot_size;
+};
+
+// if replaced the slots were moved to a new region whose fd follows on the keep alive
+// connection, otherwise the same fd is remapped with frames_size
+struct GLIS_resize_frames_reply {
+    size_t frames_size;
+    bool replaced;
+};
+
+// socket mode only, the client registers frame slots it created for a window, their fd is
+// attached to the command, any slots the window registered before are dropped
+struct GLIS_register_frames_payload {
+    size_t window_id;
+    size_t frames_size;
+};
+
+struct GLIS_register_frames_reply {
+    bool registered;
+};
+
+// every pixel of the window is drawn fully opaque, so the compositor can skip drawing the
+// windows beneath it wherever it covers them
+const uint32_t GLIS_WINDOW_FLAG_OPAQUE = 1 << 0;
+
+// replaces the GLIS_WINDOW_FLAG_* hints of a window, windows start out with none
+struct GLIS_window_flags_payload {
+    size_t window_id;
+    uint32_t flags;
+};
+
+// a batch is its header followed by count commands encoded exactly as they would be sent on
+// their own, the compositor applies every command before it draws again
+struct GLIS_batch_payload {
+    uint32_t count;
+};
+
+// the reply to a batch says whether it was applied, followed by one GLIS_new_window_reply per
+// window it created, in the order they were queued, in shared memory mode the fds of their
+// frame slots follow in that order, a batch that is refused is not applied at all
+struct GLIS_batch_reply {
+    bool applied;
+};
+
+// commands in a batch refer to a window created earlier in the same batch by
+// GLIS_batch_window(i), i being the order it was queued in
+const uint32_t GLIS_BATCH_WINDOWS_MAX = 1024;
+
+size_t GLIS_batch_window(uint32_t index) {
+    assert(index < GLIS_BATCH_WINDOWS_MAX);
+    return SIZE_MAX - index;
+}
+
+bool GLIS_is_batch_window(size_t window_id) {
+    return window_id > SIZE_MAX - GLIS_BATCH_WINDOWS_MAX;
+}
+
+uint32_t GLIS_batch_window_index(size_t window_id) {
+    return static_cast<uint32_t>(SIZE_MAX - window_id);
+}
+
+// x and y are in texture coordinates (origin at the first row glReadPixels returns)
+struct GLIS_damage_rect {
+    GLint x;
+    GLint y;
+    GLint width;
+    GLint height;
+};
+
+// sent over the keep alive connection after the parameter and doorbell fds
+struct GLIS_channel_reply {
+    size_t parameter_size;
+};
+
+template<int COMMAND, typename PAYLOAD>
+class GLIS_MESSAGE {
+    public:
+        static constexpr int command = COMMAND;
+        static constexpr size_t size =
+            serializer::field_size(sizeof(int)) + serializer::field_size(sizeof(PAYLOAD));
+
+        static bool encode(serializer &S, const PAYLOAD &payload) {
+            if (!S.stream.reserve(S.stream.data_len + size)) return false;
+            return S.add<int>(COMMAND) && S.add_fixed<PAYLOAD>(payload);
+        }
+
+        // the command id has already been consumed by the dispatcher
+        static bool decode(serializer &S, PAYLOAD &payload) {
+            return S.get_fixed<PAYLOAD>(&payload);
+        }
+};
+
+template<typename PAYLOAD>
+class GLIS_REPLY {
+    public:
+        static constexpr size_t size = serializer::field_size(sizeof(PAYLOAD));
+
+        static bool encode(serializer &S, const PAYLOAD &payload) {
+            if (!S.stream.reserve(S.stream.data_len + size)) return false;
+            return S.add_fixed<PAYLOAD>(payload);
+        }
+
+        static bool decode(serializer &S, PAYLOAD &payload) {
+            return S.get_fixed<PAYLOAD>(&payload);
+        }
+};
+
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::new_window, GLIS_new_window_payload>
+    GLIS_MESSAGE_new_window;
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::modify_window, GLIS_modify_window_payload>
+    GLIS_MESSAGE_modify_window;
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::close_window, GLIS_close_window_payload>
+    GLIS_MESSAGE_close_window;
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::texture, GLIS_texture_payload>
+    GLIS_MESSAGE_texture;
+// frame slots only, the dirty rectangles travel with the pixels in the frame slot
+// so they follow the frame through the mailbox
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::shm_texture_damage, GLIS_texture_payload>
+    GLIS_MESSAGE_shm_texture_damage;
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::resize_window_frames, GLIS_resize_frames_payload>
+    GLIS_MESSAGE_resize_window_frames;
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::batch, GLIS_batch_payload> GLIS_MESSAGE_batch;
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::register_window_frames, GLIS_register_frames_payload>
+    GLIS_MESSAGE_register_window_frames;
+typedef GLIS_MESSAGE<GLIS_SERVER_COMMAND_IDS::set_window_flags, GLIS_window_flags_payload>
+    GLIS_MESSAGE_set_window_flags;
+typedef GLIS_REPLY<GLIS_new_window_reply> GLIS_REPLY_new_window;
+typedef GLIS_REPLY<GLIS_resize_frames_reply> GLIS_REPLY_resize_window_frames;
+typedef GLIS_REPLY<GLIS_channel_reply> GLIS_REPLY_channel;
+typedef GLIS_REPLY<GLIS_register_frames_reply> GLIS_REPLY_register_window_frames;
+typedef GLIS_REPLY<GLIS_batch_reply> GLIS_REPLY_batch;
+
+// the commands a batch may hold, the ones that only change windows, a batch can not hold
+// another batch or a command that replies or takes an fd
+bool GLIS_batch_allows(int command) {
+    return command == GLIS_SERVER_COMMANDS.new_window ||
+           command == GLIS_SERVER_COMMANDS.modify_window ||
+           command == GLIS_SERVER_COMMANDS.set_window_flags ||
+           command == GLIS_SERVER_COMMANDS.close_window ||
+           command == GLIS_SERVER_COMMANDS.texture;
+}
+
+// the smallest command a batch may hold, the count in its header is checked against the bytes
+// that follow it with this before any of them are read
+const size_t GLIS_BATCH_COMMAND_SIZE_MIN = GLIS_MESSAGE_close_window::size;
+
+// compositor side, reads through the count commands that follow a batch header without
+// applying any of them, a batch is only applied if every command in it is one a batch may
+// hold, decodes, and refers to a window in windows or created earlier in the batch that the
+// batch has not closed, textures is false if the pixels of a texture would follow it in the
+// batch instead of being in the window's frame slots
+// the cursor is left at the first command, arena mode only
+bool GLIS_batch_validate(serializer &in, uint32_t count, const WINDOW_LIST &windows,
+                         bool textures) {
+    if (in.mode != SERIALIZER_MODE.arena) {
+        LOG_ERROR("batches can only be read in arena mode");
+        return false;
+    }
+    size_t start = in.cursor;
+    size_t remaining = start < in.stream.data_len ? in.stream.data_len - start : 0;
+    if (count > remaining / GLIS_BATCH_COMMAND_SIZE_MIN) {
+        LOG_ERROR("a batch of %u commands can not fit in %zu bytes", count, remaining);
+        return false;
+    }
+    uint32_t created = 0;
+    std::vector<size_t> closed;
+    bool valid = true;
+    for (uint32_t i = 0; valid && i < count; i++) {
+        int command = -1;
+        if (!in.get<int>(&command) || !GLIS_batch_allows(command)) {
+            LOG_ERROR("command %u of the batch is %d, which a batch can not hold", i, command);
+            valid = false;
+            break;
+        }
+        size_t window_id = 0;
+        if (command == GLIS_SERVER_COMMANDS.new_window) {
+            GLIS_new_window_payload payload;
+            valid = GLIS_MESSAGE_new_window::decode(in, payload);
+            created++;
+        } else if (command == GLIS_SERVER_COMMANDS.modify_window) {
+            GLIS_modify_window_payload payload;
+            valid = GLIS_MESSAGE_modify_window::decode(in, payload);
+            window_id = payload.window_id;
+        } else if (command == GLIS_SERVER_COMMANDS.set_window_flags) {
+            GLIS_window_flags_payload payload;
+            valid = GLIS_MESSAGE_set_window_flags::decode(in, payload);
+            window_id = payload.window_id;
+        } else if (command == GLIS_SERVER_COMMANDS.close_window) {
+            GLIS_close_window_payload payload;
+            valid = GLIS_MESSAGE_close_window::decode(in, payload);
+            window_id = payload.window_id;
+        } else {
+            if (!textures) {
+                LOG_ERROR("command %u of the batch is a texture, which needs frame slots", i);
+                valid = false;
+                break;
+            }
+            GLIS_texture_payload payload;
+            valid = GLIS_MESSAGE_texture::decode(in, payload);
+            window_id = payload.window_id;
+        }
+        if (!valid) {
+            LOG_ERROR("command %u of the batch (%d) does not decode", i, command);
+            break;
+        }
+        if (command == GLIS_SERVER_COMMANDS.new_window) continue;
+        bool exists = GLIS_is_batch_window(window_id)
+                      ? GLIS_batch_window_index(window_id) < created
+                      : WINDOW_LIST_find(windows, window_id) != WINDOW_LIST_NONE;
+        if (!exists || std::find(closed.begin(), closed.end(), window_id) != closed.end()) {
+            LOG_ERROR("command %u of the batch (%d) refers to window %zu, which does not exist",
+                      i, command, window_id);
+            valid = false;
+            break;
+        }
+        if (command == GLIS_SERVER_COMMANDS.close_window) closed.push_back(window_id);
+    }
+    in.cursor = start;
+    return valid;
 }
 
 class GLIS_shared_memory {
@@ -39,15 +292,8 @@ bool GLIS_shared_memory_malloc(GLIS_shared_memory &sh, size_t size) {
     return SHM_create(sh.fd, &sh.data, sh.size);
 }
 
-bool GLIS_shared_memory_realloc(GLIS_shared_memory &sh, size_t size) {
-    if (SHM_resize(sh.fd, size)) {
-        sh.size = size;
-        return true;
-    }
-    return false;
-}
-
 bool GLIS_shared_memory_free(GLIS_shared_memory &sh) {
+    if (sh.data != nullptr) munmap(sh.data, sh.size);
     if (SHM_close(sh.fd)) {
         sh.data = nullptr;
         sh.size = 0;
@@ -56,12 +302,58 @@ bool GLIS_shared_memory_free(GLIS_shared_memory &sh) {
     return false;
 }
 
-int8_t shared_memory_waiting_for_data = -1;
-int8_t shared_memory_has_data = -2;
-int8_t shared_memory_data_consumed = -3;
-int8_t shared_memory_transfer_complete = -4;
-int8_t shared_memory_allocated = -5;
-int8_t shared_memory_waiting_for_allocation = -6;
+// resizes and remaps a region, the contents are not kept, a region that can not be resized
+// in place (ashmem once mapped) is replaced by a new one and replaced is set, in which case
+// the new fd must be handed to every other process mapping it
+bool GLIS_shared_memory_realloc(GLIS_shared_memory &sh, size_t size, bool &replaced) {
+    replaced = false;
+    size_t resized = size;
+    if (SHM_resize(sh.fd, resized)) {
+        if (sh.data != nullptr) munmap(sh.data, sh.size);
+        sh.data = nullptr;
+        sh.size = resized;
+        return SHM_open(sh.fd, &sh.data, sh.size);
+    }
+    GLIS_shared_memory region;
+    if (!GLIS_shared_memory_malloc(region, size)) return false;
+    region.reference_count = sh.reference_count;
+    GLIS_shared_memory_free(sh);
+    sh = region;
+    replaced = true;
+    return true;
+}
+
+// shared memory layout: [size_t size][int32_t state][data ...]
+// the state is a naturally aligned 32 bit word so both processes can futex wait on it
+const size_t GLIS_SHARED_MEMORY_INDEX_SIZE = 0;
+const size_t GLIS_SHARED_MEMORY_INDEX_STATE = sizeof(size_t);
+const size_t GLIS_SHARED_MEMORY_INDEX_DATA = sizeof(size_t) + sizeof(int32_t);
+const size_t GLIS_SHARED_MEMORY_HEADER_SIZE = GLIS_SHARED_MEMORY_INDEX_DATA;
+
+int32_t shared_memory_waiting_for_data = -1;
+int32_t shared_memory_has_data = -2;
+int32_t shared_memory_data_consumed = -3;
+int32_t shared_memory_transfer_complete = -4;
+int32_t shared_memory_allocated = -5;
+int32_t shared_memory_waiting_for_allocation = -6;
+// never stored, returned by GLIS_shared_memory_wait_for_state when the wait is abandoned
+int32_t shared_memory_abandoned = -7;
+
+class GLIS_SHARED_MEMORY_WAIT_MODE {
+    public:
+        // busy wait on the state word, lowest latency but keeps a core at 100%
+        int spin = 0;
+        // spin for GLIS_SHARED_MEMORY_SPIN_COUNT iterations then sleep in futex_wait
+        int futex = 1;
+} GLIS_SHARED_MEMORY_WAIT_MODE;
+
+int GLIS_SHARED_MEMORY_WAIT = GLIS_SHARED_MEMORY_WAIT_MODE.futex;
+
+// how many times the state is polled before sleeping, 0 sleeps straight away
+int GLIS_SHARED_MEMORY_SPIN_COUNT = 200;
+
+// how often a reader that may be abandoned rechecks its reference count while sleeping
+int GLIS_SHARED_MEMORY_WAIT_TIMEOUT_MS = 100;
 
 bool LOG_SHARED_MEMORY_TRANSFER_INFO = false;
 
@@ -70,227 +362,351 @@ void GLIS_unsigned_underflow_check(size_t len, size_t subtract_by, size_t &out)
     else out = subtract_by;
 }
 
-void GLIS_shared_memory_write(GLIS_shared_memory &sh, serializer &data) {
+size_t &GLIS_shared_memory_size_slot(GLIS_shared_memory &sh) {
+    return *reinterpret_cast<size_t *>(&sh.data[GLIS_SHARED_MEMORY_INDEX_SIZE]);
+}
+
+int32_t *GLIS_shared_memory_state(GLIS_shared_memory &sh) {
+    return reinterpret_cast<int32_t *>(&sh.data[GLIS_SHARED_MEMORY_INDEX_STATE]);
+}
+
+void GLIS_shared_memory_set_state(GLIS_shared_memory &sh, int32_t state) {
+    int32_t *word = GLIS_shared_memory_state(sh);
+    __atomic_store_n(word, state, __ATOMIC_RELEASE);
+    futex_wake_all(word);
+}
+
+// waits until the state becomes either state or alternative and returns the state observed
+// if abandon_on_disconnect is true the wait gives up once sh.reference_count drops to zero
+// and returns shared_memory_abandoned
+int32_t GLIS_shared_memory_wait_for_state(GLIS_shared_memory &sh, int32_t state,
+                                          int32_t alternative, bool abandon_on_disconnect) {
+    int32_t *word = GLIS_shared_memory_state(sh);
+    for (int spin = 0;; spin++) {
+        int32_t observed = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if (observed == state || observed == alternative) return observed;
+        if (abandon_on_disconnect && sh.reference_count == 0) return shared_memory_abandoned;
+        if (GLIS_SHARED_MEMORY_WAIT == GLIS_SHARED_MEMORY_WAIT_MODE.spin) continue;
+        if (spin < GLIS_SHARED_MEMORY_SPIN_COUNT) continue;
+        if (abandon_on_disconnect) {
+            struct timespec timeout = futex_timeout_ms(GLIS_SHARED_MEMORY_WAIT_TIMEOUT_MS);
+            futex_wait(word, observed, &timeout);
+        } else futex_wait(word, observed, nullptr);
+    }
+}
+
+int32_t GLIS_shared_memory_wait_for_state(GLIS_shared_memory &sh, int32_t state,
+                                          bool abandon_on_disconnect) {
+    return GLIS_shared_memory_wait_for_state(sh, state, state, abandon_on_disconnect);
+}
+
+// every transfer ends in shared_memory_data_consumed, the reader knows the total length so it
+// returns after the last chunk without waiting for another state change, nothing is stored
+// after that since it could overwrite a transfer the reader has already started
+void GLIS_shared_memory_write_data(GLIS_shared_memory &sh, const int8_t *source, size_t len) {
     assert(sh.data != nullptr);
     if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("initializing shared memory transfer");
-    int8_t indexsize = 0;
-    int8_t indexstate = sizeof(size_t);
-    int8_t indexdata = sizeof(size_t) + sizeof(int8_t);
-    assert(sh.size > indexdata);
-    size_t buffer = sh.size - indexdata;
-    data.construct();
-    reinterpret_cast<size_t *>(sh.data)[indexsize] = data.stream.data_len;
+    assert(sh.size > GLIS_SHARED_MEMORY_INDEX_DATA);
+    size_t buffer = sh.size - GLIS_SHARED_MEMORY_INDEX_DATA;
+    int8_t *destination = &sh.data[GLIS_SHARED_MEMORY_INDEX_DATA];
+    GLIS_shared_memory_size_slot(sh) = len;
     if (LOG_SHARED_MEMORY_TRANSFER_INFO) {
-        LOG_INFO_SHM("total to write: %zu", data.stream.data_len);
+        LOG_INFO_SHM("total to write: %zu", len);
         LOG_INFO_SHM("buffer: %zu", buffer);
     }
-    sh.data[indexstate] = shared_memory_waiting_for_allocation;
-    while (sh.data[indexstate] != shared_memory_allocated);
-    if (buffer >= data.stream.data_len) {
-        memcpy(&sh.data[indexdata], data.stream.data, data.stream.data_len);
+    GLIS_shared_memory_set_state(sh, shared_memory_waiting_for_allocation);
+    GLIS_shared_memory_wait_for_state(sh, shared_memory_allocated, false);
+    if (buffer >= len) {
+        memcpy(destination, source, len);
         if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-            LOG_INFO_SHM("'data.stream.data' -> 'sh.data[%d]' (size %zu)", indexdata,
-                         data.stream.data_len);
-        sh.data[indexstate] = shared_memory_has_data;
-        while (sh.data[indexstate] != shared_memory_data_consumed);
+            LOG_INFO_SHM("'source' -> 'sh.data[%zu]' (size %zu)", GLIS_SHARED_MEMORY_INDEX_DATA,
+                         len);
+        GLIS_shared_memory_set_state(sh, shared_memory_has_data);
+        GLIS_shared_memory_wait_for_state(sh, shared_memory_data_consumed, false);
     } else {
-        int index = indexdata;
-        while (data.stream.data_len > 0) {
-            GLIS_unsigned_underflow_check(data.stream.data_len, buffer,
-                                          reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            memcpy(&sh.data[index], &data.stream.data[index - indexdata],
-                   reinterpret_cast<size_t *>(sh.data)[indexsize]);
+        size_t index = 0;
+        size_t chunk = 0;
+        while (index < len) {
+            GLIS_unsigned_underflow_check(len - index, buffer, chunk);
+            // each chunk is placed at the start of the data area
+            memcpy(destination, &source[index], chunk);
+            GLIS_shared_memory_size_slot(sh) = chunk;
             if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-                LOG_INFO_SHM("'data.stream.data[%zu]' -> 'sh.data[%zu]' (size %zu)",
-                             index - indexdata, index,
-                             reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            index += reinterpret_cast<size_t *>(sh.data)[indexsize];
-            sh.data[indexstate] = shared_memory_has_data;
-            while (sh.data[indexstate] != shared_memory_data_consumed);
-            data.stream.data_len -= reinterpret_cast<size_t *>(sh.data)[indexsize];
+                LOG_INFO_SHM("'source[%zu]' -> 'sh.data[%zu]' (size %zu)",
+                             index, GLIS_SHARED_MEMORY_INDEX_DATA, chunk);
+            index += chunk;
+            GLIS_shared_memory_set_state(sh, shared_memory_has_data);
+            GLIS_shared_memory_wait_for_state(sh, shared_memory_data_consumed, false);
         }
     }
-    sh.data[indexstate] = shared_memory_transfer_complete;
     if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("shared memory transfer complete");
 }
 
-void GLIS_shared_memory_read(GLIS_shared_memory &sh, serializer &data) {
+// waits for a writer to start a transfer, returns false if the wait was abandoned
+bool GLIS_shared_memory_read_length(GLIS_shared_memory &sh, size_t &len) {
     if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("initializing shared memory transfer");
-    int8_t indexsize = 0;
-    int8_t indexstate = sizeof(size_t);
-    int8_t indexdata = sizeof(size_t) + sizeof(int8_t);
-    assert(sh.size > indexdata);
-    size_t buffer = sh.size - indexdata;
-    while (sh.data[indexstate] != shared_memory_waiting_for_allocation)
-        if (sh.reference_count == 0)return;
+    assert(sh.size > GLIS_SHARED_MEMORY_INDEX_DATA);
+    if (GLIS_shared_memory_wait_for_state(sh, shared_memory_waiting_for_allocation, true) ==
+        shared_memory_abandoned)
+        return false;
+    len = GLIS_shared_memory_size_slot(sh);
     if (LOG_SHARED_MEMORY_TRANSFER_INFO) {
-        LOG_INFO_SHM("total to read: %zu", reinterpret_cast<size_t *>(sh.data)[indexsize]);
-        LOG_INFO_SHM("buffer: %zu", buffer);
+        LOG_INFO_SHM("total to read: %zu", len);
+        LOG_INFO_SHM("buffer: %zu", sh.size - GLIS_SHARED_MEMORY_INDEX_DATA);
     }
-    data.stream.allocate(reinterpret_cast<size_t *>(sh.data)[indexsize]);
-    sh.data[indexstate] = shared_memory_allocated;
-    if (buffer >= data.stream.data_len) { // if buffer is greater than or equal to data len
-        while (sh.data[indexstate] != shared_memory_has_data) if (sh.reference_count == 0) return;
-        memcpy(data.stream.data, &sh.data[indexdata], data.stream.data_len);
+    return true;
+}
+
+// reads len bytes announced by GLIS_shared_memory_read_length into destination,
+// returns false if the wait was abandoned
+bool GLIS_shared_memory_read_data(GLIS_shared_memory &sh, int8_t *destination, size_t len) {
+    size_t buffer = sh.size - GLIS_SHARED_MEMORY_INDEX_DATA;
+    int8_t *source = &sh.data[GLIS_SHARED_MEMORY_INDEX_DATA];
+    GLIS_shared_memory_set_state(sh, shared_memory_allocated);
+    if (buffer >= len) { // if buffer is greater than or equal to data len
+        if (GLIS_shared_memory_wait_for_state(sh, shared_memory_has_data, true) ==
+            shared_memory_abandoned)
+            return false;
+        memcpy(destination, source, len);
         if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-            LOG_INFO_SHM("'sh.data[%d]' -> 'data.stream.data' (size %zu)", indexdata,
-                         data.stream.data_len);
-        sh.data[indexstate] = shared_memory_data_consumed;
+            LOG_INFO_SHM("'sh.data[%zu]' -> 'destination' (size %zu)",
+                         GLIS_SHARED_MEMORY_INDEX_DATA, len);
+        GLIS_shared_memory_set_state(sh, shared_memory_data_consumed);
     } else {
         if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("reading buffered");
         size_t idx = 0;
-        while (sh.data[indexstate] != shared_memory_transfer_complete) {
-            while (sh.data[indexstate] != shared_memory_has_data) {
-                if (sh.data[indexstate] == shared_memory_transfer_complete) break;
-                if (sh.reference_count == 0) return;
-            }
-            if (sh.data[indexstate] == shared_memory_transfer_complete) break;
-            memcpy(&data.stream.data[idx], &sh.data[indexdata + idx],
-                   reinterpret_cast<size_t *>(sh.data)[indexsize]);
+        while (idx < len) {
+            if (GLIS_shared_memory_wait_for_state(sh, shared_memory_has_data, true) ==
+                shared_memory_abandoned)
+                return false;
+            size_t chunk = GLIS_shared_memory_size_slot(sh);
+            assert(idx + chunk <= len);
+            memcpy(&destination[idx], source, chunk);
             if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-                LOG_INFO_SHM("'sh.data[%zu]' -> 'data.stream.data[%zu]' (size %zu)",
-                             indexdata + idx, idx, reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            idx += reinterpret_cast<size_t *>(sh.data)[indexsize];
-            sh.data[indexstate] = shared_memory_data_consumed;
+                LOG_INFO_SHM("'sh.data[%zu]' -> 'destination[%zu]' (size %zu)",
+                             GLIS_SHARED_MEMORY_INDEX_DATA, idx, chunk);
+            idx += chunk;
+            GLIS_shared_memory_set_state(sh, shared_memory_data_consumed);
         }
-        if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("shared memory transfer complete");
     }
+    if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("shared memory transfer complete");
+    return true;
+}
+
+void GLIS_shared_memory_write(GLIS_shared_memory &sh, serializer &data) {
+    assert(sh.data != nullptr);
+    data.construct();
+    GLIS_shared_memory_write_data(sh, data.stream.data, data.stream.data_len);
+}
+
+void GLIS_shared_memory_read(GLIS_shared_memory &sh, serializer &data) {
+    size_t len;
+    if (!GLIS_shared_memory_read_length(sh, len)) return;
+    data.stream.allocate(len);
+    if (!GLIS_shared_memory_read_data(sh, data.stream.data, len)) return;
     data.deconstruct();
 }
 
-void GLIS_shared_memory_write_texture(GLIS_shared_memory &sh, int8_t *texture, size_t &len) {
+// single producer, single consumer ring of length prefixed commands
+//
+// head and tail are free running byte counters (the position is counter & (capacity - 1)),
+// each on its own cache line so the producer and consumer do not bounce a shared line
+// on every update, the producer only writes head and the consumer only writes tail
+//
+// a side that finds the ring empty (consumer) or full (producer) spins briefly, then flags
+// itself as sleeping and futex waits on the other side's counter, the other side only
+// issues a futex wake when that flag is set
+struct GLIS_command_ring_header {
+    alignas(64) uint32_t head;
+    int32_t consumer_sleeping;
+    alignas(64) uint32_t tail;
+    int32_t producer_sleeping;
+    alignas(64) uint32_t capacity; // a power of two
+};
+
+class GLIS_command_ring {
+    public:
+        GLIS_command_ring_header *header = nullptr;
+        int8_t *data = nullptr;
+        // process local, if set the producer wakes a sleeping consumer by writing this eventfd
+        // instead of a futex wake, so the consumer can sleep on many rings at once with poll
+        int doorbell = -1;
+        // process local, the capacity the ring was mapped with, the header's copy can be
+        // written by the other side at any time
+        uint32_t capacity = 0;
+        // set by the consumer once the other side has written a command that can not be in
+        // the ring, nothing more is read from it
+        bool corrupt = false;
+};
+
+// the parameter region holds two rings, client -> compositor requests and
+// compositor -> client replies
+uint32_t GLIS_COMMAND_RING_CAPACITY = 64 * 1024;
+
+// the most commands the compositor executes before it draws
+size_t GLIS_COMMAND_RING_DRAIN_MAX = 4096;
+
+size_t GLIS_command_ring_size(uint32_t capacity) {
+    return sizeof(GLIS_command_ring_header) + capacity;
+}
+
+size_t GLIS_command_rings_size(uint32_t capacity) {
+    return 2 * GLIS_command_ring_size(capacity);
+}
+
+// the creator initializes the headers, the other side only attaches to them
+void GLIS_command_ring_map(GLIS_command_ring &ring, int8_t *memory, uint32_t capacity,
+                           bool initialize) {
+    ring.header = reinterpret_cast<GLIS_command_ring_header *>(memory);
+    ring.data = memory + sizeof(GLIS_command_ring_header);
+    ring.capacity = capacity;
+    ring.corrupt = false;
+    if (initialize) {
+        assert((capacity & (capacity - 1)) == 0);
+        ring.header->head = 0;
+        ring.header->consumer_sleeping = 0;
+        ring.header->tail = 0;
+        ring.header->producer_sleeping = 0;
+        __atomic_store_n(&ring.header->capacity, capacity, __ATOMIC_RELEASE);
+    }
+}
+
+// returns false if the rings found in a region created by the other side do not fit it
+bool GLIS_command_rings_map(GLIS_shared_memory &sh, GLIS_command_ring &requests,
+                            GLIS_command_ring &replies, bool initialize) {
     assert(sh.data != nullptr);
-    if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("initializing shared memory transfer");
-    int8_t indexsize = 0;
-    int8_t indexstate = sizeof(size_t);
-    int8_t indexdata = sizeof(size_t) + sizeof(int8_t);
-    assert(sh.size > indexdata);
-    size_t buffer = sh.size - indexdata;
-    reinterpret_cast<size_t *>(sh.data)[indexsize] = len;
-    if (LOG_SHARED_MEMORY_TRANSFER_INFO) {
-        LOG_INFO_SHM("total to write: %zu", len);
-        LOG_INFO_SHM("buffer: %zu", buffer);
+    uint32_t capacity = GLIS_COMMAND_RING_CAPACITY;
+    if (!initialize) {
+        if (sh.size < sizeof(GLIS_command_ring_header)) {
+            LOG_ERROR_SHM("%zu bytes can not hold the command rings", sh.size);
+            return false;
+        }
+        capacity = __atomic_load_n(
+            &reinterpret_cast<GLIS_command_ring_header *>(sh.data)->capacity, __ATOMIC_ACQUIRE
+        );
     }
-    sh.data[indexstate] = shared_memory_waiting_for_allocation;
-    while (sh.data[indexstate] != shared_memory_allocated);
-    if (buffer >= len) {
-        memcpy(&sh.data[indexdata], texture, len);
-        if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-            LOG_INFO_SHM("'texture' -> 'sh.data[%d]' (size %zu)", indexdata, len);
-        sh.data[indexstate] = shared_memory_has_data;
-        while (sh.data[indexstate] != shared_memory_data_consumed);
-    } else {
-        int index = indexdata;
-        size_t len_tmp = len;
-        while (len_tmp > 0) {
-            GLIS_unsigned_underflow_check(len_tmp, buffer,
-                                          reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            memcpy(&sh.data[index], &texture[index - indexdata],
-                   reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-                LOG_INFO_SHM("'texture[%zu]' -> 'sh.data[%zu]' (size %zu)", index - indexdata,
-                             index, reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            index += reinterpret_cast<size_t *>(sh.data)[indexsize];
-            sh.data[indexstate] = shared_memory_has_data;
-            while (sh.data[indexstate] != shared_memory_data_consumed);
-            len_tmp -= reinterpret_cast<size_t *>(sh.data)[indexsize];
+    if (capacity <= sizeof(uint32_t) || (capacity & (capacity - 1)) != 0 ||
+        sh.size < GLIS_command_rings_size(capacity)) {
+        LOG_ERROR_SHM("command rings of %u bytes do not fit a region of %zu bytes", capacity,
+                      sh.size);
+        return false;
+    }
+    GLIS_command_ring_map(requests, sh.data, capacity, initialize);
+    GLIS_command_ring_map(replies, sh.data + GLIS_command_ring_size(capacity), capacity,
+                          initialize);
+    return true;
+}
+
+void GLIS_command_ring_copy_in(GLIS_command_ring &ring, uint32_t position, const void *source,
+                               uint32_t len) {
+    uint32_t capacity = ring.capacity;
+    uint32_t offset = position & (capacity - 1);
+    uint32_t first = capacity - offset < len ? capacity - offset : len;
+    memcpy(&ring.data[offset], source, first);
+    memcpy(ring.data, static_cast<const int8_t *>(source) + first, len - first);
+}
+
+void GLIS_command_ring_copy_out(GLIS_command_ring &ring, uint32_t position, void *destination,
+                                uint32_t len) {
+    uint32_t capacity = ring.capacity;
+    uint32_t offset = position & (capacity - 1);
+    uint32_t first = capacity - offset < len ? capacity - offset : len;
+    memcpy(destination, &ring.data[offset], first);
+    memcpy(static_cast<int8_t *>(destination) + first, ring.data, len - first);
+}
+
+// waits until *counter != value, or timeout_ms has elapsed (-1 waits forever)
+// returns false on timeout
+bool GLIS_command_ring_wait(uint32_t *counter, uint32_t value, int32_t *sleeping,
+                            int timeout_ms) {
+    for (int spin = 0; spin < GLIS_SHARED_MEMORY_SPIN_COUNT; spin++)
+        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != value) return true;
+    if (timeout_ms == 0) return false;
+    double start = now_ms();
+    for (;;) {
+        __atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) != value) break;
+        if (timeout_ms < 0) futex_wait(reinterpret_cast<int32_t *>(counter), value, nullptr);
+        else {
+            int remaining = timeout_ms - static_cast<int>(now_ms() - start);
+            if (remaining <= 0) break;
+            struct timespec timeout = futex_timeout_ms(remaining);
+            futex_wait(reinterpret_cast<int32_t *>(counter), value, &timeout);
         }
+        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != value) break;
     }
-    sh.data[indexstate] = shared_memory_transfer_complete;
-    if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("shared memory transfer complete");
+    __atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE) != value;
 }
 
-void GLIS_shared_memory_read_texture(GLIS_shared_memory &sh, int8_t **texture) {
-    if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("initializing shared memory transfer");
-    int8_t indexsize = 0;
-    int8_t indexstate = sizeof(size_t);
-    int8_t indexdata = sizeof(size_t) + sizeof(int8_t);
-    assert(sh.size > indexdata);
-    size_t buffer = sh.size - indexdata;
-    while (sh.data[indexstate] != shared_memory_waiting_for_allocation)
-        if (sh.reference_count == 0)return;
-    if (LOG_SHARED_MEMORY_TRANSFER_INFO) {
-        LOG_INFO_SHM("total to read: %zu", reinterpret_cast<size_t *>(sh.data)[indexsize]);
-        LOG_INFO_SHM("buffer: %zu", buffer);
+// publishes a new counter value and wakes the other side if it went to sleep
+void GLIS_command_ring_publish(uint32_t *counter, uint32_t value, int32_t *sleeping,
+                               int doorbell) {
+    __atomic_store_n(counter, value, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST) != 0) {
+        if (doorbell >= 0) eventfd_write(doorbell, 1);
+        else futex_wake_all(reinterpret_cast<int32_t *>(counter));
     }
-    *texture = static_cast<int8_t *>(malloc(reinterpret_cast<size_t *>(sh.data)[indexsize]));
-    sh.data[indexstate] = shared_memory_allocated;
-    if (buffer >= reinterpret_cast<size_t *>(sh.data)[indexsize]) {
-        while (sh.data[indexstate] != shared_memory_has_data) if (sh.reference_count == 0) return;
-        memcpy(*texture, &sh.data[indexdata], reinterpret_cast<size_t *>(sh.data)[indexsize]);
-        if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-            LOG_INFO_SHM("'sh.data[%d]' -> '*texture' (size %zu)", indexdata,
-                         reinterpret_cast<size_t *>(sh.data)[indexsize]);
-        sh.data[indexstate] = shared_memory_data_consumed;
-    } else {
-        if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("reading buffered");
-        size_t idx = 0;
-        while (sh.data[indexstate] != shared_memory_transfer_complete) {
-            while (sh.data[indexstate] != shared_memory_has_data) {
-                if (sh.data[indexstate] == shared_memory_transfer_complete) break;
-                if (sh.reference_count == 0) return;
-            }
-            if (sh.data[indexstate] == shared_memory_transfer_complete) break;
-            memcpy(&(*texture)[idx], &sh.data[indexdata + idx],
-                   reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            if (LOG_SHARED_MEMORY_TRANSFER_INFO)
-                LOG_INFO_SHM("'sh.data[%zu]' -> '(*texture)[%zu]' (size %zu)", indexdata + idx, idx,
-                             reinterpret_cast<size_t *>(sh.data)[indexsize]);
-            idx += reinterpret_cast<size_t *>(sh.data)[indexsize];
-            sh.data[indexstate] = shared_memory_data_consumed;
-        }
-        if (LOG_SHARED_MEMORY_TRANSFER_INFO) LOG_INFO_SHM("shared memory transfer complete");
+}
+
+// producer side, blocks only while the ring does not have room for the command
+bool GLIS_command_ring_push(GLIS_command_ring &ring, const int8_t *message, uint32_t len) {
+    assert(ring.header != nullptr);
+    GLIS_command_ring_header *header = ring.header;
+    uint32_t frame = sizeof(uint32_t) + len;
+    if (len > ring.capacity - sizeof(uint32_t)) {
+        LOG_ERROR_SHM("command of %u bytes does not fit in a ring of %u bytes", len,
+                      ring.capacity);
+        return false;
+    }
+    uint32_t head = header->head;
+    for (;;) {
+        uint32_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+        if (ring.capacity - (head - tail) >= frame) break;
+        GLIS_command_ring_wait(&header->tail, tail, &header->producer_sleeping, -1);
     }
+    GLIS_command_ring_copy_in(ring, head, &len, sizeof(uint32_t));
+    GLIS_command_ring_copy_in(ring, head + sizeof(uint32_t), message, len);
+    GLIS_command_ring_publish(&header->head, head + frame, &header->consumer_sleeping,
+                              ring.doorbell);
+    return true;
 }
 
-bool GLIS_shared_memory_get(GLIS_shared_memory &sh) {
-    SERVER_LOG_TRANSFER_INFO = true;
-    SOCKET_CLIENT client;
-    serializer cmd;
-    serializer id;
-    cmd.add<int>(GLIS_SERVER_COMMANDS.shm_texture);
-    if (client.connect_to_server()) {
-        if (client.socket_put_serial(cmd)) {
-            client.socket_get_fd(sh.fd);
-            if (client.socket_get_serial(id)) {
-                if (client.disconnect_from_server()) {
-                    id.get<size_t>(&sh.size);
-                    id.get<size_t>(&sh.reference_count);
-                    return true;
-                } else
-                    LOG_ERROR("failed to disconnect from the server");
-            } else
-                LOG_ERROR("failed to get serial from the server");
-        } else
-            LOG_ERROR("failed to send window to the server");
-    } else
-        LOG_ERROR("failed to connect to server");
-    return false;
+bool GLIS_command_ring_push(GLIS_command_ring &ring, serializer &S) {
+    S.construct();
+    return GLIS_command_ring_push(ring, S.stream.data, static_cast<uint32_t>(S.stream.data_len));
 }
 
-bool GLIS_shared_memory_params_get(GLIS_shared_memory &sh) {
-    SERVER_LOG_TRANSFER_INFO = true;
-    SOCKET_CLIENT client;
-    serializer cmd;
-    serializer id;
-    cmd.add<int>(GLIS_SERVER_COMMANDS.shm_params);
-    if (client.connect_to_server()) {
-        if (client.socket_put_serial(cmd)) {
-            client.socket_get_fd(sh.fd);
-            if (client.socket_get_serial(id)) {
-                if (client.disconnect_from_server()) {
-                    id.get<size_t>(&sh.size);
-                    id.get<size_t>(&sh.reference_count);
-                    return true;
-                } else
-                    LOG_ERROR("failed to disconnect from the server");
-            } else
-                LOG_ERROR("failed to get serial from the server");
-        } else
-            LOG_ERROR("failed to send window to the server");
-    } else
-        LOG_ERROR("failed to connect to server");
-    return false;
+// consumer side, waits up to timeout_ms for a command (0 does not wait, -1 waits forever)
+// and decodes it into S, returns false if the ring stayed empty
+// the producer writes the head and the length of every command, a length that does not fit
+// what the head says was written marks the ring corrupt and nothing more is read from it
+bool GLIS_command_ring_pop(GLIS_command_ring &ring, serializer &S, int timeout_ms) {
+    assert(ring.header != nullptr);
+    if (ring.corrupt) return false;
+    GLIS_command_ring_header *header = ring.header;
+    uint32_t tail = header->tail;
+    if (__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) == tail &&
+        !GLIS_command_ring_wait(&header->head, tail, &header->consumer_sleeping, timeout_ms))
+        return false;
+    uint32_t available = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) - tail;
+    uint32_t len = 0;
+    if (available >= sizeof(uint32_t))
+        GLIS_command_ring_copy_out(ring, tail, &len, sizeof(uint32_t));
+    if (available < sizeof(uint32_t) || available > ring.capacity ||
+        len > ring.capacity - sizeof(uint32_t) || len > available - sizeof(uint32_t)) {
+        LOG_ERROR_SHM("command ring is corrupt: %u bytes published, a command of %u bytes "
+                      "in a ring of %u bytes", available, len, ring.capacity);
+        ring.corrupt = true;
+        return false;
+    }
+    S.reset();
+    if (!S.stream.resize(len)) return false;
+    GLIS_command_ring_copy_out(ring, tail + sizeof(uint32_t), S.stream.data, len);
+    GLIS_command_ring_publish(&header->tail, tail + sizeof(uint32_t) + len,
+                              &header->producer_sleeping, -1);
+    S.deconstruct();
+    return true;
 }
 
 bool GLIS_shared_memory_open(GLIS_shared_memory &sh) {
@@ -301,175 +717,1032 @@ void GLIS_shared_memory_clear(GLIS_shared_memory &sh) {
     memset(sh.data, 0, sh.size);
 }
 
+// every window owns GLIS_FRAME_SLOTS frame slots in shared memory, the client renders into a
+// free slot and publishes it by index, the compositor latches the most recently published
+// slot and hands the slot it latched before back to the client
+//
+// this is a mailbox: publishing over a slot the compositor has not latched yet hands that
+// slot straight back to the client, so the client only waits when every slot is in flight
+// (one latched by the compositor, one published, the rest being rendered into)
+int GLIS_FRAME_SLOTS = 3;
+const int GLIS_FRAME_SLOTS_MAX = 4;
+
+// the state of a slot, accessed atomically
+const int32_t GLIS_frame_slot_free = 0;
+const int32_t GLIS_frame_slot_rendering = 1;
+const int32_t GLIS_frame_slot_published = 2;
+const int32_t GLIS_frame_slot_latched = 3;
+// free, but its pages were handed back to the kernel and must be pinned before reuse
+const int32_t GLIS_frame_slot_purgeable = 4;
+// the compositor is unpinning a free slot, the client treats it as in flight
+const int32_t GLIS_frame_slot_purging = 5;
+
+// slots start on a page boundary so each can be unpinned on its own
+const size_t GLIS_FRAME_SLOTS_ALIGNMENT = 4096;
+
+// the largest slot a window may ask for, more than a 4096 x 4096 frame needs, a slot size
+// comes from the client so it is bounded before it is aligned or allocated
+const size_t GLIS_FRAME_SLOT_SIZE_MAX = 64 * 1024 * 1024;
+
+// a window that has not published a frame for this long has its slots unpinned
+double GLIS_FRAME_SLOTS_IDLE_MS = 2000;
+
+// the most dirty rectangles a frame carries, more are merged into their bounding box
+const int GLIS_FRAME_DAMAGE_MAX = 16;
+
+// only the damaged rectangles of a slot hold valid pixels, they are laid out at their
+// position in a width x height frame, a full frame is a single rectangle covering it
+struct GLIS_frame_slot {
+    int32_t state;
+    GLint width;
+    GLint height;
+    int32_t damage_count;
+    GLIS_damage_rect damage[GLIS_FRAME_DAMAGE_MAX];
+};
+
+// layout: [GLIS_frame_slots_header, padded to GLIS_FRAME_SLOTS_ALIGNMENT][slot 0][slot 1] ...
+// slots are sized to the frames the window publishes, not to the screen
+struct GLIS_frame_slots_header {
+    uint32_t slot_count;
+    uint32_t slot_size;
+    // the most recently published slot the compositor has not latched yet, or -1,
+    // written by the client when it publishes and by the compositor when it latches
+    alignas(64) int32_t published;
+    // bumped by the compositor every time it hands a slot back, the client futex waits on it
+    // when every slot is in flight
+    alignas(64) int32_t released;
+    alignas(64) GLIS_frame_slot slots[GLIS_FRAME_SLOTS_MAX];
+};
+
+class GLIS_frame_slots {
+    public:
+        GLIS_shared_memory memory;
+        GLIS_frame_slots_header *header = nullptr;
+        // the layout the slots were created or opened with, kept out of the shared header as
+        // the other side can write to it at any time
+        uint32_t slot_count = 0;
+        uint32_t slot_size = 0;
+        int32_t latched = -1; // compositor side, the slot currently being displayed
+        bool purged = false; // compositor side, set while the slots are unpinned
+        // client side, the size of the last published frame, a damage update is only
+        // possible on top of a frame of the same size
+        GLint width = 0;
+        GLint height = 0;
+};
+
+size_t GLIS_frame_slots_align(size_t size) {
+    return (size + GLIS_FRAME_SLOTS_ALIGNMENT - 1) & ~(GLIS_FRAME_SLOTS_ALIGNMENT - 1);
+}
+
+const size_t GLIS_FRAME_SLOTS_DATA_OFFSET = GLIS_frame_slots_align(sizeof(GLIS_frame_slots_header));
+
+// the aligned size of a slot holding size bytes, 0 if size is more than
+// GLIS_FRAME_SLOT_SIZE_MAX
+uint32_t GLIS_frame_slots_slot_size(size_t size) {
+    if (size > GLIS_FRAME_SLOT_SIZE_MAX) {
+        LOG_ERROR("frame slots of %zu bytes are larger than the %zu allowed", size,
+                  GLIS_FRAME_SLOT_SIZE_MAX);
+        return 0;
+    }
+    return static_cast<uint32_t>(GLIS_frame_slots_align(size != 0 ? size : 1));
+}
+
+size_t GLIS_frame_slots_size(uint32_t slot_count, uint32_t slot_size) {
+    return GLIS_FRAME_SLOTS_DATA_OFFSET + static_cast<size_t>(slot_count) * slot_size;
+}
+
+const size_t GLIS_FRAME_SLOTS_INVALID_OFFSET = SIZE_MAX;
+
+// returns GLIS_FRAME_SLOTS_INVALID_OFFSET if slot is not one of the window's slots
+size_t GLIS_frame_slots_offset(GLIS_frame_slots &frames, int32_t slot) {
+    if (slot < 0 || static_cast<uint32_t>(slot) >= frames.slot_count) {
+        LOG_ERROR("frame slot %d is out of range, there are %u", slot, frames.slot_count);
+        return GLIS_FRAME_SLOTS_INVALID_OFFSET;
+    }
+    return GLIS_FRAME_SLOTS_DATA_OFFSET + static_cast<size_t>(slot) * frames.slot_size;
+}
+
+// returns nullptr if slot is not one of the window's slots
+int8_t *GLIS_frame_slots_data(GLIS_frame_slots &frames, int32_t slot) {
+    size_t offset = GLIS_frame_slots_offset(frames, slot);
+    if (offset == GLIS_FRAME_SLOTS_INVALID_OFFSET) return nullptr;
+    return frames.memory.data + offset;
+}
+
+void GLIS_frame_slots_initialize(GLIS_frame_slots &frames, uint32_t slot_count,
+                                 uint32_t slot_size) {
+    frames.header = reinterpret_cast<GLIS_frame_slots_header *>(frames.memory.data);
+    frames.header->slot_count = slot_count;
+    frames.header->slot_size = slot_size;
+    frames.slot_count = slot_count;
+    frames.slot_size = slot_size;
+    frames.header->released = 0;
+    for (int i = 0; i < GLIS_FRAME_SLOTS_MAX; i++) {
+        frames.header->slots[i].state = GLIS_frame_slot_free;
+        frames.header->slots[i].width = 0;
+        frames.header->slots[i].height = 0;
+        frames.header->slots[i].damage_count = 0;
+    }
+    __atomic_store_n(&frames.header->published, -1, __ATOMIC_RELEASE);
+    frames.latched = -1;
+    frames.purged = false;
+}
+
+// compositor side, allocates and initializes the slots of a window, the region is sealed
+// against shrinking so the other side may map it
+bool GLIS_frame_slots_create(GLIS_frame_slots &frames, uint32_t slot_count, size_t size) {
+    assert(slot_count >= 2 && slot_count <= GLIS_FRAME_SLOTS_MAX);
+    uint32_t slot_size = GLIS_frame_slots_slot_size(size);
+    if (slot_size == 0) return false;
+    if (!GLIS_shared_memory_malloc(frames.memory, GLIS_frame_slots_size(slot_count, slot_size))) {
+        LOG_ERROR("failed to allocate %u frame slots of %u bytes", slot_count, slot_size);
+        return false;
+    }
+    SHM_seal(frames.memory.fd, true);
+    frames.memory.reference_count = 1;
+    GLIS_frame_slots_initialize(frames, slot_count, slot_size);
+    return true;
+}
+
+// compositor side, resizes every slot of a window to hold size bytes, the client must not be
+// using any slot and every frame it published is dropped, replaced is set if the region
+// was replaced and the client needs its new fd
+// the region is sealed against shrinking, so smaller slots always get a new region, as they
+// do with ashmem, if size is out of bounds the slots are left as they are
+bool GLIS_frame_slots_resize(GLIS_frame_slots &frames, size_t size, bool &replaced) {
+    assert(frames.header != nullptr);
+    replaced = false;
+    uint32_t slot_count = frames.slot_count;
+    uint32_t slot_size = GLIS_frame_slots_slot_size(size);
+    if (slot_size == 0) return false;
+    size_t frames_size = GLIS_frame_slots_size(slot_count, slot_size);
+    if (frames_size < frames.memory.size) {
+        GLIS_shared_memory region;
+        if (!GLIS_shared_memory_malloc(region, frames_size)) {
+            LOG_ERROR("failed to shrink %u frame slots to %u bytes", slot_count, slot_size);
+            return false;
+        }
+        region.reference_count = frames.memory.reference_count;
+        GLIS_shared_memory_free(frames.memory);
+        frames.memory = region;
+        replaced = true;
+    } else if (!GLIS_shared_memory_realloc(frames.memory, frames_size, replaced)) {
+        LOG_ERROR("failed to resize %u frame slots to %u bytes", slot_count, slot_size);
+        frames.header = nullptr;
+        return false;
+    }
+    if (replaced) SHM_seal(frames.memory.fd, true);
+    GLIS_frame_slots_initialize(frames, slot_count, slot_size);
+    return true;
+}
+
+// maps slots the other side created, frames.memory.fd and size must be set, the layout in
+// their header is checked against the size of the region once and kept in frames, on failure
+// the region is unmapped but fd is left open
+bool GLIS_frame_slots_open(GLIS_frame_slots &frames) {
+    if (frames.memory.size < GLIS_FRAME_SLOTS_DATA_OFFSET) {
+        LOG_ERROR("%zu bytes can not hold any frame slots", frames.memory.size);
+        return false;
+    }
+    if (!GLIS_shared_memory_open(frames.memory)) {
+        LOG_ERROR("failed to open the frame slots");
+        return false;
+    }
+    frames.memory.reference_count = 1;
+    GLIS_frame_slots_header *header =
+        reinterpret_cast<GLIS_frame_slots_header *>(frames.memory.data);
+    uint32_t slot_count = __atomic_load_n(&header->slot_count, __ATOMIC_RELAXED);
+    uint32_t slot_size = __atomic_load_n(&header->slot_size, __ATOMIC_RELAXED);
+    if (slot_count < 2 || slot_count > GLIS_FRAME_SLOTS_MAX || slot_size == 0 ||
+        GLIS_FRAME_SLOTS_DATA_OFFSET + static_cast<uint64_t>(slot_count) * slot_size >
+        frames.memory.size) {
+        LOG_ERROR("%u frame slots of %u bytes do not fit a region of %zu bytes", slot_count,
+                  slot_size, frames.memory.size);
+        munmap(frames.memory.data, frames.memory.size);
+        frames.memory.data = nullptr;
+        return false;
+    }
+    frames.header = header;
+    frames.slot_count = slot_count;
+    frames.slot_size = slot_size;
+    return true;
+}
+
+void GLIS_frame_slots_free(GLIS_frame_slots &frames) {
+    if (frames.memory.data != nullptr) GLIS_shared_memory_free(frames.memory);
+    frames.header = nullptr;
+    frames.slot_count = 0;
+    frames.slot_size = 0;
+    frames.latched = -1;
+}
+
+// client side, returns a slot to render into, blocks only while every slot is in flight
+int32_t GLIS_frame_slots_acquire(GLIS_frame_slots &frames) {
+    GLIS_frame_slots_header *header = frames.header;
+    assert(header != nullptr);
+    for (;;) {
+        int32_t released = __atomic_load_n(&header->released, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < frames.slot_count; i++) {
+            int32_t expected = GLIS_frame_slot_free;
+            if (__atomic_compare_exchange_n(&header->slots[i].state, &expected,
+                                            GLIS_frame_slot_rendering, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                header->slots[i].damage_count = 0;
+                return static_cast<int32_t>(i);
+            }
+            if (expected == GLIS_frame_slot_purgeable &&
+                __atomic_compare_exchange_n(&header->slots[i].state, &expected,
+                                            GLIS_frame_slot_rendering, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                SHM_pin(frames.memory.fd, GLIS_frame_slots_offset(frames, i), frames.slot_size);
+                header->slots[i].damage_count = 0;
+                return static_cast<int32_t>(i);
+            }
+        }
+        futex_wait(&header->released, released, nullptr);
+    }
+}
+
+// adds count rectangles to the damage of a slot, if they do not all fit the damage
+// becomes the bounding box of every rectangle, so the caller must fill the slot's
+// damage only after every rectangle has been added
+void GLIS_frame_slots_add_damage(GLIS_frame_slots &frames, int32_t slot, const GLIS_damage_rect *rects,
+                                 int32_t count) {
+    GLIS_frame_slot &s = frames.header->slots[slot];
+    if (s.damage_count + count <= GLIS_FRAME_DAMAGE_MAX) {
+        for (int32_t i = 0; i < count; i++) s.damage[s.damage_count++] = rects[i];
+        return;
+    }
+    GLint x0 = INT_MAX, y0 = INT_MAX, x1 = 0, y1 = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        const GLIS_damage_rect *r = pass == 0 ? s.damage : rects;
+        int32_t n = pass == 0 ? s.damage_count : count;
+        for (int32_t i = 0; i < n; i++) {
+            if (r[i].x < x0) x0 = r[i].x;
+            if (r[i].y < y0) y0 = r[i].y;
+            if (r[i].x + r[i].width > x1) x1 = r[i].x + r[i].width;
+            if (r[i].y + r[i].height > y1) y1 = r[i].y + r[i].height;
+        }
+    }
+    s.damage[0] = {x0, y0, x1 - x0, y1 - y0};
+    s.damage_count = 1;
+}
+
+// client side, takes back the published slot if the compositor has not latched it yet,
+// returns it or -1, the caller carries its damage into the next frame and frees it with
+// GLIS_frame_slots_release
+int32_t GLIS_frame_slots_reclaim(GLIS_frame_slots &frames) {
+    int32_t previous = __atomic_load_n(&frames.header->published, __ATOMIC_ACQUIRE);
+    // only the client publishes, so if this fails the compositor latched it
+    if (previous >= 0 &&
+        __atomic_compare_exchange_n(&frames.header->published, &previous, -1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return previous;
+    return -1;
+}
+
+void GLIS_frame_slots_release(GLIS_frame_slots &frames, int32_t slot) {
+    __atomic_store_n(&frames.header->slots[slot].state, GLIS_frame_slot_free, __ATOMIC_RELEASE);
+}
+
+// client side, hands a rendered slot to the compositor, if the previously published slot
+// was never latched it is handed straight back as it will never be displayed, so a slot
+// carrying only damage must reclaim the previous slot and carry its damage over first
+void GLIS_frame_slots_publish_damage(GLIS_frame_slots &frames, int32_t slot, GLint width,
+                                     GLint height) {
+    GLIS_frame_slots_header *header = frames.header;
+    assert(header != nullptr);
+    assert(static_cast<size_t>(width) * height * sizeof(GLuint) <= frames.slot_size);
+    header->slots[slot].width = width;
+    header->slots[slot].height = height;
+    frames.width = width;
+    frames.height = height;
+    __atomic_store_n(&header->slots[slot].state, GLIS_frame_slot_published, __ATOMIC_RELEASE);
+    int32_t previous = __atomic_exchange_n(&header->published, slot, __ATOMIC_ACQ_REL);
+    if (previous >= 0) GLIS_frame_slots_release(frames, previous);
+}
+
+// client side, publishes a slot holding a whole frame
+void GLIS_frame_slots_publish(GLIS_frame_slots &frames, int32_t slot, GLint width,
+                              GLint height) {
+    GLIS_frame_slot &s = frames.header->slots[slot];
+    s.damage[0] = {0, 0, width, height};
+    s.damage_count = 1;
+    GLIS_frame_slots_publish_damage(frames, slot, width, height);
+}
+
+// compositor side, latches the most recently published slot and hands back the slot latched
+// before it, returns the newly latched slot or -1 if nothing was published since the last latch
+int32_t GLIS_frame_slots_latch(GLIS_frame_slots &frames) {
+    GLIS_frame_slots_header *header = frames.header;
+    assert(header != nullptr);
+    int32_t slot = __atomic_exchange_n(&header->published, -1, __ATOMIC_ACQ_REL);
+    if (slot < 0) return -1;
+    if (static_cast<uint32_t>(slot) >= frames.slot_count) {
+        LOG_ERROR("the client published frame slot %d, there are %u", slot, frames.slot_count);
+        return -1;
+    }
+    __atomic_store_n(&header->slots[slot].state, GLIS_frame_slot_latched, __ATOMIC_RELAXED);
+    if (frames.latched >= 0) {
+        // a slot unpinned while it was latched must be pinned again by the client
+        __atomic_store_n(&header->slots[frames.latched].state,
+                         frames.purged ? GLIS_frame_slot_purgeable : GLIS_frame_slot_free,
+                         __ATOMIC_RELEASE);
+        __atomic_add_fetch(&header->released, 1, __ATOMIC_RELEASE);
+        futex_wake_all(&header->released);
+    }
+    frames.latched = slot;
+    frames.purged = false;
+    return slot;
+}
+
+// compositor side, copies what the client wrote about a latched slot into frame, so it can
+// not change once checked, returns false if the frame does not fit the slot or a damaged
+// rectangle lies outside of the frame, in which case the frame must be dropped
+bool GLIS_frame_slots_latched_frame(GLIS_frame_slots &frames, int32_t slot,
+                                    GLIS_frame_slot &frame) {
+    const GLIS_frame_slot &shared = frames.header->slots[slot];
+    frame.width = __atomic_load_n(&shared.width, __ATOMIC_RELAXED);
+    frame.height = __atomic_load_n(&shared.height, __ATOMIC_RELAXED);
+    frame.damage_count = __atomic_load_n(&shared.damage_count, __ATOMIC_RELAXED);
+    if (frame.width <= 0 || frame.height <= 0 ||
+        static_cast<uint64_t>(frame.width) * static_cast<uint64_t>(frame.height) *
+        sizeof(GLuint) > frames.slot_size) {
+        LOG_ERROR("a %dx%d frame does not fit a frame slot of %u bytes", frame.width,
+                  frame.height, frames.slot_size);
+        return false;
+    }
+    if (frame.damage_count < 0 || frame.damage_count > GLIS_FRAME_DAMAGE_MAX) {
+        LOG_ERROR("a frame carries %d damaged rectangles, at most %d are allowed",
+                  frame.damage_count, GLIS_FRAME_DAMAGE_MAX);
+        return false;
+    }
+    memcpy(frame.damage, shared.damage, sizeof(GLIS_damage_rect) * frame.damage_count);
+    for (int32_t i = 0; i < frame.damage_count; i++) {
+        const GLIS_damage_rect &r = frame.damage[i];
+        if (r.x < 0 || r.y < 0 || r.width < 0 || r.height < 0 ||
+            static_cast<int64_t>(r.x) + r.width > frame.width ||
+            static_cast<int64_t>(r.y) + r.height > frame.height) {
+            LOG_ERROR("damaged rectangle %d,%d %dx%d lies outside of a %dx%d frame", r.x, r.y,
+                      r.width, r.height, frame.width, frame.height);
+            return false;
+        }
+    }
+    return true;
+}
+
+// compositor side, unpins the slots of a window that stopped publishing frames so the kernel
+// can reclaim them, the latched slot is already in the window's texture, slots the client
+// is rendering into or has published are left alone, returns the number of bytes unpinned
+size_t GLIS_frame_slots_purge(GLIS_frame_slots &frames) {
+    GLIS_frame_slots_header *header = frames.header;
+    if (header == nullptr || frames.purged) return 0;
+    size_t purged = 0;
+    for (uint32_t i = 0; i < frames.slot_count; i++) {
+        int32_t slot = static_cast<int32_t>(i);
+        if (slot == frames.latched) {
+            if (SHM_unpin(frames.memory.fd, GLIS_frame_slots_offset(frames, slot),
+                          frames.slot_size))
+                purged += frames.slot_size;
+            continue;
+        }
+        int32_t expected = GLIS_frame_slot_free;
+        if (!__atomic_compare_exchange_n(&header->slots[i].state, &expected,
+                                         GLIS_frame_slot_purging, false, __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED))
+            continue;
+        if (SHM_unpin(frames.memory.fd, GLIS_frame_slots_offset(frames, slot),
+                      frames.slot_size))
+            purged += frames.slot_size;
+        __atomic_store_n(&header->slots[i].state, GLIS_frame_slot_purgeable, __ATOMIC_RELEASE);
+        // the client may have gone to sleep while this slot was purging
+        __atomic_add_fetch(&header->released, 1, __ATOMIC_RELEASE);
+        futex_wake_all(&header->released);
+    }
+    frames.purged = true;
+    return purged;
+}
+
+// the channel of this process when it is a client
 GLIS_shared_memory GLIS_INTERNAL_SHARED_MEMORY_PARAMETER;
-GLIS_shared_memory GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA;
+GLIS_command_ring GLIS_INTERNAL_COMMAND_RING_REQUESTS;
+GLIS_command_ring GLIS_INTERNAL_COMMAND_RING_REPLIES;
 SOCKET_CLIENT KEEP_ALIVE;
+// the frame slots of every window this process has created, indexed by window id
+std::vector<GLIS_frame_slots *> GLIS_INTERNAL_WINDOW_FRAMES;
+// in socket mode, windows create their own frame slots and register them with the compositor
+// on their first frame, later frames are published into a slot and only announced, instead of
+// their pixels being sent through the socket every frame
+bool GLIS_CLIENT_WINDOW_FRAMES = true;
+
+GLIS_frame_slots *GLIS_window_frames(size_t window_id) {
+    if (window_id >= GLIS_INTERNAL_WINDOW_FRAMES.size()) return nullptr;
+    return GLIS_INTERNAL_WINDOW_FRAMES[window_id];
+}
+
+// replaces the frame slots of a window, frames may be nullptr, the previous slots are freed
+void GLIS_window_frames_set(size_t window_id, GLIS_frame_slots *frames) {
+    if (GLIS_INTERNAL_WINDOW_FRAMES.size() <= window_id)
+        GLIS_INTERNAL_WINDOW_FRAMES.resize(window_id + 1, nullptr);
+    GLIS_frame_slots *previous = GLIS_INTERNAL_WINDOW_FRAMES[window_id];
+    if (previous != nullptr) {
+        GLIS_frame_slots_free(*previous);
+        delete previous;
+    }
+    GLIS_INTERNAL_WINDOW_FRAMES[window_id] = frames;
+}
+
+// the connection this process keeps open to the compositor's main server, every request
+// starts with an id the compositor echoes at the start of its reply, so several requests can
+// be in flight at once and their replies collected in any order
+class GLIS_session {
+    public:
+        SOCKET_CLIENT connection;
+        bool connected = false;
+        uint32_t next_request = 0;
+        // replies that arrived while waiting for the reply to another request
+        std::vector<std::pair<uint32_t, serializer *>> replies;
+};
+
+GLIS_session GLIS_INTERNAL_SESSION;
+
+// connects on first use, and again after the connection has failed
+bool GLIS_session_open(GLIS_session &session) {
+    if (session.connected) return true;
+    if (!session.connection.connect_to_server()) {
+        LOG_ERROR("failed to connect to server");
+        return false;
+    }
+    session.connected = true;
+    return true;
+}
+
+void GLIS_session_close(GLIS_session &session) {
+    if (!session.connected) return;
+    session.connection.disconnect_from_server();
+    session.connected = false;
+    for (std::pair<uint32_t, serializer *> &reply : session.replies) delete reply.second;
+    session.replies.clear();
+}
+
+// starts a request, the command is encoded into request after the id this returns
+uint32_t GLIS_session_request(GLIS_session &session, serializer &request) {
+    uint32_t id = session.next_request++;
+    request.add<uint32_t>(id);
+    return id;
+}
+
+// sends a request without waiting for its reply, fds are attached to it
+bool GLIS_session_send(GLIS_session &session, serializer &request, const int *fds = nullptr,
+                       size_t fd_count = 0) {
+    if (!GLIS_session_open(session)) return false;
+    if (!session.connection.socket_put_serial(request, fds, fd_count)) {
+        LOG_ERROR("failed to send command to the server");
+        GLIS_session_close(session);
+        return false;
+    }
+    return true;
+}
+
+// waits for the reply to request, replies to other requests that arrive first are kept until
+// they are waited for, reply is left positioned after the id
+bool GLIS_session_reply(GLIS_session &session, uint32_t request, serializer &reply) {
+    for (size_t i = 0; i < session.replies.size(); i++) {
+        if (session.replies[i].first != request) continue;
+        reply.swap(*session.replies[i].second);
+        delete session.replies[i].second;
+        session.replies.erase(session.replies.begin() + i);
+        return true;
+    }
+    if (!session.connected) return false;
+    for (;;) {
+        serializer *incoming = new serializer;
+        if (!session.connection.socket_get_serial(*incoming)) {
+            LOG_ERROR("failed to get serial from the server");
+            delete incoming;
+            GLIS_session_close(session);
+            return false;
+        }
+        uint32_t id = 0;
+        incoming->get<uint32_t>(&id);
+        if (id == request) {
+            reply.swap(*incoming);
+            delete incoming;
+            return true;
+        }
+        session.replies.push_back(std::make_pair(id, incoming));
+    }
+}
+
+bool GLIS_session_call(GLIS_session &session, uint32_t request, serializer &command,
+                       serializer &reply) {
+    return GLIS_session_send(session, command) && GLIS_session_reply(session, request, reply);
+}
+
+// the compositor side of a client connected through new_connection
+class GLIS_client_channel {
+    public:
+        size_t server_id = 0; // the keep alive server
+        GLIS_shared_memory parameter; // request and reply rings
+        GLIS_command_ring requests;
+        GLIS_command_ring replies;
+        int doorbell = -1; // eventfd the client writes when the compositor sleeps
+        bool connected = true; // cleared by the keep alive thread, accessed atomically
+        bool disconnecting = false; // compositor side, set by GLIS_client_channel_disconnect
+};
+
+std::vector<GLIS_client_channel *> GLIS_CLIENT_CHANNELS;
+
+void GLIS_client_channel_free(GLIS_client_channel *channel) {
+    if (channel->parameter.data != nullptr) GLIS_shared_memory_free(channel->parameter);
+    if (channel->doorbell >= 0) close(channel->doorbell);
+    delete channel;
+}
+
+GLIS_client_channel *GLIS_client_channel_create() {
+    GLIS_client_channel *channel = new GLIS_client_channel;
+    if (!GLIS_shared_memory_malloc(channel->parameter,
+                                   GLIS_command_rings_size(GLIS_COMMAND_RING_CAPACITY))) {
+        LOG_ERROR("failed to allocate the parameter channel");
+        GLIS_client_channel_free(channel);
+        return nullptr;
+    }
+    // the rings never change size
+    SHM_seal(channel->parameter.fd);
+    channel->doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (channel->doorbell < 0) {
+        LOG_ERROR("eventfd: errno: %d (%s)", errno, strerror(errno));
+        GLIS_client_channel_free(channel);
+        return nullptr;
+    }
+    channel->parameter.reference_count = 1;
+    GLIS_command_rings_map(channel->parameter, channel->requests, channel->replies, true);
+    return channel;
+}
+
+bool GLIS_client_channel_connected(GLIS_client_channel *channel) {
+    return __atomic_load_n(&channel->connected, __ATOMIC_ACQUIRE);
+}
+
+// drops the keep alive connection of a client that broke its channel, its keep alive thread
+// then clears connected as if the client had disconnected and the channel is collected
+void GLIS_client_channel_disconnect(GLIS_client_channel *channel) {
+    if (channel->disconnecting || !GLIS_client_channel_connected(channel)) return;
+    LOG_ERROR("disconnecting client %zu", channel->server_id);
+    channel->disconnecting = true;
+    shutdown(SERVER_get(channel->server_id)->socket_data_fd, SHUT_RDWR);
+}
+
+// frees the channels of every client that has disconnected, their doorbells are watched by
+// server
+void GLIS_client_channels_collect(SOCKET_SERVER &server,
+                                  std::vector<GLIS_client_channel *> &channels) {
+    for (size_t i = 0; i < channels.size();) {
+        if (!GLIS_client_channel_connected(channels[i])) {
+            LOG_INFO("client %zu disconnected, releasing its channel", channels[i]->server_id);
+            server.socket_unwatch(channels[i]->doorbell);
+            GLIS_client_channel_free(channels[i]);
+            channels.erase(channels.begin() + i);
+        } else i++;
+    }
+}
 
-// this function gets called whenever a handle is passed
-void GLIS_shared_memory_increase_reference(GLIS_shared_memory &shared_memory) {
-    shared_memory.reference_count++;
+// flags every client's request ring as having a sleeping consumer, a producer that publishes
+// after this point sees the flag and rings the channel's doorbell
+// returns true if a command or a disconnect is already pending, in which case the caller must
+// not sleep
+bool GLIS_client_channels_sleep(std::vector<GLIS_client_channel *> &channels) {
+    bool pending = false;
+    for (GLIS_client_channel *channel : channels) {
+        GLIS_command_ring_header *header = channel->requests.header;
+        __atomic_store_n(&header->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->head, __ATOMIC_SEQ_CST) != header->tail ||
+            !GLIS_client_channel_connected(channel))
+            pending = true;
+    }
+    return pending;
+}
+
+// clears the flags set by GLIS_client_channels_sleep and empties the doorbells that rang
+void GLIS_client_channels_wake(std::vector<GLIS_client_channel *> &channels,
+                               const std::vector<int> &doorbells) {
+    for (GLIS_client_channel *channel : channels)
+        __atomic_store_n(&channel->requests.header->consumer_sleeping, 0, __ATOMIC_RELAXED);
+    for (int doorbell : doorbells) {
+        eventfd_t value;
+        eventfd_read(doorbell, &value);
+    }
 }
 
+// sleeps until a client queues a command on its request ring, a client disconnects,
+// or timeout_ms has elapsed, the compositor waits on its server instead so that its
+// sessions share the same wait point
+void GLIS_client_channels_wait(std::vector<GLIS_client_channel *> &channels, int timeout_ms) {
+    static std::vector<struct pollfd> fds;
+    static std::vector<int> rang;
+    fds.clear();
+    rang.clear();
+    for (GLIS_client_channel *channel : channels) {
+        struct pollfd doorbell = {0};
+        doorbell.fd = channel->doorbell;
+        doorbell.events = POLLIN;
+        fds.push_back(doorbell);
+    }
+    if (!GLIS_client_channels_sleep(channels)) {
+        int ret = poll(fds.data(), fds.size(), timeout_ms);
+        if (ret < 0 && errno != EINTR)
+            LOG_ERROR("poll: errno: %d (%s)", errno, strerror(errno));
+    }
+    for (struct pollfd &doorbell : fds)
+        if (doorbell.revents & POLLIN) rang.push_back(doorbell.fd);
+    GLIS_client_channels_wake(channels, rang);
+}
+
+// runs on its own thread for every client, hands the client its channel over the keep alive
+// connection then waits for the client to disconnect
 void *KEEP_ALIVE_MAIN_NOTIFIER(void *arg) {
     int *ret = new int;
     assert(arg != nullptr);
-    struct pa {
-        size_t table_id;
-
-        class GLIS_shared_memory *params;
-    } *p;
-    p = static_cast<pa *>(arg);
-    SOCKET_SERVER *server = SERVER_get(p->table_id);
+    GLIS_client_channel *channel = static_cast<GLIS_client_channel *>(arg);
+    SOCKET_SERVER *server = SERVER_get(channel->server_id);
     server->socket_accept();
+    serializer out;
+    GLIS_channel_reply reply = {channel->parameter.size};
+    GLIS_REPLY_channel::encode(out, reply);
+    int fds[2] = {channel->parameter.fd, channel->doorbell};
+    server->socket_put_serial(out, fds, 2);
     server->connection_wait_until_disconnect();
     server->shutdownServer();
-    LOG_INFO_SERVER("params.reference_count = %zu", p->params->reference_count);
-    p->params->reference_count--;
-    LOG_INFO_SERVER("params.reference_count = %zu", p->params->reference_count);
+    LOG_INFO_SERVER("client %zu has disconnected", channel->server_id);
+    channel->parameter.reference_count = 0;
+    // wake the compositor if it is waiting on its server, the channel is
+    // freed by the compositor once it sees connected cleared so it must not be touched after that
+    eventfd_write(channel->doorbell, 1);
+    __atomic_store_n(&channel->connected, false, __ATOMIC_RELEASE);
     *ret = 0;
     return ret;
 }
 
+// receives the channel the compositor created for us over the keep alive connection
+bool GLIS_client_channel_receive(SOCKET_CLIENT &keep_alive, GLIS_shared_memory &parameter) {
+    int doorbell = -1;
+    serializer in;
+    GLIS_channel_reply reply;
+    if (!keep_alive.socket_get_serial(in)) {
+        LOG_ERROR("failed to get the channel from the server");
+        return false;
+    }
+    keep_alive.socket_get_fd(parameter.fd);
+    keep_alive.socket_get_fd(doorbell);
+    if (!GLIS_REPLY_channel::decode(in, reply)) {
+        LOG_ERROR("failed to decode the channel");
+        return false;
+    }
+    parameter.size = reply.parameter_size;
+    parameter.reference_count = 1;
+    if (!GLIS_shared_memory_open(parameter)) {
+        LOG_ERROR("failed to open shared memory parameter");
+        return false;
+    }
+    if (!GLIS_command_rings_map(parameter, GLIS_INTERNAL_COMMAND_RING_REQUESTS,
+                                GLIS_INTERNAL_COMMAND_RING_REPLIES, false)) {
+        LOG_ERROR("the channel's command rings are invalid");
+        return false;
+    }
+    GLIS_INTERNAL_COMMAND_RING_REQUESTS.doorbell = doorbell;
+    return true;
+}
+
 bool GLIS_SHARED_MEMORY_INITIALIZED = false;
 
-bool GLIS_INIT_SHARED_MEMORY(GLIS_shared_memory &shared_memory, GLIS_shared_memory &parameter) {
+bool GLIS_INIT_SHARED_MEMORY(GLIS_shared_memory &parameter) {
     if (GLIS_SHARED_MEMORY_INITIALIZED) return true;
     SERVER_LOG_TRANSFER_INFO = true;
-    SOCKET_CLIENT client;
     serializer cmd;
     serializer server;
+    uint32_t request = GLIS_session_request(GLIS_INTERNAL_SESSION, cmd);
     cmd.add<int>(GLIS_SERVER_COMMANDS.new_connection);
-    if (client.connect_to_server()) {
-        if (client.socket_put_serial(cmd)) {
-            if (client.socket_get_serial(server)) {
-                if (client.disconnect_from_server()) {
-                    char *server_name;
-                    server.get_raw_pointer<char>(&server_name);
-                    KEEP_ALIVE.set_name(server_name);
-                    delete[] server_name;
-                    if (KEEP_ALIVE.connect_to_server()) {
-                        if (GLIS_shared_memory_get(shared_memory)) {
-                            if (GLIS_shared_memory_open(shared_memory)) {
-                                if (GLIS_shared_memory_params_get(parameter)) {
-                                    if (GLIS_shared_memory_open(parameter)) {
-                                        GLIS_SHARED_MEMORY_INITIALIZED = true;
-                                        return true;
-                                    } else
-                                        LOG_ERROR("failed to open shared memory parameter");
-                                } else
-                                    LOG_ERROR("failed to get shared memory parameter");
-                            } else
-                                LOG_ERROR("failed to open shared memory texture");
-                        } else
-                            LOG_ERROR("failed to get shared memory texture");
-                    } else
-                        LOG_ERROR("failed to connect to the server");
-                } else
-                    LOG_ERROR("failed to disconnect from the server");
+    if (GLIS_session_call(GLIS_INTERNAL_SESSION, request, cmd, server)) {
+        char *server_name;
+        server.get_raw_pointer<char>(&server_name);
+        KEEP_ALIVE.set_name(server_name);
+        delete[] server_name;
+        if (KEEP_ALIVE.connect_to_server()) {
+            if (GLIS_client_channel_receive(KEEP_ALIVE, parameter)) {
+                GLIS_SHARED_MEMORY_INITIALIZED = true;
+                return true;
             } else
-                LOG_ERROR("failed to get serial from the server");
+                LOG_ERROR("failed to receive the channel from the server");
         } else
-            LOG_ERROR("failed to send command to the server");
-    } else
-        LOG_ERROR("failed to connect to server");
+            LOG_ERROR("failed to connect to the server");
+    }
     return false;
 };
 
 bool GLIS_INIT_SHARED_MEMORY() {
-    return GLIS_INIT_SHARED_MEMORY(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA,
-                                   GLIS_INTERNAL_SHARED_MEMORY_PARAMETER);
+    return GLIS_INIT_SHARED_MEMORY(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER);
+}
+
+// receives the frame slots the compositor created along with a window
+bool GLIS_window_frames_receive(const GLIS_new_window_reply &reply) {
+    if (reply.frames_size == 0) {
+        LOG_ERROR("the server failed to create the frame slots of window %zu", reply.window_id);
+        return false;
+    }
+    GLIS_frame_slots *frames = new GLIS_frame_slots;
+    KEEP_ALIVE.socket_get_fd(frames->memory.fd);
+    frames->memory.size = reply.frames_size;
+    if (!GLIS_frame_slots_open(*frames)) {
+        delete frames;
+        return false;
+    }
+    GLIS_window_frames_set(reply.window_id, frames);
+    return true;
+}
+
+// socket mode, creates frame slots for width x height frames and registers them with the
+// compositor as the slots of a window, their fd is attached to the command so this happens
+// once per window and again only when its frames change size
+bool GLIS_window_frames_register(size_t window_id, GLint width, GLint height) {
+    GLIS_frame_slots *frames = new GLIS_frame_slots;
+    if (!GLIS_frame_slots_create(*frames, static_cast<uint32_t>(GLIS_FRAME_SLOTS),
+                                 static_cast<size_t>(width) * height * sizeof(GLuint))) {
+        delete frames;
+        return false;
+    }
+    serializer request;
+    serializer response;
+    uint32_t id = GLIS_session_request(GLIS_INTERNAL_SESSION, request);
+    GLIS_register_frames_payload payload = {window_id, frames->memory.size};
+    GLIS_register_frames_reply reply = {false};
+    GLIS_MESSAGE_register_window_frames::encode(request, payload);
+    if (!GLIS_session_send(GLIS_INTERNAL_SESSION, request, &frames->memory.fd, 1) ||
+        !GLIS_session_reply(GLIS_INTERNAL_SESSION, id, response) ||
+        !GLIS_REPLY_register_window_frames::decode(response, reply) || !reply.registered) {
+        // the compositor has dropped any slots registered before, so frames are sent whole
+        LOG_ERROR("failed to register the frame slots of window %zu", window_id);
+        GLIS_frame_slots_free(*frames);
+        delete frames;
+        GLIS_window_frames_set(window_id, nullptr);
+        return false;
+    }
+    GLIS_window_frames_set(window_id, frames);
+    return true;
 }
 
 size_t GLIS_new_window(int x, int y, int w, int h) {
     serializer window;
     serializer id;
-    int win[4] = {x, y, x + w, y + h};
-    window.add<int>(GLIS_SERVER_COMMANDS.new_window);
-    window.add_pointer<int>(win, 4);
+    GLIS_new_window_payload payload = {{x, y, x + w, y + h}};
+    GLIS_new_window_reply reply;
+    uint32_t request = 0;
+    if (IPC == IPC_MODE.socket) request = GLIS_session_request(GLIS_INTERNAL_SESSION, window);
+    GLIS_MESSAGE_new_window::encode(window, payload);
     if (IPC == IPC_MODE.shared_memory) {
-        GLIS_shared_memory_write(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER, window);
-        GLIS_shared_memory_read(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER, id);
-        size_t window_id;
-        id.get<size_t>(&window_id);
-        return window_id;
+        GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, window);
+        GLIS_command_ring_pop(GLIS_INTERNAL_COMMAND_RING_REPLIES, id, -1);
+        if (!GLIS_REPLY_new_window::decode(id, reply)) {
+            LOG_ERROR("failed to decode the window id");
+            return static_cast<size_t>(-1);
+        }
+        if (!GLIS_window_frames_receive(reply)) return static_cast<size_t>(-1);
+        return reply.window_id;
     } else if (IPC == IPC_MODE.socket) {
-        SOCKET_CLIENT client;
-        if (client.connect_to_server()) {
-            if (client.socket_put_serial(window)) {
-                if (client.socket_get_serial(id)) {
-                    if (client.disconnect_from_server()) {
-                        size_t window_id;
-                        id.get<size_t>(&window_id);
-                        return window_id;
-                    } else
-                        LOG_ERROR("failed to disconnect from the server");
-                } else
-                    LOG_ERROR("failed to get serial from the server");
-            } else
-                LOG_ERROR("failed to send command to the server");
-        } else
-            LOG_ERROR("failed to connect to server");
+        if (GLIS_session_call(GLIS_INTERNAL_SESSION, request, window, id)) {
+            if (GLIS_REPLY_new_window::decode(id, reply)) return reply.window_id;
+            LOG_ERROR("failed to decode the window id");
+        }
     }
     return static_cast<size_t>(-1);
 }
 
 bool GLIS_modify_window(size_t window_id, int x, int y, int w, int h) {
     serializer window;
-    int win[4] = {x, y, x + w, y + h};
-    window.add<int>(GLIS_SERVER_COMMANDS.modify_window);
-    window.add<size_t>(window_id);
-    window.add_pointer<int>(win, 4);
+    GLIS_modify_window_payload payload = {window_id, {x, y, x + w, y + h}};
+    if (IPC == IPC_MODE.socket) GLIS_session_request(GLIS_INTERNAL_SESSION, window);
+    GLIS_MESSAGE_modify_window::encode(window, payload);
     if (IPC == IPC_MODE.shared_memory) {
-        GLIS_shared_memory_write(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER, window);
-        return true;
+        return GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, window);
     } else if (IPC == IPC_MODE.socket) {
-        SOCKET_CLIENT client;
-        if (client.connect_to_server()) {
-            if (client.socket_put_serial(window)) {
-                if (client.disconnect_from_server()) return true;
-                else
-                    LOG_ERROR("failed to disconnect from the server");
-            } else
-                LOG_ERROR("failed to send command to the server");
-        } else
-            LOG_ERROR("failed to connect to server");
+        return GLIS_session_send(GLIS_INTERNAL_SESSION, window);
+    }
+    return false;
+}
+
+bool GLIS_set_window_flags(size_t window_id, uint32_t flags) {
+    serializer window;
+    GLIS_window_flags_payload payload = {window_id, flags};
+    if (IPC == IPC_MODE.socket) GLIS_session_request(GLIS_INTERNAL_SESSION, window);
+    GLIS_MESSAGE_set_window_flags::encode(window, payload);
+    if (IPC == IPC_MODE.shared_memory) {
+        return GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, window);
+    } else if (IPC == IPC_MODE.socket) {
+        return GLIS_session_send(GLIS_INTERNAL_SESSION, window);
     }
     return false;
 }
 
 bool GLIS_close_window(size_t window_id) {
     serializer window;
-    window.add<int>(GLIS_SERVER_COMMANDS.close_window);
-    window.add<size_t>(window_id);
+    GLIS_close_window_payload payload = {window_id};
+    if (IPC == IPC_MODE.socket) GLIS_session_request(GLIS_INTERNAL_SESSION, window);
+    GLIS_MESSAGE_close_window::encode(window, payload);
+    if (GLIS_window_frames(window_id) != nullptr) GLIS_window_frames_set(window_id, nullptr);
     if (IPC == IPC_MODE.shared_memory) {
-        GLIS_shared_memory_write(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER, window);
-        return true;
+        return GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, window);
     } else if (IPC == IPC_MODE.socket) {
-        SOCKET_CLIENT client;
-        if (client.connect_to_server()) {
-            if (client.socket_put_serial(window)) {
-                if (client.disconnect_from_server()) return true;
-                else
-                    LOG_ERROR("failed to disconnect from the server");
-            } else
-                LOG_ERROR("failed to send command to the server");
-        } else
-            LOG_ERROR("failed to connect to server");
+        return GLIS_session_send(GLIS_INTERNAL_SESSION, window);
     }
     return false;
 }
 
+// queues commands to be sent as a single message by GLIS_batch_commit and applied by the
+// compositor in a single frame, so none of the states in between are ever drawn
+class GLIS_batch {
+    public:
+        // arena mode whatever the default is, the header is patched in place on commit
+        serializer commands{SERIALIZER_MODE.arena};
+        uint32_t count = 0;
+        uint32_t windows = 0; // windows created by this batch so far
+        uint32_t request = 0; // the session request id in socket mode
+        // where the header's payload field starts, filled in by GLIS_batch_commit once the
+        // count is known
+        size_t payload_field = 0;
+};
+
+void GLIS_batch_begin(GLIS_batch &batch) {
+    batch.commands.reset();
+    batch.count = 0;
+    batch.windows = 0;
+    if (IPC == IPC_MODE.socket)
+        batch.request = GLIS_session_request(GLIS_INTERNAL_SESSION, batch.commands);
+    // the payload field follows the command id field
+    batch.payload_field = batch.commands.stream.data_len + serializer::field_size(sizeof(int));
+    GLIS_batch_payload payload = {0};
+    GLIS_MESSAGE_batch::encode(batch.commands, payload);
+}
+
+// returns the id later commands in the batch refer to the window by,
+// the real id is returned by GLIS_batch_commit
+size_t GLIS_batch_new_window(GLIS_batch &batch, int x, int y, int w, int h) {
+    GLIS_new_window_payload payload = {{x, y, x + w, y + h}};
+    GLIS_MESSAGE_new_window::encode(batch.commands, payload);
+    batch.count++;
+    return GLIS_batch_window(batch.windows++);
+}
+
+void GLIS_batch_modify_window(GLIS_batch &batch, size_t window_id, int x, int y, int w, int h) {
+    GLIS_modify_window_payload payload = {window_id, {x, y, x + w, y + h}};
+    GLIS_MESSAGE_modify_window::encode(batch.commands, payload);
+    batch.count++;
+}
+
+void GLIS_batch_set_window_flags(GLIS_batch &batch, size_t window_id, uint32_t flags) {
+    GLIS_window_flags_payload payload = {window_id, flags};
+    GLIS_MESSAGE_set_window_flags::encode(batch.commands, payload);
+    batch.count++;
+}
+
+void GLIS_batch_close_window(GLIS_batch &batch, size_t window_id) {
+    GLIS_close_window_payload payload = {window_id};
+    GLIS_MESSAGE_close_window::encode(batch.commands, payload);
+    batch.count++;
+}
+
+// shared memory mode only, has the compositor latch the frame most recently published in
+// the window's frame slots as part of the batch
+bool GLIS_batch_texture(GLIS_batch &batch, size_t window_id, GLint width, GLint height) {
+    if (IPC != IPC_MODE.shared_memory) {
+        LOG_ERROR("textures can only be referenced by a batch in shared memory mode");
+        return false;
+    }
+    GLIS_texture_payload payload = {window_id, width, height};
+    GLIS_MESSAGE_texture::encode(batch.commands, payload);
+    batch.count++;
+    return true;
+}
+
+// sends the batch in one round trip, windows receives the ids of the windows it created
+// in the order they were queued
+bool GLIS_batch_commit(GLIS_batch &batch, std::vector<size_t> &windows) {
+    GLIS_batch_payload payload = {batch.count};
+    if (!batch.commands.patch_fixed<GLIS_batch_payload>(batch.payload_field, payload))
+        return false;
+    serializer response;
+    if (IPC == IPC_MODE.shared_memory) {
+        if (!GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, batch.commands))
+            return false;
+        GLIS_command_ring_pop(GLIS_INTERNAL_COMMAND_RING_REPLIES, response, -1);
+    } else if (IPC == IPC_MODE.socket) {
+        if (!GLIS_session_call(GLIS_INTERNAL_SESSION, batch.request, batch.commands, response))
+            return false;
+    }
+    windows.clear();
+    GLIS_batch_reply result = {false};
+    if (!GLIS_REPLY_batch::decode(response, result) || !result.applied) {
+        LOG_ERROR("the compositor refused the batch of %u commands", batch.count);
+        return false;
+    }
+    int8_t *replies = nullptr;
+    size_t len = response.get_raw_pointer_view<int8_t>(&replies);
+    if (len != batch.windows * sizeof(GLIS_new_window_reply)) {
+        LOG_ERROR("expected %u windows from the batch, got %zu bytes", batch.windows, len);
+        return false;
+    }
+    bool received = true;
+    for (uint32_t i = 0; i < batch.windows; i++) {
+        GLIS_new_window_reply reply;
+        memcpy(&reply, replies + i * sizeof(GLIS_new_window_reply), sizeof(reply));
+        windows.push_back(reply.window_id);
+        if (IPC == IPC_MODE.shared_memory && !GLIS_window_frames_receive(reply))
+            received = false;
+    }
+    return received;
+}
+
+// client side, the slots fit a width x height frame if it fills at least half of a slot
+bool GLIS_frame_slots_fits(GLIS_frame_slots &frames, GLint width, GLint height) {
+    size_t needed = GLIS_frame_slots_align(static_cast<size_t>(width) * height * sizeof(GLuint));
+    size_t slot_size = frames.slot_size;
+    return needed <= slot_size && needed >= slot_size / 2;
+}
+
+// client side, makes sure every slot of a window can hold a width x height frame, the slots
+// grow when a frame no longer fits and shrink when frames use less than half of a slot
+bool GLIS_frame_slots_fit(size_t window_id, GLIS_frame_slots &frames, GLint width,
+                          GLint height) {
+    if (GLIS_frame_slots_fits(frames, width, height)) return true;
+    size_t needed = GLIS_frame_slots_align(static_cast<size_t>(width) * height * sizeof(GLuint));
+    size_t slot_size = frames.slot_size;
+    serializer request;
+    serializer response;
+    GLIS_resize_frames_payload payload = {window_id, static_cast<uint32_t>(needed)};
+    GLIS_resize_frames_reply reply;
+    GLIS_MESSAGE_resize_window_frames::encode(request, payload);
+    GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, request);
+    GLIS_command_ring_pop(GLIS_INTERNAL_COMMAND_RING_REPLIES, response, -1);
+    if (!GLIS_REPLY_resize_window_frames::decode(response, reply)) {
+        LOG_ERROR("failed to decode the resized frame slots");
+        return false;
+    }
+    LOG_INFO("resized the frame slots of window %zu from %zu to %zu bytes", window_id,
+             slot_size, needed);
+    // the compositor has reinitialized the slots, only our mapping is left to update
+    munmap(frames.memory.data, frames.memory.size);
+    frames.memory.data = nullptr;
+    frames.header = nullptr;
+    if (reply.replaced) {
+        SHM_close(frames.memory.fd);
+        KEEP_ALIVE.socket_get_fd(frames.memory.fd);
+    }
+    frames.memory.size = reply.frames_size;
+    frames.width = 0;
+    frames.height = 0;
+    return reply.frames_size != 0 && GLIS_frame_slots_open(frames);
+}
+
+// client side, the frame slots a window presents through fitted to a width x height frame,
+// or nullptr if the frame has to be sent along with the texture command instead
+GLIS_frame_slots *GLIS_window_frames_fit(size_t window_id, GLint width, GLint height) {
+    GLIS_frame_slots *frames = GLIS_window_frames(window_id);
+    if (IPC == IPC_MODE.socket) {
+        if (!GLIS_CLIENT_WINDOW_FRAMES) return nullptr;
+        // the compositor maps the slots itself, so they are replaced rather than resized
+        if (frames != nullptr && GLIS_frame_slots_fits(*frames, width, height)) return frames;
+        if (!GLIS_window_frames_register(window_id, width, height)) return nullptr;
+        return GLIS_window_frames(window_id);
+    }
+    assert(frames != nullptr);
+    if (!GLIS_frame_slots_fit(window_id, *frames, width, height)) {
+        LOG_ERROR("failed to fit the frame slots to %dx%d", width, height);
+        return nullptr;
+    }
+    return frames;
+}
+
 void
 GLIS_upload_texture_resize(GLIS_CLASS &GLIS, size_t &window_id, GLuint &texture_id,
                            GLint texture_width,
                            GLint texture_height, GLint texture_width_to,
                            GLint texture_height_to) {
-    LOG_INFO("uploading texture");
+    TRACE_VERBOSE("uploading texture");
     GLIS_Sync_GPU();
     GLIS_error_to_string_exec_EGL(eglSwapBuffers(GLIS.display, GLIS.surface));
     GLIS_Sync_GPU();
     if (IPC == IPC_MODE.socket || IPC == IPC_MODE.shared_memory) {
-        if (texture_width_to != 0 && texture_height_to != 0) {
+        serializer tex;
+        GLIS_texture_payload payload = {
+            window_id,
+            texture_width_to != 0 ? texture_width_to : texture_width,
+            texture_height_to != 0 ? texture_height_to : texture_height
+        };
+        if (IPC == IPC_MODE.socket) GLIS_session_request(GLIS_INTERNAL_SESSION, tex);
+        GLIS_MESSAGE_texture::encode(tex, payload);
+        GLIS_frame_slots *frames = GLIS_window_frames_fit(window_id, payload.width,
+                                                          payload.height);
+        if (IPC == IPC_MODE.shared_memory && frames == nullptr) return;
+        bool resize = texture_width_to != 0 && texture_height_to != 0;
+        if (resize) {
             LOG_ERROR("resizing from %dx%d to %dx%d",
                       texture_width, texture_height, texture_width_to, texture_height_to);
             GLIS_resize(&TEXDATA, TEXDATA_LEN, texture_width, texture_height, texture_width_to,
@@ -477,7 +1750,7 @@ GLIS_upload_texture_resize(GLIS_CLASS &GLIS, size_t &window_id, GLuint &texture_
             LOG_ERROR("resized from %dx%d to %dx%d",
                       texture_width, texture_height, texture_width_to, texture_height_to);
             assert(TEXDATA != nullptr);
-        } else {
+        } else if (frames == nullptr) {
             TEXDATA_LEN = texture_width * texture_height * sizeof(GLuint);
             TEXDATA = new GLuint[TEXDATA_LEN];
             memset(TEXDATA, 0, TEXDATA_LEN);
@@ -486,52 +1759,52 @@ GLIS_upload_texture_resize(GLIS_CLASS &GLIS, size_t &window_id, GLuint &texture_
                              TEXDATA)
             );
         }
-        serializer tex;
-        tex.add<int>(GLIS_SERVER_COMMANDS.texture);
-        tex.add<size_t>(window_id);
-        GLint tex_dimens[2] = {
-            texture_width_to != 0 ? texture_width_to : texture_width,
-            texture_height_to != 0 ? texture_height_to : texture_height
-        };
-        tex.add_pointer<GLint>(tex_dimens, 2);
-        if (IPC == IPC_MODE.shared_memory) {
-            GLIS_shared_memory_write(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER, tex);
-            GLIS_shared_memory_write_texture(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA,
-                                             reinterpret_cast<int8_t *>(TEXDATA), TEXDATA_LEN);
-        } else if (IPC == IPC_MODE.socket) {
-            tex.add_pointer<GLuint>(TEXDATA, TEXDATA_LEN);
-            SOCKET_CLIENT client;
-            if (client.connect_to_server()) {
-                if (client.socket_put_serial(tex)) {
-                    if (!client.disconnect_from_server())
-                        LOG_ERROR("failed to disconnect from server");
-                } else
-                    LOG_ERROR("failed to send texture to server");
-            } else
-                LOG_ERROR("failed to connect to server");
+        if (frames != nullptr) {
+            // the frame goes into a slot the compositor uploads from, a full frame is read
+            // back straight into it, and only the notification is sent
+            int32_t slot = GLIS_frame_slots_acquire(*frames);
+            if (resize) {
+                memcpy(GLIS_frame_slots_data(*frames, slot), TEXDATA,
+                       static_cast<size_t>(payload.width) * payload.height * sizeof(GLuint));
+            } else {
+                GLIS_error_to_string_exec_GL(
+                    glReadPixels(0, 0, texture_width, texture_height, GL_RGBA,
+                                 GL_UNSIGNED_BYTE, GLIS_frame_slots_data(*frames, slot))
+                );
+            }
+            GLIS_frame_slots_publish(*frames, slot, payload.width, payload.height);
+            if (IPC == IPC_MODE.shared_memory)
+                GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, tex);
+            else if (!GLIS_session_send(GLIS_INTERNAL_SESSION, tex))
+                LOG_ERROR("failed to send texture to server");
+        } else {
+            // sent straight from the glReadPixels buffer
+            tex.add_pointer_borrowed<GLuint>(TEXDATA, TEXDATA_LEN);
+            if (!GLIS_session_send(GLIS_INTERNAL_SESSION, tex))
+                LOG_ERROR("failed to send texture to server");
         }
-        delete TEXDATA;
-        LOG_INFO("uploaded texture");
+        if (resize || frames == nullptr) delete TEXDATA;
+        TRACE_INFO("uploaded texture");
         return;
     } else {
-        while (SYNC_STATE != STATE.request_upload) {}
-        SYNC_STATE = STATE.response_uploading;
+        SYNC_VARIABLE_wait(SYNC_STATE, STATE.request_upload);
+        SYNC_VARIABLE_set(SYNC_STATE, STATE.response_uploading);
         if (IPC == IPC_MODE.thread) {
             GLIS_current_texture = texture_id;
-            SYNC_STATE = STATE.response_uploaded;
+            SYNC_VARIABLE_set(SYNC_STATE, STATE.response_uploaded);
         } else if (IPC == IPC_MODE.texture) {
             TEXDATA_LEN = texture_width * texture_height * sizeof(GLuint);
             TEXDATA = new GLuint[TEXDATA_LEN];
             GLIS_error_to_string_exec_GL(
                 glReadPixels(0, 0, texture_width, texture_height, GL_RGBA, GL_UNSIGNED_BYTE,
                              TEXDATA));
-            SYNC_STATE = STATE.response_uploaded;
+            SYNC_VARIABLE_set(SYNC_STATE, STATE.response_uploaded);
         }
-        LOG_INFO("uploaded texture");
-        LOG_INFO("requesting SERVER to render");
-        SYNC_STATE = STATE.request_render;
-        while (SYNC_STATE != STATE.response_rendered) {}
-        LOG_INFO("SERVER has rendered");
+        TRACE_INFO("uploaded texture");
+        TRACE_VERBOSE("requesting SERVER to render");
+        SYNC_VARIABLE_set(SYNC_STATE, STATE.request_render);
+        SYNC_VARIABLE_wait(SYNC_STATE, STATE.response_rendered);
+        TRACE_VERBOSE("SERVER has rendered");
         return;
     }
 }
@@ -542,4 +1815,62 @@ GLIS_upload_texture(GLIS_CLASS &GLIS, size_t &window_id, GLuint &texture_id, GLi
     GLIS_upload_texture_resize(GLIS, window_id, texture_id, texture_width, texture_height, 0, 0);
 }
 
+// uploads only the damaged rectangles of the current frame, each is read back straight into
+// its position in a frame slot and the compositor applies it to the window's texture,
+// when the window has no frame slots or the frame size changed the whole frame is uploaded
+void
+GLIS_upload_texture_damage(GLIS_CLASS &GLIS, size_t &window_id, GLuint &texture_id,
+                           GLint texture_width, GLint texture_height, const GLIS_damage_rect *damage,
+                           int32_t damage_count) {
+    GLIS_frame_slots *frames = nullptr;
+    if (IPC == IPC_MODE.shared_memory || IPC == IPC_MODE.socket)
+        frames = GLIS_window_frames(window_id);
+    if (frames == nullptr || frames->width != texture_width ||
+        frames->height != texture_height) {
+        GLIS_upload_texture(GLIS, window_id, texture_id, texture_width, texture_height);
+        return;
+    }
+    TRACE_VERBOSE("uploading %d damaged rectangles", damage_count);
+    GLIS_Sync_GPU();
+    GLIS_error_to_string_exec_EGL(eglSwapBuffers(GLIS.display, GLIS.surface));
+    GLIS_Sync_GPU();
+    int32_t slot = GLIS_frame_slots_acquire(*frames);
+    GLIS_frame_slots_add_damage(*frames, slot, damage, damage_count);
+    // this frame replaces a frame the compositor has not latched yet, the framebuffer already
+    // holds the newest pixels of that frame's damage so they are read back along with ours
+    int32_t previous = GLIS_frame_slots_reclaim(*frames);
+    if (previous >= 0) {
+        GLIS_frame_slot &replaced = frames->header->slots[previous];
+        GLIS_frame_slots_add_damage(*frames, slot, replaced.damage, replaced.damage_count);
+        GLIS_frame_slots_release(*frames, previous);
+    }
+    GLIS_frame_slot &s = frames->header->slots[slot];
+    int8_t *pixels = GLIS_frame_slots_data(*frames, slot);
+    size_t len = 0;
+    GLIS_error_to_string_exec_GL(glPixelStorei(GL_PACK_ROW_LENGTH, texture_width));
+    for (int32_t i = 0; i < s.damage_count; i++) {
+        GLIS_damage_rect &r = s.damage[i];
+        assert(r.x >= 0 && r.y >= 0 && r.x + r.width <= texture_width &&
+               r.y + r.height <= texture_height);
+        GLIS_error_to_string_exec_GL(
+            glReadPixels(r.x, r.y, r.width, r.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                         pixels + (static_cast<size_t>(r.y) * texture_width + r.x) *
+                                  sizeof(GLuint))
+        );
+        len += static_cast<size_t>(r.width) * r.height * sizeof(GLuint);
+    }
+    GLIS_error_to_string_exec_GL(glPixelStorei(GL_PACK_ROW_LENGTH, 0));
+    GLIS_frame_slots_publish_damage(*frames, slot, texture_width, texture_height);
+    serializer tex;
+    GLIS_texture_payload payload = {window_id, texture_width, texture_height};
+    if (IPC == IPC_MODE.socket) GLIS_session_request(GLIS_INTERNAL_SESSION, tex);
+    GLIS_MESSAGE_shm_texture_damage::encode(tex, payload);
+    if (IPC == IPC_MODE.shared_memory)
+        GLIS_command_ring_push(GLIS_INTERNAL_COMMAND_RING_REQUESTS, tex);
+    else if (!GLIS_session_send(GLIS_INTERNAL_SESSION, tex))
+        LOG_ERROR("failed to send texture to server");
+    TRACE_INFO("uploaded %d damaged rectangles, %zu of %zu bytes", s.damage_count, len,
+               static_cast<size_t>(texture_width) * texture_height * sizeof(GLuint));
+}
+
 #endif //GLNE_GLIS_COMMANDS_H
@@ -43,11 +43,17 @@
 #include <android/native_window_jni.h> // requires ndk r5 or newer
 #include <pthread.h>
 #include <vector>
+#include <cmath>
 #include <android/log.h>
 
 #include "logger.h"
 #include "GLIS.h"
 #include "GLIS_COMMANDS.h"
+#include "mpsc_queue.h"
+#include "histogram.h"
+#include "window_list.h"
+#include "region.h"
+#include "occlusion.h"
 
 #define LOG_TAG "EglSample"
 
@@ -55,22 +61,42 @@ class GLIS_CLASS CompositorMain;
 
 char *executableDir;
 
+// how long the surface owner waits for the Compositor to shut down before logging that it is
+// still waiting
+int COMPOSITOR_WAIT_WARNING_MS = 1000;
+
 extern "C" JNIEXPORT void JNICALL Java_glnative_example_NativeView_nativeSetSurface(JNIEnv* jenv,
                                                                                     jclass type,
                                                                                     jobject surface)
 {
     if (surface != nullptr) {
-        CompositorMain.native_window = ANativeWindow_fromSurface(jenv, surface);
+        ANativeWindow *window = ANativeWindow_fromSurface(jenv, surface);
+        if (CompositorMain.native_window != nullptr) {
+            // the format or size of the surface being rendered to changed, its window surface
+            // follows the window so there is nothing to hand over
+            LOG_INFO("surface changed");
+            ANativeWindow_release(window);
+            return;
+        }
+        CompositorMain.native_window = window;
         LOG_INFO("Got window %p", CompositorMain.native_window);
-        LOG_INFO("waiting for Compositor to initialize");
-        while (SYNC_STATE != STATE.initialized) {}
+        // the Compositor picks the window up once it has initialized, this does not wait for it
         LOG_INFO("requesting SERVER startup");
-        SYNC_STATE = STATE.request_startup;
+        SYNC_VARIABLE_set(SYNC_STATE, STATE.request_startup);
     } else {
-        CompositorMain.server.shutdownServer();
-        SYNC_STATE = STATE.request_shutdown;
+        // the Compositor has already shut down if it failed to initialize
+        int32_t state = SYNC_VARIABLE_get(SYNC_STATE);
+        while (state != STATE.response_shutdown &&
+               !SYNC_VARIABLE_transition(SYNC_STATE, state, STATE.request_shutdown))
+            state = SYNC_VARIABLE_get(SYNC_STATE);
         LOG_INFO("requesting SERVER shutdown");
-        while (SYNC_STATE != STATE.response_shutdown) {}
+        // the window must not be released while it is being rendered to, and the server must
+        // outlive the Compositor's last wait on it
+        while (!SYNC_VARIABLE_wait(SYNC_STATE, STATE.response_shutdown,
+                                   COMPOSITOR_WAIT_WARNING_MS))
+            LOG_ERROR("Compositor has not shut down after %d milliseconds",
+                      COMPOSITOR_WAIT_WARNING_MS);
+        CompositorMain.server.shutdownServer();
         LOG_INFO("SERVER has shutdown");
         LOG_INFO("Releasing window");
         ANativeWindow_release(CompositorMain.native_window);
@@ -120,6 +146,919 @@ void main()
 }
 )glsl";
 
+// where a window is and what it shows is kept in COMPOSITOR_WINDOWS, which the draw loop reads
+struct Client_Window {
+    GLuint TEXTURE = 0;
+    GLint TEXTURE_WIDTH = 0; // the size the texture storage was allocated with
+    GLint TEXTURE_HEIGHT = 0;
+    GLuint PBO = 0; // pixel unpack buffer, only used with COMPOSITOR_UPLOAD_THROUGH_PBO
+    GLIS_frame_slots frames; // created in shared memory mode, registered by the client in socket mode
+    double last_frame_ms = 0; // when the client last published a frame
+};
+
+// every window of the object table, in the order they are drawn
+WINDOW_LIST COMPOSITOR_WINDOWS;
+
+// stage frames through a pixel unpack buffer instead of handing the client pixels to
+// glTexSubImage2D directly, this costs a copy into the buffer but lets the driver perform
+// the texture transfer asynchronously
+bool COMPOSITOR_UPLOAD_THROUGH_PBO = false;
+
+// uploads the damaged rectangles of a width x height frame into the window's texture
+// straight from pixels (the mapped frame slot or the received stream), the texture storage
+// is only allocated when the frame size changes, the rectangles are then written into it
+// with glTexSubImage2D, using the unpack row length and skips to pick them out of the frame
+void COMPOSITOR_upload_texture(Client_Window *CW, GLint width, GLint height,
+                               const GLuint *pixels, const GLIS_damage_rect *damage,
+                               int32_t damage_count) {
+    TRACE_INFO_START(start);
+    if (CW->TEXTURE == 0) {
+        GLIS_error_to_string_exec_GL(glGenTextures(1, &CW->TEXTURE));
+        GLIS_error_to_string_exec_GL(glBindTexture(GL_TEXTURE_2D, CW->TEXTURE));
+        GLIS_error_to_string_exec_GL(
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                            GL_NEAREST));
+        GLIS_error_to_string_exec_GL(
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                            GL_LINEAR));
+        GLIS_error_to_string_exec_GL(
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                            GL_CLAMP_TO_BORDER));
+        GLIS_error_to_string_exec_GL(
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                            GL_CLAMP_TO_BORDER));
+    } else {
+        GLIS_error_to_string_exec_GL(glBindTexture(GL_TEXTURE_2D, CW->TEXTURE));
+    }
+    const int8_t *source = reinterpret_cast<const int8_t *>(pixels);
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+    size_t len = 0;
+    for (int32_t i = 0; i < damage_count; i++)
+        len += static_cast<size_t>(damage[i].width) * damage[i].height * sizeof(GLuint);
+#endif
+    if (COMPOSITOR_UPLOAD_THROUGH_PBO) {
+        GLsizeiptr size = static_cast<GLsizeiptr>(width) * height * sizeof(GLuint);
+        if (CW->PBO == 0) {
+            GLIS_error_to_string_exec_GL(glGenBuffers(1, &CW->PBO));
+        }
+        GLIS_error_to_string_exec_GL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, CW->PBO));
+        // orphan the previous storage so we never wait on a transfer still reading it
+        GLIS_error_to_string_exec_GL(
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW));
+        void *buffer = GLIS_error_to_string_exec_GL(
+            glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        int8_t *mapped = static_cast<int8_t *>(buffer);
+        if (mapped != nullptr) {
+            // only the damaged rows are staged, at the same offsets as in the frame
+            for (int32_t i = 0; i < damage_count; i++) {
+                const GLIS_damage_rect &r = damage[i];
+                for (GLint row = r.y; row < r.y + r.height; row++) {
+                    size_t offset = (static_cast<size_t>(row) * width + r.x) * sizeof(GLuint);
+                    memcpy(mapped + offset, source + offset, r.width * sizeof(GLuint));
+                }
+            }
+            GLIS_error_to_string_exec_GL(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+            source = nullptr; // offset 0 into the bound buffer
+        } else {
+            LOG_ERROR("failed to map the pixel unpack buffer, uploading directly");
+            GLIS_error_to_string_exec_GL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+        }
+    }
+    bool full = damage_count == 1 && damage[0].x == 0 && damage[0].y == 0 &&
+                damage[0].width == width && damage[0].height == height;
+    if (width != CW->TEXTURE_WIDTH || height != CW->TEXTURE_HEIGHT) {
+        // a whole frame is uploaded as the new storage, otherwise the storage is allocated
+        // and only the damage is written into it
+        GLIS_error_to_string_exec_GL(
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, full ? source : nullptr)
+        );
+        CW->TEXTURE_WIDTH = width;
+        CW->TEXTURE_HEIGHT = height;
+    } else if (full) {
+        GLIS_error_to_string_exec_GL(
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                            GL_RGBA, GL_UNSIGNED_BYTE, source)
+        );
+    }
+    if (!full) {
+        GLIS_error_to_string_exec_GL(glPixelStorei(GL_UNPACK_ROW_LENGTH, width));
+        for (int32_t i = 0; i < damage_count; i++) {
+            const GLIS_damage_rect &r = damage[i];
+            GLIS_error_to_string_exec_GL(glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x));
+            GLIS_error_to_string_exec_GL(glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y));
+            GLIS_error_to_string_exec_GL(
+                glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height,
+                                GL_RGBA, GL_UNSIGNED_BYTE, source)
+            );
+        }
+        GLIS_error_to_string_exec_GL(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+        GLIS_error_to_string_exec_GL(glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0));
+        GLIS_error_to_string_exec_GL(glPixelStorei(GL_UNPACK_SKIP_ROWS, 0));
+    }
+    if (COMPOSITOR_UPLOAD_THROUGH_PBO) {
+        GLIS_error_to_string_exec_GL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+    }
+    GLIS_error_to_string_exec_GL(glGenerateMipmap(GL_TEXTURE_2D));
+    GLIS_error_to_string_exec_GL(glBindTexture(GL_TEXTURE_2D, 0));
+    TRACE_INFO("uploaded %d rectangles (%zu bytes) of a %dx%d texture in %G milliseconds",
+               damage_count, len, width, height, TRACE_ms_since(start));
+}
+
+void COMPOSITOR_release_texture(Client_Window *CW) {
+    if (CW->TEXTURE != 0) {
+        GLIS_error_to_string_exec_GL(glDeleteTextures(1, &CW->TEXTURE));
+    }
+    if (CW->PBO != 0) {
+        GLIS_error_to_string_exec_GL(glDeleteBuffers(1, &CW->PBO));
+    }
+    CW->TEXTURE = 0;
+    CW->PBO = 0;
+    CW->TEXTURE_WIDTH = 0;
+    CW->TEXTURE_HEIGHT = 0;
+}
+
+// the sessions of the main server are read and decoded by COMPOSITOR_DECODE_WORKERS threads
+// which hand every command they receive to the render thread, so a large transfer only holds
+// up the worker receiving it, with 0 the render thread reads them itself
+int COMPOSITOR_DECODE_WORKERS = 2;
+
+// a worker gives up on a session whose client sent part of a message and then nothing for
+// this long, the session is closed so a stalled client can not hold a worker
+int COMPOSITOR_DECODE_TIMEOUT_MS = 1000;
+
+const int COMPOSITOR_COMMAND_REQUEST = 0;
+const int COMPOSITOR_COMMAND_RESUME = 1; // the worker is done with the session for now
+const int COMPOSITOR_COMMAND_CLOSED = 2; // the client closed the session
+
+class COMPOSITOR_command : public MPSC_QUEUE_NODE {
+    public:
+        int kind = COMPOSITOR_COMMAND_REQUEST;
+        int session = -1;
+        uint32_t request = 0;
+        serializer in; // positioned at the command id
+        int fd = -1; // received along with register_window_frames
+};
+
+// filled by the workers, drained by the render thread
+MPSC_QUEUE COMPOSITOR_COMMANDS;
+// eventfd watched by the main server, written by a worker after it has queued commands
+int COMPOSITOR_COMMANDS_READY = -1;
+// the command being executed if a worker received it, the render thread does not read
+// from a session a worker may be reading from
+COMPOSITOR_command *COMPOSITOR_CURRENT_COMMAND = nullptr;
+
+class COMPOSITOR_decode_job {
+    public:
+        int session;
+        SOCKET_READER *reader;
+};
+
+std::deque<COMPOSITOR_decode_job> COMPOSITOR_DECODE_JOBS;
+pthread_mutex_t COMPOSITOR_DECODE_JOBS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t COMPOSITOR_DECODE_JOBS_CONDITION = PTHREAD_COND_INITIALIZER;
+bool COMPOSITOR_DECODE_STOP = false;
+// eventfd written when the workers are stopped, it is never read so a worker waiting on a
+// session in the middle of a message sees it and lets go
+int COMPOSITOR_DECODE_STOP_FD = -1;
+std::vector<pthread_t> COMPOSITOR_DECODE_THREADS;
+
+// how the render loop paces frames, either way a frame is only composited when a command
+// changed the scene
+// vsync composites at most once per refresh period, applying every command that arrives
+// until just before the frame is due so a burst of commands shares one frame
+// low latency composites as soon as the commands waiting have been applied, eglSwapBuffers
+// still holds it to the refresh rate once the display's buffers are all queued
+const int COMPOSITOR_PACING_VSYNC = 0;
+const int COMPOSITOR_PACING_LOW_LATENCY = 1;
+int COMPOSITOR_PACING = COMPOSITOR_PACING_VSYNC;
+
+// how much earlier than its estimated composite time a frame is started in vsync pacing
+double COMPOSITOR_FRAME_SLACK_MS = 1.0;
+
+class COMPOSITOR_frame_scheduler {
+    public:
+        // the refresh period of the display, set from the surface owner's thread
+        double period_ms = 1000.0 / 60.0;
+        // a moving average of the time from starting a frame to handing it to eglSwapBuffers
+        double composite_ms = 0;
+        // when the last frame was handed to eglSwapBuffers
+        double presented_ms = 0;
+        // a command changed the scene since the last frame
+        bool damaged = false;
+        // commands executed since the last frame
+        size_t pending_commands = 0;
+        size_t frames = 0;
+        size_t commands = 0;
+} COMPOSITOR_FRAMES;
+
+void COMPOSITOR_frame_set_refresh_rate(COMPOSITOR_frame_scheduler &scheduler,
+                                       double refresh_rate) {
+    if (refresh_rate <= 0) return;
+    double period = 1000.0 / refresh_rate;
+    __atomic_store(&scheduler.period_ms, &period, __ATOMIC_RELAXED);
+}
+
+// the latest a frame can be started and still be handed over before the next refresh
+double COMPOSITOR_frame_deadline(COMPOSITOR_frame_scheduler &scheduler) {
+    double period;
+    __atomic_load(&scheduler.period_ms, &period, __ATOMIC_RELAXED);
+    return scheduler.presented_ms + period - scheduler.composite_ms - COMPOSITOR_FRAME_SLACK_MS;
+}
+
+// returns how long the render loop may wait for commands before a frame is due, at most
+// timeout_ms
+int COMPOSITOR_frame_wait_ms(COMPOSITOR_frame_scheduler &scheduler, int timeout_ms) {
+    if (!scheduler.damaged) return timeout_ms;
+    if (COMPOSITOR_PACING == COMPOSITOR_PACING_LOW_LATENCY) return 0;
+    double left = COMPOSITOR_frame_deadline(scheduler) - now_ms();
+    if (left <= 0) return 0;
+    int wait = static_cast<int>(ceil(left));
+    return wait < timeout_ms ? wait : timeout_ms;
+}
+
+// returns true if a frame should be composited now
+bool COMPOSITOR_frame_due(COMPOSITOR_frame_scheduler &scheduler) {
+    if (!scheduler.damaged) return false;
+    if (COMPOSITOR_PACING == COMPOSITOR_PACING_LOW_LATENCY) return true;
+    return now_ms() >= COMPOSITOR_frame_deadline(scheduler);
+}
+
+// start is when compositing the frame began, presented is when it was handed to
+// eglSwapBuffers
+void COMPOSITOR_frame_presented(COMPOSITOR_frame_scheduler &scheduler, double start,
+                                double presented) {
+    scheduler.composite_ms = scheduler.frames == 0 ? presented - start :
+                             scheduler.composite_ms * 0.9 + (presented - start) * 0.1;
+    TRACE_INFO("frame %zu: %zu commands, %G milliseconds since the last frame",
+               scheduler.frames, scheduler.pending_commands, presented - scheduler.presented_ms);
+    scheduler.presented_ms = presented;
+    scheduler.damaged = false;
+    scheduler.frames++;
+    scheduler.commands += scheduler.pending_commands;
+    scheduler.pending_commands = 0;
+}
+
+// receives the fd sent along with the command being executed
+void COMPOSITOR_receive_fd(int &fd) {
+    if (COMPOSITOR_CURRENT_COMMAND == nullptr) {
+        CompositorMain.server.socket_get_fd(fd);
+        return;
+    }
+    fd = COMPOSITOR_CURRENT_COMMAND->fd;
+    COMPOSITOR_CURRENT_COMMAND->fd = -1;
+}
+
+// a command inside a batch may refer to a window the same batch created earlier
+// the id comes from the client, WINDOW_LIST_NONE is returned if it is not one of the windows
+// on screen or a window the batch has created so far
+size_t COMPOSITOR_window_id(size_t window_id, std::vector<GLIS_new_window_reply> *batch) {
+    if (batch != nullptr && GLIS_is_batch_window(window_id)) {
+        uint32_t index = GLIS_batch_window_index(window_id);
+        if (index >= batch->size()) {
+            LOG_ERROR("window %u of the batch has not been created yet", index);
+            return WINDOW_LIST_NONE;
+        }
+        window_id = (*batch)[index].window_id;
+    }
+    if (WINDOW_LIST_find(COMPOSITOR_WINDOWS, window_id) == WINDOW_LIST_NONE) {
+        LOG_ERROR("window %zu does not exist", window_id);
+        return WINDOW_LIST_NONE;
+    }
+    return window_id;
+}
+
+// what every command handler is given, client is the channel the command was read from, or
+// nullptr if it arrived on the main socket, any reply is sent back over the transport the
+// command arrived on
+// batch is nullptr unless the command is part of a batch, in which case the windows it
+// creates are collected there and replied to once the whole batch has been applied
+// returns true if the command changed what is on screen
+typedef bool (*COMPOSITOR_command_handler)(serializer &in, serializer &out,
+                                           GLIS_client_channel *client,
+                                           std::vector<GLIS_new_window_reply> *batch);
+
+bool COMPOSITOR_execute_command(serializer &in, serializer &out, GLIS_client_channel *client,
+                                std::vector<GLIS_new_window_reply> *batch = nullptr);
+
+bool COMPOSITOR_command_new_window(serializer &in, serializer &out, GLIS_client_channel *client,
+                                   std::vector<GLIS_new_window_reply> *batch) {
+    // the window's frame slots are handed over on the keep alive connection of its channel
+    if (IPC == IPC_MODE.shared_memory && client == nullptr) {
+        LOG_ERROR("windows can only be created over a client channel in shared memory mode");
+        return false;
+    }
+    GLIS_new_window_payload payload;
+    if (!GLIS_MESSAGE_new_window::decode(in, payload)) {
+        LOG_ERROR("dropping a new window command that does not decode");
+        return false;
+    }
+    int *win = payload.win;
+    struct Client_Window *x = new struct Client_Window;
+    x->last_frame_ms = now_ms();
+    size_t id = CompositorMain.KERNEL.table->findObject(
+        CompositorMain.KERNEL.newObject(0, 0, x));
+    WINDOW_LIST_add(COMPOSITOR_WINDOWS, id, win[0], win[1], win[2], win[3]);
+    TRACE_INFO("window %zu: %d,%d,%d,%d", id, win[0], win[1], win[2], win[3]);
+    TRACE_VERBOSE("sending id %zu", id);
+    GLIS_new_window_reply reply = {id, 0};
+    if (IPC == IPC_MODE.shared_memory) {
+        // sized to the window to start with, the client resizes them to fit its frames
+        // the size is worked out in 64 bits, where it can not wrap once either side is
+        // within GLIS_FRAME_SLOT_SIZE_MAX, and checked before it is narrowed to a size_t, which
+        // may only be 32 bits
+        uint64_t width = win[2] > win[0] ? static_cast<uint64_t>(int64_t(win[2]) - win[0]) : 0;
+        uint64_t height = win[3] > win[1] ? static_cast<uint64_t>(int64_t(win[3]) - win[1]) : 0;
+        uint64_t size = UINT64_MAX;
+        if (width <= GLIS_FRAME_SLOT_SIZE_MAX && height <= GLIS_FRAME_SLOT_SIZE_MAX)
+            size = sizeof(GLuint) * width * height;
+        if (size > GLIS_FRAME_SLOT_SIZE_MAX)
+            LOG_ERROR("window %zu is too large for frame slots, %llu bytes per frame", id,
+                      static_cast<unsigned long long>(size));
+        else if (!GLIS_frame_slots_create(x->frames, static_cast<uint32_t>(GLIS_FRAME_SLOTS),
+                                          static_cast<size_t>(size)))
+            LOG_ERROR("failed to create the frame slots of window %zu", id);
+        reply.frames_size = x->frames.memory.size;
+    }
+    if (batch != nullptr) {
+        batch->push_back(reply);
+        return true;
+    }
+    GLIS_REPLY_new_window::encode(out, reply);
+    if (IPC == IPC_MODE.socket) CompositorMain.server.socket_put_serial(out);
+    else if (IPC == IPC_MODE.shared_memory) {
+        GLIS_command_ring_push(client->replies, out);
+        if (reply.frames_size != 0)
+            SERVER_get(client->server_id)->socket_put_fd(x->frames.memory.fd);
+    }
+    return true;
+}
+
+bool COMPOSITOR_command_modify_window(serializer &in, serializer &out,
+                                      GLIS_client_channel *client,
+                                      std::vector<GLIS_new_window_reply> *batch) {
+    GLIS_modify_window_payload payload;
+    if (!GLIS_MESSAGE_modify_window::decode(in, payload)) {
+        LOG_ERROR("dropping a modify window command that does not decode");
+        return false;
+    }
+    size_t window_id = COMPOSITOR_window_id(payload.window_id, batch);
+    if (window_id == WINDOW_LIST_NONE) return false;
+    int *win = payload.win;
+    WINDOW_LIST_move(COMPOSITOR_WINDOWS, window_id, win[0], win[1], win[2], win[3]);
+    return true;
+}
+
+bool COMPOSITOR_command_set_window_flags(serializer &in, serializer &out,
+                                         GLIS_client_channel *client,
+                                         std::vector<GLIS_new_window_reply> *batch) {
+    GLIS_window_flags_payload payload;
+    if (!GLIS_MESSAGE_set_window_flags::decode(in, payload)) {
+        LOG_ERROR("dropping a set window flags command that does not decode");
+        return false;
+    }
+    size_t window_id = COMPOSITOR_window_id(payload.window_id, batch);
+    if (window_id == WINDOW_LIST_NONE) return false;
+    WINDOW_LIST_set_flags(COMPOSITOR_WINDOWS, window_id, payload.flags);
+    return true;
+}
+
+bool COMPOSITOR_command_close_window(serializer &in, serializer &out,
+                                     GLIS_client_channel *client,
+                                     std::vector<GLIS_new_window_reply> *batch) {
+    GLIS_close_window_payload payload;
+    if (!GLIS_MESSAGE_close_window::decode(in, payload)) {
+        LOG_ERROR("dropping a close window command that does not decode");
+        return false;
+    }
+    size_t window_id = COMPOSITOR_window_id(payload.window_id, batch);
+    if (window_id == WINDOW_LIST_NONE) return false;
+    struct Client_Window *CW = static_cast<Client_Window *>(
+        CompositorMain.KERNEL.table->table[window_id]->resource);
+    GLIS_frame_slots_free(CW->frames);
+    COMPOSITOR_release_texture(CW);
+    WINDOW_LIST_remove(COMPOSITOR_WINDOWS, window_id);
+    CompositorMain.KERNEL.table->DELETE(window_id);
+    return true;
+}
+
+// texture and shm_texture_damage carry the same payload, a latched slot always says which of
+// its rectangles hold pixels, as a whole frame may replace a damage update in the mailbox and
+// the other way around
+bool COMPOSITOR_command_texture(serializer &in, serializer &out, GLIS_client_channel *client,
+                                std::vector<GLIS_new_window_reply> *batch) {
+    GLIS_texture_payload payload;
+    if (!GLIS_MESSAGE_texture::decode(in, payload)) {
+        LOG_ERROR("dropping a texture command that does not decode");
+        return false;
+    }
+    size_t Client_id = COMPOSITOR_window_id(payload.window_id, batch);
+    if (Client_id == WINDOW_LIST_NONE) return false;
+    GLint tex_dimens[2] = {payload.width, payload.height};
+    TRACE_VERBOSE("received id: %zu, w: %d, h: %d", Client_id, tex_dimens[0],
+                  tex_dimens[1]);
+    struct Client_Window *CW = static_cast<Client_Window *>(
+        CompositorMain.KERNEL.table->table[Client_id]->resource);
+    GLuint *texdata = nullptr;
+    GLIS_damage_rect full = {0, 0, tex_dimens[0], tex_dimens[1]};
+    const GLIS_damage_rect *damage = &full;
+    int32_t damage_count = 1;
+    GLIS_frame_slot frame; // what the client wrote about the latched slot, once checked
+    if (CW->frames.header != nullptr) {
+        // upload straight out of the most recently published slot, if the client
+        // published several frames since the last notification only the newest is shown
+        // and the notifications for the frames it replaced find nothing new to latch
+        int32_t slot = GLIS_frame_slots_latch(CW->frames);
+        if (slot < 0) return true;
+        CW->last_frame_ms = now_ms();
+        TRACE_VERBOSE("latched slot %d", slot);
+        if (!GLIS_frame_slots_latched_frame(CW->frames, slot, frame)) {
+            LOG_ERROR("dropping the frame window %zu published in slot %d", Client_id, slot);
+            return false;
+        }
+        tex_dimens[0] = frame.width;
+        tex_dimens[1] = frame.height;
+        damage = frame.damage;
+        damage_count = frame.damage_count;
+        texdata = reinterpret_cast<GLuint *>(GLIS_frame_slots_data(CW->frames, slot));
+    } else if (IPC == IPC_MODE.socket) {
+        // upload straight out of the received stream, which must hold the whole frame
+        size_t len = in.get_raw_pointer_view<GLuint>(&texdata);
+        if (tex_dimens[0] <= 0 || tex_dimens[1] <= 0 ||
+            len < static_cast<uint64_t>(tex_dimens[0]) * static_cast<uint64_t>(tex_dimens[1])) {
+            LOG_ERROR("window %zu sent %zu pixels for a %dx%d texture, dropping it", Client_id,
+                      len, tex_dimens[0], tex_dimens[1]);
+            return false;
+        }
+    } else return true;
+    COMPOSITOR_upload_texture(CW, tex_dimens[0], tex_dimens[1], texdata, damage,
+                              damage_count);
+    WINDOW_LIST_set_texture(COMPOSITOR_WINDOWS, Client_id, CW->TEXTURE);
+    return true;
+}
+
+// applied as a whole before the caller draws again, so none of the states in between are
+// ever on screen, every command is checked by GLIS_batch_validate before the first one is
+// applied, a batch that fails is refused whole
+bool COMPOSITOR_command_batch(serializer &in, serializer &out, GLIS_client_channel *client,
+                              std::vector<GLIS_new_window_reply> *batch) {
+    if (IPC == IPC_MODE.shared_memory && client == nullptr) {
+        LOG_ERROR("a batch can only be sent over a client channel in shared memory mode");
+        return false;
+    }
+    bool redraw = false;
+    GLIS_batch_payload payload;
+    GLIS_batch_reply reply = {false};
+    std::vector<GLIS_new_window_reply> windows;
+    if (!GLIS_MESSAGE_batch::decode(in, payload))
+        LOG_ERROR("dropping a batch whose header does not decode");
+    else if (!GLIS_batch_validate(in, payload.count, COMPOSITOR_WINDOWS,
+                                  IPC == IPC_MODE.shared_memory))
+        LOG_ERROR("refusing a batch of %u commands", payload.count);
+    else {
+        reply.applied = true;
+        for (uint32_t i = 0; i < payload.count; i++)
+            if (COMPOSITOR_execute_command(in, out, client, &windows)) redraw = true;
+        TRACE_INFO("applied a batch of %u commands creating %zu windows", payload.count,
+                   windows.size());
+    }
+    GLIS_REPLY_batch::encode(out, reply);
+    out.add_pointer<const int8_t>(reinterpret_cast<const int8_t *>(windows.data()),
+                                  windows.size() * sizeof(GLIS_new_window_reply));
+    if (IPC == IPC_MODE.socket) CompositorMain.server.socket_put_serial(out);
+    else if (IPC == IPC_MODE.shared_memory) {
+        GLIS_command_ring_push(client->replies, out);
+        for (GLIS_new_window_reply &window : windows) {
+            if (window.frames_size == 0) continue;
+            struct Client_Window *CW = static_cast<Client_Window *>(
+                CompositorMain.KERNEL.table->table[window.window_id]->resource);
+            SERVER_get(client->server_id)->socket_put_fd(CW->frames.memory.fd);
+        }
+    }
+    return redraw;
+}
+
+bool COMPOSITOR_command_resize_window_frames(serializer &in, serializer &out,
+                                             GLIS_client_channel *client,
+                                             std::vector<GLIS_new_window_reply> *batch) {
+    // the reply and the fd of any new region go back over the client's channel
+    if (client == nullptr) {
+        LOG_ERROR("frame slots can only be resized over a client channel");
+        return false;
+    }
+    GLIS_resize_frames_payload payload;
+    if (!GLIS_MESSAGE_resize_window_frames::decode(in, payload)) {
+        LOG_ERROR("dropping a resize window frames command that does not decode");
+        return false;
+    }
+    size_t window_id = COMPOSITOR_window_id(payload.window_id, batch);
+    struct Client_Window *CW = nullptr;
+    if (window_id != WINDOW_LIST_NONE)
+        CW = static_cast<Client_Window *>(
+            CompositorMain.KERNEL.table->table[window_id]->resource);
+    bool replaced = false;
+    GLIS_resize_frames_reply reply = {0, false};
+    // the slot the window is displaying is already in its texture, so it can go too
+    if (CW != nullptr && CW->frames.header != nullptr &&
+        GLIS_frame_slots_resize(CW->frames, payload.slot_size, replaced)) {
+        reply.frames_size = CW->frames.memory.size;
+        reply.replaced = replaced;
+        LOG_INFO("resized the frame slots of window %zu to %u bytes", window_id,
+                 CW->frames.slot_size);
+    }
+    // the client waits for the reply either way
+    GLIS_REPLY_resize_window_frames::encode(out, reply);
+    GLIS_command_ring_push(client->replies, out);
+    if (replaced) SERVER_get(client->server_id)->socket_put_fd(CW->frames.memory.fd);
+    return false;
+}
+
+// the fd is attached to the command, so it can only arrive on a session
+bool COMPOSITOR_command_register_window_frames(serializer &in, serializer &out,
+                                               GLIS_client_channel *client,
+                                               std::vector<GLIS_new_window_reply> *batch) {
+    if (client != nullptr) {
+        LOG_ERROR("frame slots can only be registered over a session");
+        return false;
+    }
+    // a command that does not decode is refused like one naming a window that does not
+    // exist, so the fd attached to it is still closed
+    GLIS_register_frames_payload payload;
+    size_t window_id = WINDOW_LIST_NONE;
+    if (GLIS_MESSAGE_register_window_frames::decode(in, payload))
+        window_id = COMPOSITOR_window_id(payload.window_id, batch);
+    else LOG_ERROR("refusing a register window frames command that does not decode");
+    GLIS_register_frames_reply reply = {false};
+    int fd = -1;
+    COMPOSITOR_receive_fd(fd);
+    if (window_id == WINDOW_LIST_NONE) {
+        if (fd != -1) SHM_close(fd);
+        GLIS_REPLY_register_window_frames::encode(out, reply);
+        CompositorMain.server.socket_put_serial(out);
+        return false;
+    }
+    struct Client_Window *CW = static_cast<Client_Window *>(
+        CompositorMain.KERNEL.table->table[window_id]->resource);
+    // the window's texture keeps showing the last frame until one is published in the
+    // new slots
+    GLIS_frame_slots_free(CW->frames);
+    CW->frames.purged = false;
+    CW->last_frame_ms = now_ms();
+    // the client created the region and can still resize it, so it is only mapped if it is
+    // sealed against shrinking and as large as the client says, the slot layout is then
+    // checked once by GLIS_frame_slots_open and never read from the region again
+    if (fd != -1) {
+        if (SHM_sealed(fd, payload.frames_size)) {
+            CW->frames.memory.fd = fd;
+            CW->frames.memory.size = payload.frames_size;
+            reply.registered = GLIS_frame_slots_open(CW->frames);
+        }
+        if (!reply.registered) {
+            LOG_ERROR("refusing the frame slots window %zu registered", window_id);
+            SHM_close(fd);
+            CW->frames.memory.fd = -1;
+        }
+    }
+    if (reply.registered)
+        LOG_INFO("window %zu registered %zu bytes of frame slots", window_id,
+                 payload.frames_size);
+    GLIS_REPLY_register_window_frames::encode(out, reply);
+    CompositorMain.server.socket_put_serial(out);
+    return false;
+}
+
+// every client gets its own request rings and doorbell, they are handed over on the keep alive
+// connection, frames travel through the frame slots of each window
+bool COMPOSITOR_command_new_connection(serializer &in, serializer &out,
+                                       GLIS_client_channel *client,
+                                       std::vector<GLIS_new_window_reply> *batch) {
+    if (client != nullptr) {
+        LOG_ERROR("a client channel can only be asked for over a session");
+        return false;
+    }
+    GLIS_client_channel *channel = GLIS_client_channel_create();
+    if (channel == nullptr) {
+        LOG_ERROR("failed to create a channel for the new connection");
+        return false;
+    }
+    char *s = SERVER_allocate_new_server(SERVER_START_REPLY_MANUALLY, channel->server_id);
+    CompositorMain.server.socket_watch(channel->doorbell);
+    GLIS_CLIENT_CHANNELS.push_back(channel);
+    long t; // unused
+    int e = pthread_create(&t, nullptr, KEEP_ALIVE_MAIN_NOTIFIER, channel);
+    if (e != 0)
+        LOG_ERROR("pthread_create(): errno: %d (%s) | return: %d (%s)", errno,
+                  strerror(errno), e,
+                  strerror(e));
+    else
+        LOG_INFO("KEEP_ALIVE_MAIN_NOTIFIER thread successfully started");
+    out.add_pointer<char>(s, 107);
+    CompositorMain.server.socket_put_serial(out);
+    return false;
+}
+
+class COMPOSITOR_command_entry {
+    public:
+        int id;
+        const char *name;
+        COMPOSITOR_command_handler execute;
+};
+
+// indexed by command id, adding a command to GLIS_SERVER_COMMAND_IDS means adding its entry
+// here, ids that are not commands have no handler
+constexpr COMPOSITOR_command_entry COMPOSITOR_COMMAND_TABLE[] = {
+    {0, nullptr, nullptr},
+    {GLIS_SERVER_COMMAND_IDS::texture, "Texture Upload", COMPOSITOR_command_texture},
+    {GLIS_SERVER_COMMAND_IDS::new_window, "Create New Window", COMPOSITOR_command_new_window},
+    {GLIS_SERVER_COMMAND_IDS::modify_window, "Modify Window", COMPOSITOR_command_modify_window},
+    {GLIS_SERVER_COMMAND_IDS::close_window, "Close Window", COMPOSITOR_command_close_window},
+    {5, nullptr, nullptr},
+    {6, nullptr, nullptr},
+    {GLIS_SERVER_COMMAND_IDS::new_connection, "New Server Connection",
+        COMPOSITOR_command_new_connection},
+    {GLIS_SERVER_COMMAND_IDS::shm_texture_damage, "Texture Damage Upload",
+        COMPOSITOR_command_texture},
+    {GLIS_SERVER_COMMAND_IDS::resize_window_frames, "Resize Window Frames",
+        COMPOSITOR_command_resize_window_frames},
+    {GLIS_SERVER_COMMAND_IDS::batch, "Batch", COMPOSITOR_command_batch},
+    {GLIS_SERVER_COMMAND_IDS::register_window_frames, "Register Window Frames",
+        COMPOSITOR_command_register_window_frames},
+    {GLIS_SERVER_COMMAND_IDS::set_window_flags, "Set Window Flags",
+        COMPOSITOR_command_set_window_flags},
+};
+
+const int COMPOSITOR_COMMAND_COUNT =
+    sizeof(COMPOSITOR_COMMAND_TABLE) / sizeof(COMPOSITOR_command_entry);
+
+constexpr bool COMPOSITOR_command_table_is_indexed(int id = 0) {
+    return id == COMPOSITOR_COMMAND_COUNT ||
+           (COMPOSITOR_COMMAND_TABLE[id].id == id && COMPOSITOR_command_table_is_indexed(id + 1));
+}
+
+static_assert(COMPOSITOR_command_table_is_indexed(),
+              "every entry of COMPOSITOR_COMMAND_TABLE must sit at the index of its id");
+
+// what every command that has been executed cost, a batch counts the commands inside it as
+// well as itself
+class COMPOSITOR_command_statistics {
+    public:
+        // nanoseconds spent in the handler
+        HISTOGRAM latency;
+        // the bytes of the command read from its message, pixels latched from frame slots are
+        // not counted
+        uint64_t bytes = 0;
+};
+
+COMPOSITOR_command_statistics COMPOSITOR_COMMAND_STATISTICS[COMPOSITOR_COMMAND_COUNT];
+
+const char *COMPOSITOR_command_name(int command) {
+    if (command < 0 || command >= COMPOSITOR_COMMAND_COUNT ||
+        COMPOSITOR_COMMAND_TABLE[command].name == nullptr)
+        return "unknown";
+    return COMPOSITOR_COMMAND_TABLE[command].name;
+}
+
+// decodes and applies a single command, see COMPOSITOR_command_handler
+bool COMPOSITOR_execute_command(serializer &in, serializer &out, GLIS_client_channel *client,
+                                std::vector<GLIS_new_window_reply> *batch) {
+    size_t in_start = in.cursor;
+    int command = -1;
+    in.get<int>(&command);
+    if (command < 0 || command >= COMPOSITOR_COMMAND_COUNT ||
+        COMPOSITOR_COMMAND_TABLE[command].execute == nullptr) {
+        LOG_ERROR("unknown command: %d", command);
+        return false;
+    }
+    COMPOSITOR_FRAMES.pending_commands++;
+    TRACE_INFO("command: %d (%s)", command, COMPOSITOR_COMMAND_TABLE[command].name);
+    uint64_t start = TRACE_now();
+    bool redraw = COMPOSITOR_COMMAND_TABLE[command].execute(in, out, client, batch);
+    COMPOSITOR_command_statistics &statistics = COMPOSITOR_COMMAND_STATISTICS[command];
+    HISTOGRAM_record(statistics.latency, TRACE_now() - start);
+    statistics.bytes += in.cursor - in_start;
+    return redraw;
+}
+
+// logs the latency of every command that has been executed since the last call and resets it
+void COMPOSITOR_command_statistics_log() {
+    for (int command = 0; command < COMPOSITOR_COMMAND_COUNT; command++) {
+        COMPOSITOR_command_statistics &statistics = COMPOSITOR_COMMAND_STATISTICS[command];
+        HISTOGRAM &latency = statistics.latency;
+        if (latency.count == 0) continue;
+        LOG_INFO("%s: %llu executed, p50 %G us, p99 %G us, max %G us, %G ms in total, "
+                 "%llu bytes", COMPOSITOR_COMMAND_TABLE[command].name,
+                 static_cast<unsigned long long>(latency.count),
+                 HISTOGRAM_percentile(latency, 50) / 1000.0,
+                 HISTOGRAM_percentile(latency, 99) / 1000.0, latency.max / 1000.0,
+                 latency.total / 1000000.0, static_cast<unsigned long long>(statistics.bytes));
+        HISTOGRAM_reset(latency);
+        statistics.bytes = 0;
+    }
+}
+
+// executes the requests waiting on every ready session of the main server, each reply starts
+// with the id of the request it answers, sessions closed by their client are dropped
+bool COMPOSITOR_service_sessions(std::vector<int> &ready, serializer &out) {
+    bool redraw = false;
+    SOCKET_SERVER &server = CompositorMain.server;
+    for (int session : ready) {
+        server.session_select(session);
+        // a client may pipeline requests, take as many as are waiting but do not let it hold
+        // the other sessions off for more than GLIS_COMMAND_RING_DRAIN_MAX of them
+        size_t executed = 0;
+        do {
+            serializer in;
+            if (!server.socket_get_serial(in)) {
+                LOG_INFO_SERVER("%ssession %d closed", server.TAG, session);
+                server.session_close(session);
+                break;
+            }
+            uint32_t request = 0;
+            in.get<uint32_t>(&request);
+            out.add<uint32_t>(request);
+            if (COMPOSITOR_execute_command(in, out, nullptr)) redraw = true;
+            out.reset();
+            executed++;
+        } while (executed < GLIS_COMMAND_RING_DRAIN_MAX && server.session_has_request(session));
+    }
+    return redraw;
+}
+
+// reads the requests waiting on a session until none are left or GLIS_COMMAND_RING_DRAIN_MAX
+// have been read, then hands the session back to the render thread
+void COMPOSITOR_decode_session(SOCKET_DATA_TRANSFER_INFO &info, COMPOSITOR_decode_job &job) {
+    SOCKET_SERVER &server = CompositorMain.server;
+    size_t received = 0;
+    int kind = COMPOSITOR_COMMAND_RESUME;
+    job.reader->stop_fd = COMPOSITOR_DECODE_STOP_FD;
+    job.reader->timeout_ms = COMPOSITOR_DECODE_TIMEOUT_MS;
+    do {
+        COMPOSITOR_command *command = new COMPOSITOR_command;
+        command->session = job.session;
+        if (!SOCKET_GET_SERIAL(info, server.TAG, *job.reader, job.session, command->in,
+                               server.server_name, server.transport)) {
+            delete command;
+            kind = COMPOSITOR_COMMAND_CLOSED;
+            break;
+        }
+        command->in.get<uint32_t>(&command->request);
+        int id = -1;
+        command->in.peek<int>(&id);
+        if (id == GLIS_SERVER_COMMANDS.register_window_frames)
+            SOCKET_GET_FD(info, server.TAG, *job.reader, job.session, command->fd,
+                          server.server_name, server.transport);
+        MPSC_QUEUE_push(COMPOSITOR_COMMANDS, command);
+        received++;
+    } while (received < GLIS_COMMAND_RING_DRAIN_MAX &&
+             SOCKET_READER_has_data(*job.reader, job.session));
+    COMPOSITOR_command *done = new COMPOSITOR_command;
+    done->kind = kind;
+    done->session = job.session;
+    MPSC_QUEUE_push(COMPOSITOR_COMMANDS, done);
+    eventfd_write(COMPOSITOR_COMMANDS_READY, 1);
+}
+
+void *COMPOSITOR_decode_worker(void *arg) {
+    // every worker keeps its own transfer counters
+    SOCKET_DATA_TRANSFER_INFO info;
+    for (;;) {
+        pthread_mutex_lock(&COMPOSITOR_DECODE_JOBS_LOCK);
+        while (!COMPOSITOR_DECODE_STOP && COMPOSITOR_DECODE_JOBS.empty())
+            pthread_cond_wait(&COMPOSITOR_DECODE_JOBS_CONDITION, &COMPOSITOR_DECODE_JOBS_LOCK);
+        if (COMPOSITOR_DECODE_STOP) {
+            pthread_mutex_unlock(&COMPOSITOR_DECODE_JOBS_LOCK);
+            break;
+        }
+        COMPOSITOR_decode_job job = COMPOSITOR_DECODE_JOBS.front();
+        COMPOSITOR_DECODE_JOBS.pop_front();
+        pthread_mutex_unlock(&COMPOSITOR_DECODE_JOBS_LOCK);
+        COMPOSITOR_decode_session(info, job);
+    }
+    return nullptr;
+}
+
+bool COMPOSITOR_decode_workers_start(int count) {
+    if (count <= 0) return true;
+    COMPOSITOR_COMMANDS_READY = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (COMPOSITOR_COMMANDS_READY < 0) {
+        LOG_ERROR("eventfd: %d (%s)", errno, strerror(errno));
+        return false;
+    }
+    COMPOSITOR_DECODE_STOP_FD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (COMPOSITOR_DECODE_STOP_FD < 0) {
+        LOG_ERROR("eventfd: %d (%s)", errno, strerror(errno));
+        close(COMPOSITOR_COMMANDS_READY);
+        COMPOSITOR_COMMANDS_READY = -1;
+        return false;
+    }
+    CompositorMain.server.socket_watch(COMPOSITOR_COMMANDS_READY);
+    COMPOSITOR_DECODE_STOP = false;
+    for (int i = 0; i < count; i++) {
+        pthread_t worker;
+        int e = pthread_create(&worker, nullptr, COMPOSITOR_decode_worker, nullptr);
+        if (e != 0) LOG_ERROR("pthread_create(): %d (%s)", e, strerror(e));
+        else COMPOSITOR_DECODE_THREADS.push_back(worker);
+    }
+    LOG_INFO("started %zu decode workers", COMPOSITOR_DECODE_THREADS.size());
+    return !COMPOSITOR_DECODE_THREADS.empty();
+}
+
+void COMPOSITOR_decode_workers_stop() {
+    if (COMPOSITOR_COMMANDS_READY < 0) return;
+    pthread_mutex_lock(&COMPOSITOR_DECODE_JOBS_LOCK);
+    COMPOSITOR_DECODE_STOP = true;
+    COMPOSITOR_DECODE_JOBS.clear();
+    pthread_cond_broadcast(&COMPOSITOR_DECODE_JOBS_CONDITION);
+    pthread_mutex_unlock(&COMPOSITOR_DECODE_JOBS_LOCK);
+    // wakes the workers waiting on a session
+    eventfd_write(COMPOSITOR_DECODE_STOP_FD, 1);
+    for (pthread_t worker : COMPOSITOR_DECODE_THREADS) pthread_join(worker, nullptr);
+    COMPOSITOR_DECODE_THREADS.clear();
+    MPSC_QUEUE_NODE *node;
+    while ((node = MPSC_QUEUE_pop(COMPOSITOR_COMMANDS)) != nullptr) {
+        COMPOSITOR_command *command = static_cast<COMPOSITOR_command *>(node);
+        if (command->fd != -1) SHM_close(command->fd);
+        delete command;
+    }
+    CompositorMain.server.socket_unwatch(COMPOSITOR_COMMANDS_READY);
+    close(COMPOSITOR_COMMANDS_READY);
+    COMPOSITOR_COMMANDS_READY = -1;
+    close(COMPOSITOR_DECODE_STOP_FD);
+    COMPOSITOR_DECODE_STOP_FD = -1;
+}
+
+// hands every ready session to the workers, socket_wait does not report it again until the
+// render thread sees the worker is done with it
+void COMPOSITOR_dispatch_sessions(std::vector<int> &ready) {
+    if (ready.empty()) return;
+    SOCKET_SERVER &server = CompositorMain.server;
+    pthread_mutex_lock(&COMPOSITOR_DECODE_JOBS_LOCK);
+    for (int session : ready) {
+        server.session_suspend(session);
+        COMPOSITOR_DECODE_JOBS.push_back({session, &server.reader(session)});
+    }
+    pthread_cond_broadcast(&COMPOSITOR_DECODE_JOBS_CONDITION);
+    pthread_mutex_unlock(&COMPOSITOR_DECODE_JOBS_LOCK);
+}
+
+// executes every command the workers have queued so far, replies go out from here so only
+// the render thread writes to the sessions
+bool COMPOSITOR_apply_commands(serializer &out) {
+    bool redraw = false;
+    SOCKET_SERVER &server = CompositorMain.server;
+    MPSC_QUEUE_NODE *node;
+    while ((node = MPSC_QUEUE_pop(COMPOSITOR_COMMANDS)) != nullptr) {
+        COMPOSITOR_command *command = static_cast<COMPOSITOR_command *>(node);
+        if (command->kind == COMPOSITOR_COMMAND_REQUEST) {
+            server.session_select(command->session);
+            out.add<uint32_t>(command->request);
+            COMPOSITOR_CURRENT_COMMAND = command;
+            if (COMPOSITOR_execute_command(command->in, out, nullptr)) redraw = true;
+            COMPOSITOR_CURRENT_COMMAND = nullptr;
+            out.reset();
+            // the command did not take the fd that came with it
+            if (command->fd != -1) SHM_close(command->fd);
+        } else if (command->kind == COMPOSITOR_COMMAND_CLOSED) {
+            LOG_INFO_SERVER("%ssession %d closed", server.TAG, command->session);
+            server.session_close(command->session);
+        } else server.session_resume(command->session);
+        delete command;
+    }
+    return redraw;
+}
+
+// services the sessions socket_wait found ready, through the workers if there are any
+bool COMPOSITOR_service(std::vector<int> &ready, std::vector<int> &watched, serializer &out) {
+    if (COMPOSITOR_DECODE_THREADS.empty()) return COMPOSITOR_service_sessions(ready, out);
+    for (int fd : watched) {
+        if (fd != COMPOSITOR_COMMANDS_READY) continue;
+        eventfd_t value;
+        eventfd_read(COMPOSITOR_COMMANDS_READY, &value);
+    }
+    COMPOSITOR_dispatch_sessions(ready);
+    return COMPOSITOR_apply_commands(out);
+}
+
+// unpins the frame slots of every window that has not published a frame for
+// GLIS_FRAME_SLOTS_IDLE_MS so the kernel can reclaim them, they are pinned again
+// by the client when it renders into them
+void COMPOSITOR_purge_idle_windows() {
+    double now = now_ms();
+    for (size_t i = 0; i < WINDOW_LIST_count(COMPOSITOR_WINDOWS); i++) {
+        size_t id = COMPOSITOR_WINDOWS.id[i];
+        struct Client_Window *CW = static_cast<Client_Window *>(
+            CompositorMain.KERNEL.table->table[id]->resource);
+        if (CW->frames.purged || now - CW->last_frame_ms < GLIS_FRAME_SLOTS_IDLE_MS)
+            continue;
+        size_t purged = GLIS_frame_slots_purge(CW->frames);
+        if (purged != 0) LOG_INFO("window %zu is idle, unpinned %zu bytes", id, purged);
+    }
+}
+
+// the windows to draw each frame
+COMPOSITOR_occlusion COMPOSITOR_OCCLUSION;
+
 int COMPOSITORMAIN__() {
     LOG_INFO("called COMPOSITORMAIN__()");
     system(std::string(std::string("chmod -R 777 ") + executableDir).c_str());
@@ -134,23 +1073,15 @@ int COMPOSITORMAIN__() {
     char *args2[2] = {exe2, 0};
     GLIS_FORK(args2[0], args2);
 
-    SYNC_STATE = STATE.initialized;
-    while (SYNC_STATE != STATE.request_startup);
+    // the surface may already have been handed over
+    SYNC_VARIABLE_transition(SYNC_STATE, STATE.no_state, STATE.initialized);
+    SYNC_VARIABLE_wait(SYNC_STATE, STATE.request_startup);
     LOG_INFO("starting up");
-    SYNC_STATE = STATE.response_starting_up;
+    SYNC_VARIABLE_transition(SYNC_STATE, STATE.request_startup, STATE.response_starting_up);
     LOG_INFO("initializing main Compositor");
     if (GLIS_setupOnScreenRendering(CompositorMain)) {
-        if (IPC == IPC_MODE.shared_memory) {
-            assert(GLIS_shared_memory_malloc(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA,
-                                             sizeof(size_t) +
-                                             sizeof(int8_t) +
-                                             (sizeof(GLuint) * CompositorMain.height *
-                                              CompositorMain.width)));
-            assert(GLIS_shared_memory_malloc(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER,
-                                             sizeof(size_t) + sizeof(int8_t) +
-                                             (sizeof(int8_t) * 4)));
-        }
         CompositorMain.server.startServer(SERVER_START_REPLY_MANUALLY);
+        COMPOSITOR_decode_workers_start(COMPOSITOR_DECODE_WORKERS);
         LOG_INFO("initialized main Compositor");
         GLuint shaderProgram;
         GLuint vertexShader;
@@ -176,286 +1107,139 @@ int COMPOSITORMAIN__() {
         GLIS_error_to_string_exec_GL(glClearColor(0.0F, 0.0F, 1.0F, 1.0F));
         GLIS_error_to_string_exec_GL(glClear(GL_COLOR_BUFFER_BIT));
         SERVER_LOG_TRANSFER_INFO = true;
-        SYNC_STATE = STATE.response_started_up;
+        // a shutdown requested while starting up is kept
+        SYNC_VARIABLE_transition(SYNC_STATE, STATE.response_starting_up,
+                                 STATE.response_started_up);
         LOG_INFO("started up");
-        struct Client_Window {
-            int x;
-            int y;
-            int w;
-            int h;
-            GLuint TEXTURE;
-        };
         GLIS_error_to_string_exec_GL(glClearColor(0.0F, 0.0F, 1.0F, 1.0F));
         GLIS_error_to_string_exec_GL(glClear(GL_COLOR_BUFFER_BIT));
         GLIS_error_to_string_exec_EGL(
             eglSwapBuffers(CompositorMain.display, CompositorMain.surface));
         GLIS_Sync_GPU();
-        double program_start = now_ms();
-        while(SYNC_STATE != STATE.request_shutdown) {
-            double loop_start = now_ms();
+        TRACE_VERBOSE_START(program_start);
+        while(SYNC_VARIABLE_get(SYNC_STATE) != STATE.request_shutdown) {
+            TRACE_VERBOSE_START(loop_start);
             bool redraw = false;
-            bool accepted = false;
             serializer in;
             serializer out;
-            int command = -1;
+            // sessions with requests waiting and doorbells that rang, refilled by socket_wait
+            static std::vector<int> ready;
+            static std::vector<int> rang;
             if (IPC == IPC_MODE.socket) {
-                LOG_INFO_SERVER("%swaiting for connection", CompositorMain.server.TAG);
-                if (CompositorMain.server.socket_accept()) {
-                    LOG_INFO_SERVER("%sconnection obtained", CompositorMain.server.TAG);
-                    CompositorMain.server.socket_get_serial(in);
-                } else {
-                    LOG_ERROR_SERVER("%sfailed to obtain a connection", CompositorMain.server.TAG);
-                    goto draw;
+                if (SYNC_VARIABLE_get(CompositorMain.server.internaldata->server_should_close)) {
+                    // nothing can connect, sleep until shutdown is requested
+                    SYNC_VARIABLE_wait(SYNC_STATE, STATE.request_shutdown);
+                    continue;
                 }
+                CompositorMain.server.socket_wait(
+                    ready, rang,
+                    COMPOSITOR_frame_wait_ms(COMPOSITOR_FRAMES, GLIS_SHARED_MEMORY_WAIT_TIMEOUT_MS));
+                redraw = COMPOSITOR_service(ready, rang, out);
+                COMPOSITOR_purge_idle_windows();
             } else if (IPC == IPC_MODE.shared_memory) {
-                if (!CompositorMain.server.socket_accept_non_blocking()) {
-                    if (CompositorMain.server.internaldata->server_should_close) continue;
-                    if (GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count != 0) {
-                        LOG_INFO("reference_count != 0 , waiting for parameter");
-                        double start = now_ms();
-                        GLIS_shared_memory_read(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER, in);
-                        double end = now_ms();
-                        LOG_INFO("read parameters in %G milliseconds", end - start);
-                    } else continue;
-                } else {
-                    double start = now_ms();
-                    CompositorMain.server.socket_get_serial(in);
-                    double end = now_ms();
-                    LOG_INFO("read serial in %G milliseconds", end - start);
-                }
-            }
-            in.get<int>(&command);
-            if (IPC == IPC_MODE.socket)
-                LOG_INFO_SERVER("%scommand: %d (%s)",
-                                CompositorMain.server.TAG, command,
-                                GLIS_command_to_string(command));
-            else
-                LOG_INFO("command: %d (%s)", command, GLIS_command_to_string(command));
-            if (command == GLIS_SERVER_COMMANDS.new_window) {
-                redraw = true;
-                int *win;
-                assert(in.get_raw_pointer<int>(&win) == 4); // must have 4 indexes
-                struct Client_Window *x = new struct Client_Window;
-                x->x = win[0];
-                x->y = win[1];
-                x->w = win[2];
-                x->h = win[3];
-                size_t id = CompositorMain.KERNEL.table->findObject(
-                    CompositorMain.KERNEL.newObject(0, 0, x));
-                if (IPC == IPC_MODE.socket) {
-                    LOG_INFO_SERVER("%swindow %zu: %d,%d,%d,%d",
-                                    CompositorMain.server.TAG, id, win[0], win[1], win[2], win[3]);
-                    if (SERVER_LOG_TRANSFER_INFO)
-                        LOG_INFO_SERVER("%ssending id %zu", CompositorMain.server.TAG, id);
-                } else {
-                    LOG_INFO("window %zu: %d,%d,%d,%d", id, win[0], win[1], win[2], win[3]);
-                    LOG_INFO("sending id %zu", id);
+                GLIS_client_channels_collect(CompositorMain.server, GLIS_CLIENT_CHANNELS);
+                if (SYNC_VARIABLE_get(CompositorMain.server.internaldata->server_should_close)) {
+                    // nothing can connect, sleep until shutdown is requested
+                    SYNC_VARIABLE_wait(SYNC_STATE, STATE.request_shutdown);
+                    continue;
                 }
-                out.add<int>(id);
-                if (IPC == IPC_MODE.socket) CompositorMain.server.socket_put_serial(out);
-                else if (IPC == IPC_MODE.shared_memory)
-                    GLIS_shared_memory_write(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER, out);
-                redraw = true;
-            } else if (command == GLIS_SERVER_COMMANDS.modify_window) {
-                redraw = true;
-                size_t window_id;
-                in.get<size_t>(&window_id);
-                int *win;
-                assert(in.get_raw_pointer<int>(&win) == 4); // must have 4 indexes
-                assert(win != 0);
-                assert(win != nullptr);
-                assert(window_id >= 0);
-                assert(CompositorMain.KERNEL.table->table[window_id] != nullptr);
-                struct Client_Window *c = reinterpret_cast<Client_Window *>(
-                    CompositorMain.KERNEL.table->table[window_id]->resource
-                );
-                c->x = win[0];
-                c->y = win[1];
-                c->w = win[2];
-                c->h = win[3];
-            } else if (command == GLIS_SERVER_COMMANDS.close_window) {
-                redraw = true;
-                size_t window_id;
-                in.get<size_t>(&window_id);
-                CompositorMain.KERNEL.table->DELETE(window_id);
-            } else if (command == GLIS_SERVER_COMMANDS.texture) {
-                redraw = true;
-                size_t Client_id;
-                in.get<size_t>(&Client_id);
-                if (IPC == IPC_MODE.socket) {
-                    if (SERVER_LOG_TRANSFER_INFO)
-                        LOG_INFO_SERVER("%sreceived id: %zu", CompositorMain.server.TAG, Client_id);
-                } else {
-                    LOG_INFO("received id: %zu", Client_id);
+                // one wait point for new connections, every session and the doorbell of
+                // every client's request ring
+                bool pending = GLIS_client_channels_sleep(GLIS_CLIENT_CHANNELS);
+                CompositorMain.server.socket_wait(
+                    ready, rang, pending ? 0 : COMPOSITOR_frame_wait_ms(
+                        COMPOSITOR_FRAMES, GLIS_SHARED_MEMORY_WAIT_TIMEOUT_MS));
+                GLIS_client_channels_wake(GLIS_CLIENT_CHANNELS, rang);
+                redraw = COMPOSITOR_service(ready, rang, out);
+                // drain everything each client queued since the last iteration and draw once
+                // for the whole batch, a client can not hold the others off for more than
+                // GLIS_COMMAND_RING_DRAIN_MAX commands
+                size_t drained = 0;
+                TRACE_INFO_START(start);
+                for (size_t i = 0; i < GLIS_CLIENT_CHANNELS.size(); i++) {
+                    GLIS_client_channel *client = GLIS_CLIENT_CHANNELS[i];
+                    size_t executed = 0;
+                    while (executed < GLIS_COMMAND_RING_DRAIN_MAX &&
+                           GLIS_command_ring_pop(client->requests, in, 0)) {
+                        if (COMPOSITOR_execute_command(in, out, client)) redraw = true;
+                        out.reset();
+                        executed++;
+                    }
+                    if (client->requests.corrupt) GLIS_client_channel_disconnect(client);
+                    drained += executed;
                 }
-                GLint *tex_dimens;
-                assert(in.get_raw_pointer<GLint>(&tex_dimens) == 2);
-                if (IPC == IPC_MODE.socket) {
-                    if (SERVER_LOG_TRANSFER_INFO)
-                        LOG_INFO_SERVER("%sreceived w: %d, h: %d",
-                                        CompositorMain.server.TAG, tex_dimens[0], tex_dimens[1]);
-                } else {
-                    LOG_INFO("received w: %d, h: %d", tex_dimens[0], tex_dimens[1]);
-                }
-                struct Client_Window *CW = static_cast<Client_Window *>(
-                    CompositorMain.KERNEL.table->table[Client_id]->resource);
-                GLIS_error_to_string_exec_GL(
-                    glGenTextures(1, &CW->TEXTURE));
-                GLIS_error_to_string_exec_GL(
-                    glBindTexture(GL_TEXTURE_2D, CW->TEXTURE));
-                GLuint *texdata = nullptr;
-                if (IPC == IPC_MODE.shared_memory) {
-                    LOG_INFO("reading texture");
-                    GLIS_shared_memory_read_texture(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA,
-                                                    reinterpret_cast<int8_t **>(&texdata));
-                    LOG_INFO("read texture");
-                } else if (IPC == IPC_MODE.socket) {
-                    in.get_raw_pointer<GLuint>(&texdata);
-                }
-                GLIS_error_to_string_exec_GL(
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_dimens[0], tex_dimens[1], 0,
-                                 GL_RGBA, GL_UNSIGNED_BYTE, texdata)
-                );
-                if (texdata != nullptr) free(texdata);
-                GLIS_error_to_string_exec_GL(glGenerateMipmap(GL_TEXTURE_2D));
-                GLIS_error_to_string_exec_GL(
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
-                                    GL_NEAREST));
-                GLIS_error_to_string_exec_GL(
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                                    GL_LINEAR));
-                GLIS_error_to_string_exec_GL(
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
-                                    GL_CLAMP_TO_BORDER));
-                GLIS_error_to_string_exec_GL(
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
-                                    GL_CLAMP_TO_BORDER));
-                GLIS_error_to_string_exec_GL(glBindTexture(GL_TEXTURE_2D, 0));
-            } else if (command == GLIS_SERVER_COMMANDS.shm_texture) {
-                double start = now_ms();
-                assert(ashmem_valid(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.fd));
-                LOG_INFO_SERVER("GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count = %zu",
-                                GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.reference_count);
-                GLIS_shared_memory_increase_reference(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA);
-                out.add<size_t>(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.size);
-                out.add<size_t>(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.reference_count);
-                if (IPC == IPC_MODE.socket) {
-                    if (SERVER_LOG_TRANSFER_INFO)
-                        LOG_INFO_SERVER("%ssending id %d, sise: %zu",
-                                        CompositorMain.server.TAG,
-                                        GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.fd,
-                                        GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.size);
-                } else {
-                    LOG_INFO("sending id %d, sise: %zu",
-                             GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.fd,
-                             GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.size);
-                }
-                CompositorMain.server.socket_put_fd(GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.fd);
-                CompositorMain.server.socket_put_serial(out);
-                LOG_INFO_SERVER("GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count = %zu",
-                                GLIS_INTERNAL_SHARED_MEMORY_TEXTURE_DATA.reference_count);
-                double end = now_ms();
-                LOG_INFO("send texture file descriptor in %G milliseconds", end - start);
-            } else if (command == GLIS_SERVER_COMMANDS.shm_params) {
-                double start = now_ms();
-                assert(ashmem_valid(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.fd));
-                LOG_INFO_SERVER("GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count = %zu",
-                                GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count);
-                GLIS_shared_memory_increase_reference(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER);
-                out.add<size_t>(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.size);
-                out.add<size_t>(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count);
-                if (IPC == IPC_MODE.socket) {
-                    if (SERVER_LOG_TRANSFER_INFO)
-                        LOG_INFO_SERVER("%ssending id %d, sise: %zu",
-                                        CompositorMain.server.TAG,
-                                        GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.fd,
-                                        GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.size);
-                } else {
-                    LOG_INFO("sending id %d, sise: %zu", GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.fd,
-                             GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.size);
-                }
-                CompositorMain.server.socket_put_fd(GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.fd);
-                CompositorMain.server.socket_put_serial(out);
-                LOG_INFO_SERVER("GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count = %zu",
-                                GLIS_INTERNAL_SHARED_MEMORY_PARAMETER.reference_count);
-                double end = now_ms();
-                LOG_INFO("send parameters file descriptor in %G milliseconds", end - start);
-            } else if (command == GLIS_SERVER_COMMANDS.new_connection) {
-                struct pa {
-                    size_t table_id;
-
-                    class GLIS_shared_memory *GLIS_INTERNAL_SHARED_MEMORY_PARAMETER;
-                } p;
-                p.GLIS_INTERNAL_SHARED_MEMORY_PARAMETER = &GLIS_INTERNAL_SHARED_MEMORY_PARAMETER;
-                char *s = SERVER_allocate_new_server(SERVER_START_REPLY_MANUALLY, p.table_id);
-                long t; // unused
-                int e = pthread_create(&t, nullptr, KEEP_ALIVE_MAIN_NOTIFIER, &p);
-                if (e != 0)
-                    LOG_ERROR("pthread_create(): errno: %d (%s) | return: %d (%s)", errno,
-                              strerror(errno), e,
-                              strerror(e));
-                else
-                    LOG_INFO("KEEP_ALIVE_MAIN_NOTIFIER thread successfully started");
-                out.add_pointer<char>(s, 107);
-                CompositorMain.server.socket_put_serial(out);
+                if (drained != 0)
+                    TRACE_INFO("executed %zu %s from %zu %s in %G milliseconds", drained,
+                               drained == 1 ? "command" : "commands",
+                               GLIS_CLIENT_CHANNELS.size(),
+                               GLIS_CLIENT_CHANNELS.size() == 1 ? "client" : "clients",
+                               TRACE_ms_since(start));
+                COMPOSITOR_purge_idle_windows();
             }
-            if (IPC == IPC_MODE.socket) assert(CompositorMain.server.socket_unaccept());
-            LOG_INFO("CLIENT has uploaded");
-            goto draw;
-            draw:
-            if (redraw) {
+            if (redraw) COMPOSITOR_FRAMES.damaged = true;
+            if (COMPOSITOR_frame_due(COMPOSITOR_FRAMES)) {
                 double start = now_ms();
-                LOG_INFO("rendering");
+                TRACE_VERBOSE("rendering");
                 GLIS_error_to_string_exec_GL(glClearColor(0.0F, 0.0F, 1.0F, 1.0F));
                 GLIS_error_to_string_exec_GL(glClear(GL_COLOR_BUFFER_BIT));
-                int page = 1;
-                size_t index = 0;
-                size_t page_size = CompositorMain.KERNEL.table->page_size;
-                int drawn = 0;
-                double startK = now_ms();
-                for (; page <= CompositorMain.KERNEL.table->Page.count(); page++) {
-                    index = ((page_size * page) - page_size);
-                    for (; index < page_size * page; index++)
-                        if (CompositorMain.KERNEL.table->table[index] != nullptr) {
-                            struct Client_Window *CW = static_cast<Client_Window *>(CompositorMain.KERNEL.table->table[index]->resource);
-                            struct Client_Window *CWT = static_cast<Client_Window *>(CompositorMain.KERNEL.table->table[0]->resource);
-                            double startR = now_ms();
-                            GLIS_draw_rectangle<GLint>(GL_TEXTURE0,
-                                                       CWT->TEXTURE,
-                                                       0, CW->x,
-                                                       CW->y, CW->w, CW->h,
-                                                       CompositorMain.width, CompositorMain.height);
-                            drawn++;
-                            double endR = now_ms();
-                        }
+                TRACE_INFO_START(draw_start);
+                const WINDOW_LIST &windows = COMPOSITOR_WINDOWS;
+                COMPOSITOR_occlusion &occlusion = COMPOSITOR_OCCLUSION;
+                COMPOSITOR_occlusion_cull(occlusion, windows, GLIS_WINDOW_FLAG_OPAQUE,
+                                          CompositorMain.width, CompositorMain.height);
+                for (size_t d = occlusion.draw.size(); d-- > 0;) {
+                    size_t i = occlusion.draw[d];
+                    GLIS_draw_rectangle<GLint>(GL_TEXTURE0, windows.texture[i], 0,
+                                               windows.x1[i], windows.y1[i], windows.x2[i],
+                                               windows.y2[i], CompositorMain.width,
+                                               CompositorMain.height);
                 }
-                double endK = now_ms();
-                LOG_INFO("Drawn %d %s in %G milliseconds", drawn,
-                         drawn == 1 ? "window" : "windows", endK - startK);
-                GLIS_Sync_GPU();
+                TRACE_INFO("Drawn %zu %s in %G milliseconds", occlusion.draw.size(),
+                           occlusion.draw.size() == 1 ? "window" : "windows",
+                           TRACE_ms_since(draw_start));
+                TRACE_INFO("culled %zu windows, %llu fragments (%G overdraw), %llu without "
+                           "culling", occlusion.culled,
+                           static_cast<unsigned long long>(occlusion.fragments),
+                           static_cast<double>(occlusion.fragments) /
+                           (static_cast<double>(CompositorMain.width) * CompositorMain.height),
+                           static_cast<unsigned long long>(occlusion.unculled_fragments));
+                // the GPU is left to finish the frame while the next commands are applied
+                COMPOSITOR_frame_presented(COMPOSITOR_FRAMES, start, now_ms());
                 GLIS_error_to_string_exec_EGL(
                     eglSwapBuffers(CompositorMain.display, CompositorMain.surface));
-                GLIS_Sync_GPU();
-                double end = now_ms();
-                LOG_INFO("rendered in %G milliseconds", end - start);
-                LOG_INFO("since loop start: %G milliseconds", end - loop_start);
-                LOG_INFO("since start: %G milliseconds", end - program_start);
+                TRACE_INFO("rendered in %G milliseconds", now_ms() - start);
+                TRACE_VERBOSE("since loop start: %G milliseconds", TRACE_ms_since(loop_start));
+                TRACE_VERBOSE("since start: %G milliseconds", TRACE_ms_since(program_start));
             }
         }
-        SYNC_STATE = STATE.response_shutting_down;
+        SYNC_VARIABLE_set(SYNC_STATE, STATE.response_shutting_down);
         LOG_INFO("shutting down");
+        if (COMPOSITOR_FRAMES.commands != 0)
+            LOG_INFO("composited %zu frames for %zu commands (%G frames per command)",
+                     COMPOSITOR_FRAMES.frames, COMPOSITOR_FRAMES.commands,
+                     static_cast<double>(COMPOSITOR_FRAMES.frames) / COMPOSITOR_FRAMES.commands);
+        COMPOSITOR_command_statistics_log();
+        COMPOSITOR_occlusion_log(COMPOSITOR_OCCLUSION, CompositorMain.width,
+                                 CompositorMain.height);
 
         // clean up
         LOG_INFO("Cleaning up");
+        COMPOSITOR_decode_workers_stop();
         GLIS_error_to_string_exec_GL(glDeleteProgram(shaderProgram));
         GLIS_error_to_string_exec_GL(glDeleteShader(fragmentShader));
         GLIS_error_to_string_exec_GL(glDeleteShader(vertexShader));
+        WINDOW_LIST_clear(COMPOSITOR_WINDOWS);
         GLIS_destroy_GLIS(CompositorMain);
         LOG_INFO("Destroyed main Compositor GLIS");
+        std::string trace = std::string(executableDir) + "/compositor.trace";
+        LOG_INFO("wrote %zu trace records to %s", TRACE_dump(trace.c_str()), trace.c_str());
         LOG_INFO("Cleaned up");
         LOG_INFO("shut down");
-        SYNC_STATE = STATE.response_shutdown;
-    } else LOG_ERROR("failed to initialize main Compositor");
+        SYNC_VARIABLE_set(SYNC_STATE, STATE.response_shutdown);
+    } else {
+        LOG_ERROR("failed to initialize main Compositor");
+        SYNC_VARIABLE_set(SYNC_STATE, STATE.response_shutdown);
+    }
     return 0;
 }
 
@@ -466,6 +1250,12 @@ void * COMPOSITORMAIN(void * arg) {
     return ret;
 }
 
+extern "C" JNIEXPORT void JNICALL Java_glnative_example_NativeView_nativeSetRefreshRate(
+    JNIEnv *jenv, jclass type, jfloat refresh_rate) {
+    LOG_INFO("display refreshes at %G Hz", static_cast<double>(refresh_rate));
+    COMPOSITOR_frame_set_refresh_rate(COMPOSITOR_FRAMES, refresh_rate);
+}
+
 long COMPOSITORMAIN_threadId;
 extern "C" JNIEXPORT void JNICALL Java_glnative_example_NativeView_nativeOnStart(JNIEnv* jenv,
                                                                                  jclass type,
@@ -6,6 +6,7 @@
 
 class GLIS_CLASS G;
 int main() {
+    TRACE_echo() = GLIS_trace_log;
     int W = 1080;
     int H = 2031;
     if (GLIS_setupOffScreenRendering(G, W, H)) {
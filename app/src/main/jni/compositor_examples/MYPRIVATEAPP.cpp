@@ -32,6 +32,7 @@ void main()
 
 class GLIS_CLASS G;
 int main() {
+    TRACE_echo() = GLIS_trace_log;
     int W = 1000;
     int H = 1000;
     if (GLIS_setupOffScreenRendering(G, W, H)) {
@@ -70,6 +71,8 @@ int main() {
         LOG_INFO("creating window %d", 0);
         size_t win_id1 = GLIS_new_window(0, 0, W, H);
         LOG_INFO("window id: %zu", win_id1);
+        // drawn with an alpha of 1.0 everywhere
+        GLIS_set_window_flags(win_id1, GLIS_WINDOW_FLAG_OPAQUE);
         SERVER_LOG_TRANSFER_INFO = true;
         GLIS_upload_texture(G, win_id1, renderedTexture, W, H);
         LOG_INFO("created window %d", 0);
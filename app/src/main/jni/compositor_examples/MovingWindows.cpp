@@ -33,6 +33,7 @@ void main()
 class GLIS_CLASS G;
 
 int main() {
+    TRACE_echo() = GLIS_trace_log;
     int W = 1080;
     int H = 2031;
     if (GLIS_setupOffScreenRendering(G, W, H)) {
@@ -75,10 +76,15 @@ int main() {
         for (int i = 599; i >= 451; i--) GLIS_modify_window(win_id1, 500, i, 200, 200);
         for (int i = 699; i >= 501; i--) GLIS_modify_window(win_id2, i, 600, 200, 200);
         while (true) {
+            double start = now_ms();
             for (int i = 450; i <= 600; i++) GLIS_modify_window(win_id1, 500, i, 200, 200);
             for (int i = 500; i <= 700; i++) GLIS_modify_window(win_id2, i, 600, 200, 200);
             for (int i = 599; i >= 451; i--) GLIS_modify_window(win_id1, 500, i, 200, 200);
             for (int i = 699; i >= 501; i--) GLIS_modify_window(win_id2, i, 600, 200, 200);
+            double end = now_ms();
+            int commands = 151 + 201 + 149 + 199;
+            LOG_INFO("sent %d commands in %G milliseconds (%G commands per second)", commands,
+                     end - start, commands / ((end - start) / 1000.));
         }
 
         LOG_INFO("Cleaning up");
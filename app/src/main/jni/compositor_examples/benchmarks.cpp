@@ -0,0 +1,457 @@
+//
+// measures the serializer, then the shared memory handshake, the command rings, the client
+// channels, the frame slots and the socket reader, each with a thread on either side of the
+// transport
+// usage: benchmarks
+//
+
+#include "../GLIS.h"
+#include "../shm.h"
+#define LOG_TAG "benchmarks"
+
+double serializer_now_ms() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000. + ts.tv_nsec / 1000000.;
+}
+
+// encodes the same fields GLIS_modify_window sends, serializer_reused keeps one serializer
+// alive across messages so its stream capacity is reused
+void serializer_benchmark_allocations(int mode, const char *name, size_t iterations,
+                                      bool serializer_reused) {
+    serializer reused(mode);
+    size_t allocations = SERIALIZER_allocations();
+    double start = serializer_now_ms();
+    for (size_t i = 0; i < iterations; i++) {
+        int win[4] = {500, static_cast<int>(i), 700, static_cast<int>(i) + 200};
+        if (serializer_reused) {
+            reused.reset();
+            reused.add<int>(3);
+            reused.add<size_t>(i);
+            reused.add_pointer<int>(win, 4);
+            reused.construct();
+        } else {
+            serializer window(mode);
+            window.add<int>(3);
+            window.add<size_t>(i);
+            window.add_pointer<int>(win, 4);
+            window.construct();
+        }
+    }
+    double end = serializer_now_ms();
+    LOG_INFO_serializer("%-14s %zu messages: %6.2f allocations per message, %G milliseconds\n",
+                        name, iterations,
+                        static_cast<double>(SERIALIZER_allocations() - allocations) / iterations,
+                        end - start);
+}
+
+// decodes a texture command carrying a full 1080x2031 RGBA frame, deque mode copies every
+// field out of the stream while arena mode hands out a view of the pixels
+void serializer_benchmark_decode(int mode, const char *name, size_t iterations) {
+    size_t pixels_len = 1080 * 2031;
+    uint32_t *pixels = new uint32_t[pixels_len];
+    memset(pixels, 0, pixels_len * sizeof(uint32_t));
+    int dimens[2] = {1080, 2031};
+    serializer tex;
+    tex.add<int>(1);
+    tex.add<size_t>(0);
+    tex.add_pointer<int>(dimens, 2);
+    tex.add_pointer<uint32_t>(pixels, pixels_len);
+    tex.construct();
+    delete[] pixels;
+    double total = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        serializer in(mode);
+        in.stream.allocate(tex.stream.data_len);
+        memcpy(in.stream.data, tex.stream.data, tex.stream.data_len);
+        double start = serializer_now_ms();
+        int command;
+        size_t id;
+        int *dimens_in;
+        uint32_t *pixels_in;
+        in.deconstruct();
+        in.get<int>(&command);
+        in.get<size_t>(&id);
+        if (mode == SERIALIZER_MODE.arena) {
+            in.get_raw_pointer_view<int>(&dimens_in);
+            in.get_raw_pointer_view<uint32_t>(&pixels_in);
+        } else {
+            in.get_raw_pointer<int>(&dimens_in);
+            in.get_raw_pointer<uint32_t>(&pixels_in);
+            delete[] dimens_in;
+            delete[] pixels_in;
+        }
+        total += serializer_now_ms() - start;
+    }
+    LOG_INFO_serializer("%-14s %zu frames: %G milliseconds per decode\n", name, iterations,
+                        total / iterations);
+}
+
+// the fields serializer_benchmark_allocations encodes, built the way every message was before
+// the stream grew geometrically, each field is copied into a chunk of its own and the stream is
+// then grown to the exact size of every part of every field as the chunks are concatenated,
+// the deque mode still copies the fields but no longer grows the stream this way, so it is
+// measured separately as the baseline
+void serializer_benchmark_baseline(const char *name, size_t iterations) {
+    size_t allocations = 0;
+    // read back so the copies are not optimised away
+    volatile int8_t sink = 0;
+    double start = serializer_now_ms();
+    for (size_t i = 0; i < iterations; i++) {
+        int command = 3;
+        int win[4] = {500, static_cast<int>(i), 700, static_cast<int>(i) + 200};
+        struct serializer_data fields[3] = {
+            {sizeof(int), reinterpret_cast<char *>(&command), 1},
+            {sizeof(size_t), reinterpret_cast<char *>(&i), 1},
+            {sizeof(int), reinterpret_cast<char *>(win), 4},
+        };
+        for (struct serializer_data &field : fields) {
+            char *chunk = new char[field.type_size * field.data_len];
+            allocations++;
+            memcpy(chunk, field.data, field.type_size * field.data_len);
+            field.data = chunk;
+        }
+        int8_t *stream = nullptr;
+        size_t len = 0;
+        for (struct serializer_data &field : fields) {
+            const void *parts[3] = {&field.type_size, &field.data_len, field.data};
+            size_t sizes[3] = {sizeof(int8_t), sizeof(size_t),
+                               static_cast<size_t>(field.type_size) * field.data_len};
+            for (int part = 0; part < 3; part++) {
+                stream = static_cast<int8_t *>(realloc(stream, len + sizes[part]));
+                allocations++;
+                memcpy(stream + len, parts[part], sizes[part]);
+                len += sizes[part];
+            }
+            delete[] field.data;
+        }
+        sink = stream[len - 1];
+        free(stream);
+    }
+    double end = serializer_now_ms();
+    LOG_INFO_serializer("%-14s %zu messages: %6.2f allocations per message, %G milliseconds\n",
+                        name, iterations, static_cast<double>(allocations) / iterations,
+                        end - start);
+}
+
+void serializer_benchmark() {
+    serializer_benchmark_decode(SERIALIZER_MODE.deque, "deque decode:", 20);
+    serializer_benchmark_decode(SERIALIZER_MODE.arena, "arena decode:", 20);
+    size_t iterations = 1000000;
+    serializer_benchmark_baseline("baseline:", iterations);
+    serializer_benchmark_allocations(SERIALIZER_MODE.deque, "deque:", iterations, false);
+    serializer_benchmark_allocations(SERIALIZER_MODE.arena, "arena:", iterations, false);
+    serializer_benchmark_allocations(SERIALIZER_MODE.arena, "arena reused:", iterations, true);
+}
+
+class GLIS_shared_memory_benchmark_reader_args {
+    public:
+        GLIS_shared_memory *sh = nullptr;
+        int iterations = 0;
+        double cpu_ms = 0;
+};
+
+void *GLIS_shared_memory_benchmark_reader(void *arg) {
+    GLIS_shared_memory_benchmark_reader_args *args =
+        static_cast<GLIS_shared_memory_benchmark_reader_args *>(arg);
+    int8_t byte;
+    size_t len;
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    for (int i = 0; i < args->iterations; i++)
+        if (GLIS_shared_memory_read_length(*args->sh, len))
+            GLIS_shared_memory_read_data(*args->sh, &byte, len);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    args->cpu_ms = (end.tv_sec - start.tv_sec) * 1000. + (end.tv_nsec - start.tv_nsec) / 1000000.;
+    return nullptr;
+}
+
+// measures the round trip of a single byte transfer (allocation + data handoffs)
+// and the cpu time the reader burns while waiting, idle_us is slept between transfers
+void GLIS_shared_memory_benchmark(int mode, const char *name, int iterations, int idle_us) {
+    GLIS_shared_memory sh;
+    sh.reference_count = 1;
+    if (!GLIS_shared_memory_malloc(sh, GLIS_SHARED_MEMORY_HEADER_SIZE + sizeof(int8_t))) {
+        LOG_ERROR_SHM("%s failed to allocate shared memory", name);
+        return;
+    }
+    int previous_mode = GLIS_SHARED_MEMORY_WAIT;
+    GLIS_SHARED_MEMORY_WAIT = mode;
+    GLIS_shared_memory_benchmark_reader_args args;
+    args.sh = &sh;
+    args.iterations = iterations;
+    pthread_t reader;
+    pthread_create(&reader, nullptr, GLIS_shared_memory_benchmark_reader, &args);
+    int8_t byte = 0;
+    double total = 0;
+    double wall_start = now_ms();
+    for (int i = 0; i < iterations; i++) {
+        if (idle_us != 0) usleep(static_cast<useconds_t>(idle_us));
+        double start = now_ms();
+        GLIS_shared_memory_write_data(sh, &byte, sizeof(int8_t));
+        total += now_ms() - start;
+    }
+    pthread_join(reader, nullptr);
+    double wall = now_ms() - wall_start;
+    LOG_INFO_SHM("%s %d transfers, %G milliseconds per round trip, "
+                 "reader cpu %G milliseconds over %G milliseconds (%G%%)",
+                 name, iterations, total / iterations, args.cpu_ms, wall,
+                 (args.cpu_ms / wall) * 100.);
+    GLIS_SHARED_MEMORY_WAIT = previous_mode;
+    GLIS_shared_memory_free(sh);
+}
+
+void GLIS_shared_memory_benchmark() {
+    GLIS_shared_memory_benchmark(GLIS_SHARED_MEMORY_WAIT_MODE.spin, "spin:", 10000, 0);
+    GLIS_shared_memory_benchmark(GLIS_SHARED_MEMORY_WAIT_MODE.futex, "futex:", 10000, 0);
+    GLIS_shared_memory_benchmark(GLIS_SHARED_MEMORY_WAIT_MODE.spin, "spin idle:", 200, 5000);
+    GLIS_shared_memory_benchmark(GLIS_SHARED_MEMORY_WAIT_MODE.futex, "futex idle:", 200, 5000);
+}
+
+class GLIS_command_ring_benchmark_consumer_args {
+    public:
+        GLIS_shared_memory *sh = nullptr;
+        GLIS_command_ring *ring = nullptr;
+        int commands = 0;
+};
+
+void *GLIS_command_ring_benchmark_consumer(void *arg) {
+    GLIS_command_ring_benchmark_consumer_args *args =
+        static_cast<GLIS_command_ring_benchmark_consumer_args *>(arg);
+    serializer in;
+    for (int i = 0; i < args->commands; i++) {
+        if (args->ring != nullptr) GLIS_command_ring_pop(*args->ring, in, -1);
+        else GLIS_shared_memory_read(*args->sh, in);
+        int command = -1;
+        GLIS_modify_window_payload payload;
+        in.get<int>(&command);
+        bool decoded = GLIS_MESSAGE_modify_window::decode(in, payload);
+        assert(decoded);
+    }
+    return nullptr;
+}
+
+// sends modify_window commands from one thread to another, either through a one message
+// mailbox region the size of the old parameter region, or through the command ring
+void GLIS_command_ring_benchmark(bool ring, const char *name, int commands) {
+    GLIS_shared_memory sh;
+    sh.reference_count = 1;
+    GLIS_command_ring requests;
+    GLIS_command_ring replies;
+    size_t size = ring ? GLIS_command_rings_size(GLIS_COMMAND_RING_CAPACITY)
+                       : GLIS_SHARED_MEMORY_HEADER_SIZE + (sizeof(int8_t) * 4);
+    if (!GLIS_shared_memory_malloc(sh, size)) {
+        LOG_ERROR_SHM("%s failed to allocate shared memory", name);
+        return;
+    }
+    if (ring) GLIS_command_rings_map(sh, requests, replies, true);
+    GLIS_command_ring_benchmark_consumer_args args;
+    args.sh = &sh;
+    args.ring = ring ? &requests : nullptr;
+    args.commands = commands;
+    pthread_t consumer;
+    double start = now_ms();
+    pthread_create(&consumer, nullptr, GLIS_command_ring_benchmark_consumer, &args);
+    serializer window;
+    for (int i = 0; i < commands; i++) {
+        GLIS_modify_window_payload payload = {0, {500, i % 1000, 700, (i % 1000) + 200}};
+        window.reset();
+        GLIS_MESSAGE_modify_window::encode(window, payload);
+        if (ring) GLIS_command_ring_push(requests, window);
+        else GLIS_shared_memory_write(sh, window);
+    }
+    pthread_join(consumer, nullptr);
+    double end = now_ms();
+    LOG_INFO_SHM("%s %d commands in %G milliseconds (%G commands per second)", name, commands,
+                 end - start, commands / ((end - start) / 1000.));
+    GLIS_shared_memory_free(sh);
+}
+
+void GLIS_command_ring_benchmark() {
+    GLIS_command_ring_benchmark(false, "mailbox:", 10000);
+    GLIS_command_ring_benchmark(true, "ring:", 1000000);
+}
+
+class GLIS_client_channels_benchmark_producer_args {
+    public:
+        GLIS_command_ring ring;
+        int commands = 0;
+};
+
+void *GLIS_client_channels_benchmark_producer(void *arg) {
+    GLIS_client_channels_benchmark_producer_args *args =
+        static_cast<GLIS_client_channels_benchmark_producer_args *>(arg);
+    serializer window;
+    for (int i = 0; i < args->commands; i++) {
+        GLIS_modify_window_payload payload = {0, {500, i % 1000, 700, (i % 1000) + 200}};
+        window.reset();
+        GLIS_MESSAGE_modify_window::encode(window, payload);
+        GLIS_command_ring_push(args->ring, window);
+    }
+    return nullptr;
+}
+
+// one producer thread per client channel, the calling thread services every channel through
+// GLIS_client_channels_wait, sleeping on the doorbells the same way the compositor loop does
+void GLIS_client_channels_benchmark(int clients, int commands) {
+    std::vector<GLIS_client_channel *> channels;
+    std::vector<GLIS_client_channels_benchmark_producer_args> args(clients);
+    std::vector<pthread_t> producers(clients);
+    for (int i = 0; i < clients; i++) {
+        GLIS_client_channel *channel = GLIS_client_channel_create();
+        if (channel == nullptr) return;
+        channels.push_back(channel);
+        // the producer's view of the ring, as the client would map it
+        args[i].ring = channel->requests;
+        args[i].ring.doorbell = channel->doorbell;
+        args[i].commands = commands;
+    }
+    double start = now_ms();
+    for (int i = 0; i < clients; i++)
+        pthread_create(&producers[i], nullptr, GLIS_client_channels_benchmark_producer, &args[i]);
+    serializer in;
+    size_t total = static_cast<size_t>(clients) * commands;
+    size_t received = 0;
+    while (received < total) {
+        GLIS_client_channels_wait(channels, GLIS_SHARED_MEMORY_WAIT_TIMEOUT_MS);
+        for (GLIS_client_channel *channel : channels)
+            while (GLIS_command_ring_pop(channel->requests, in, 0)) received++;
+    }
+    for (int i = 0; i < clients; i++) pthread_join(producers[i], nullptr);
+    double end = now_ms();
+    LOG_INFO_SHM("%d %s: %zu commands in %G milliseconds (%G commands per second)", clients,
+                 clients == 1 ? "client" : "clients", total, end - start,
+                 total / ((end - start) / 1000.));
+    for (GLIS_client_channel *channel : channels) GLIS_client_channel_free(channel);
+}
+
+void GLIS_client_channels_benchmark() {
+    GLIS_client_channels_benchmark(1, 1000000);
+    GLIS_client_channels_benchmark(2, 1000000);
+    GLIS_client_channels_benchmark(4, 1000000);
+}
+
+class GLIS_frame_slots_benchmark_client_args {
+    public:
+        GLIS_frame_slots *frames = nullptr;
+        int frames_to_publish = 0;
+        double waited = 0;
+};
+
+void *GLIS_frame_slots_benchmark_client(void *arg) {
+    GLIS_frame_slots_benchmark_client_args *args =
+        static_cast<GLIS_frame_slots_benchmark_client_args *>(arg);
+    for (int i = 0; i < args->frames_to_publish; i++) {
+        double start = now_ms();
+        int32_t slot = GLIS_frame_slots_acquire(*args->frames);
+        args->waited += now_ms() - start;
+        memset(GLIS_frame_slots_data(*args->frames, slot), i, args->frames->slot_size);
+        // the width doubles as the frame number
+        GLIS_frame_slots_publish(*args->frames, slot, i + 1, 1);
+    }
+    return nullptr;
+}
+
+// a client publishing frames as fast as it can render them against a compositor
+// latching one every latch_interval_us, reports how many frames were displayed, how many
+// the mailbox dropped, and how long the client spent waiting for a slot
+void GLIS_frame_slots_benchmark(uint32_t slot_count, int frames_to_publish,
+                                int latch_interval_us) {
+    GLIS_frame_slots frames;
+    if (!GLIS_frame_slots_create(frames, slot_count, 1024 * 1024)) return;
+    GLIS_frame_slots_benchmark_client_args args;
+    args.frames = &frames;
+    args.frames_to_publish = frames_to_publish;
+    pthread_t client;
+    double start = now_ms();
+    pthread_create(&client, nullptr, GLIS_frame_slots_benchmark_client, &args);
+    int latched = 0;
+    // the client is done once its last frame has been latched
+    for (;;) {
+        int32_t slot = GLIS_frame_slots_latch(frames);
+        if (slot >= 0) {
+            latched++;
+            if (frames.header->slots[slot].width == frames_to_publish) break;
+        }
+        usleep(static_cast<useconds_t>(latch_interval_us));
+    }
+    pthread_join(client, nullptr);
+    double end = now_ms();
+    LOG_INFO_SHM("%u slots: %d frames published, %d displayed, %d dropped, client waited %G "
+                 "of %G milliseconds", slot_count, frames_to_publish, latched,
+                 frames_to_publish - latched, args.waited, end - start);
+    GLIS_frame_slots_free(frames);
+}
+
+void GLIS_frame_slots_benchmark() {
+    GLIS_frame_slots_benchmark(2, 1000, 1000);
+    GLIS_frame_slots_benchmark(3, 1000, 1000);
+}
+
+class SOCKET_READER_benchmark_writer_args {
+    public:
+        int fd = -1;
+        int messages = 0;
+        size_t message_size = 0;
+};
+
+void *SOCKET_READER_benchmark_writer(void *arg) {
+    SOCKET_READER_benchmark_writer_args *args =
+        static_cast<SOCKET_READER_benchmark_writer_args *>(arg);
+    SOCKET_DATA_TRANSFER_INFO s;
+    std::vector<int8_t> payload(args->message_size);
+    serializer message;
+    for (int i = 0; i < args->messages; i++) {
+        message.reset();
+        message.add_pointer<int8_t>(payload.data(), payload.size());
+        SOCKET_SEND_SERIAL(s, "", args->fd, message, const_cast<char *>(""));
+    }
+    return nullptr;
+}
+
+// reports the recvmsg calls and the waits for data it takes to receive a message
+void SOCKET_READER_benchmark(const char *name, int messages, size_t message_size) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        LOG_ERROR_SERVER("socketpair: %d (%s)\n", errno, strerror(errno));
+        return;
+    }
+    SOCKET_READER_benchmark_writer_args args;
+    args.fd = fds[0];
+    args.messages = messages;
+    args.message_size = message_size;
+    pthread_t writer;
+    double start = now_ms();
+    pthread_create(&writer, nullptr, SOCKET_READER_benchmark_writer, &args);
+    SOCKET_DATA_TRANSFER_INFO s;
+    SOCKET_READER reader;
+    int received = 0;
+    for (int i = 0; i < messages; i++) {
+        serializer message;
+        if (SOCKET_GET_SERIAL(s, "", reader, fds[1], message, const_cast<char *>("")))
+            received++;
+    }
+    pthread_join(writer, nullptr);
+    double end = now_ms();
+    LOG_INFO_SERVER("%s %d messages of %zu bytes in %G milliseconds, %G recvmsg and %G waits "
+                    "per message", name, received, message_size, end - start,
+                    static_cast<double>(s.reads) / messages,
+                    static_cast<double>(s.waits) / messages);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void SOCKET_READER_benchmark() {
+    SOCKET_READER_benchmark("small:", 10000, 64);
+    SOCKET_READER_benchmark("1080p frame:", 100, 1920 * 1080 * 4);
+}
+
+int main() {
+    serializer_benchmark();
+    GLIS_shared_memory_benchmark();
+    GLIS_command_ring_benchmark();
+    GLIS_client_channels_benchmark();
+    GLIS_frame_slots_benchmark();
+    SOCKET_READER_benchmark();
+    return 0;
+}
@@ -0,0 +1,606 @@
+//
+// checks the compositor's window bookkeeping against brute force, and the serializer, the
+// MPSC queue, frame slots and batches against what they must refuse, exits with 1 on the
+// first mismatch
+// usage: checks
+//
+// the frame slot and batch checks need GLIS.h, which needs GL, so they are only built for a
+// device, the rest only depends on headers that do not touch GL and is built for the host too
+//
+
+#ifdef __ANDROID__
+#include "../GLIS.h"
+#undef LOG_TAG
+// WINAPI defines min and max as macros, which std::min and std::max can not be used through
+#undef min
+#undef max
+#endif
+#define LOG_TAG "checks"
+
+#include "../histogram.h"
+#include "../region.h"
+#include "../window_list.h"
+#include "../occlusion.h"
+#include "../serializer.h"
+#include "../mpsc_queue.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// any flag works, the window list checks never go near the GLIS protocol
+const uint32_t OPAQUE = 1;
+
+// xorshift, the same sequence on every platform
+uint64_t random_state = 88172645463325252ULL;
+
+uint64_t random_next() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+int random_below(int limit) {
+    return static_cast<int>(random_next() % static_cast<uint64_t>(limit));
+}
+
+// windows with x1, y1, x2, y2 corners
+class screen_bitmap {
+    public:
+        int width;
+        int height;
+        std::vector<uint8_t> pixels;
+
+        screen_bitmap(int width, int height)
+            : width(width), height(height), pixels(static_cast<size_t>(width) * height, 0) {}
+
+        uint8_t &at(int x, int y) { return pixels[static_cast<size_t>(y) * width + x]; }
+
+        void fill(const REGION_rect &r, uint8_t value) {
+            for (int y = std::max(r.y1, 0); y < std::min(r.y2, height); y++)
+                for (int x = std::max(r.x1, 0); x < std::min(r.x2, width); x++) at(x, y) = value;
+        }
+
+        uint64_t count(const REGION_rect &r, uint8_t value) {
+            uint64_t n = 0;
+            for (int y = std::max(r.y1, 0); y < std::min(r.y2, height); y++)
+                for (int x = std::max(r.x1, 0); x < std::min(r.x2, width); x++)
+                    if (at(x, y) == value) n++;
+            return n;
+        }
+};
+
+// a window minus a few rectangles, counted by REGION and pixel by pixel
+bool check_region(int cases) {
+    const int size = 64;
+    REGION region;
+    REGION cut;
+    std::vector<REGION_rect> scratch;
+    for (int i = 0; i < cases; i++) {
+        screen_bitmap bitmap(size, size);
+        REGION_rect window = {random_below(size / 2), random_below(size / 2),
+                              size / 2 + random_below(size / 2),
+                              size / 2 + random_below(size / 2)};
+        REGION_set(region, window);
+        bitmap.fill(window, 1);
+        REGION_clear(cut);
+        for (int k = 0; k < 5; k++) {
+            int x1 = random_below(size);
+            int y1 = random_below(size);
+            REGION_rect r = {x1, y1, x1 + random_below(30), y1 + random_below(30)};
+            cut.rects.push_back(r);
+            bitmap.fill(r, 0);
+        }
+        REGION_subtract(region, cut, scratch);
+        uint64_t expected = bitmap.count({0, 0, size, size}, 1);
+        if (REGION_area(region) != expected) {
+            printf("region: case %d has an area of %llu, the bitmap %llu\n", i,
+                   static_cast<unsigned long long>(REGION_area(region)),
+                   static_cast<unsigned long long>(expected));
+            return false;
+        }
+        for (const REGION_rect &r : region.rects)
+            if (bitmap.count(r, 1) != REGION_rect_area(r)) {
+                printf("region: case %d keeps pixels that were cut\n", i);
+                return false;
+            }
+    }
+    printf("region: %d subtractions match the bitmap\n", cases);
+    return true;
+}
+
+// a culled window must be hidden by the opaque windows above it, checked by painting them
+// front to back
+bool check_culled_windows_are_hidden(const char *name, const WINDOW_LIST &windows,
+                                     COMPOSITOR_occlusion &occlusion, int width, int height) {
+    screen_bitmap covered(width, height);
+    size_t next = 0; // the next entry of occlusion.draw, front to back
+    for (size_t i = WINDOW_LIST_count(windows); i-- > 0;) {
+        REGION_rect window = {windows.x1[i], windows.y1[i], windows.x2[i], windows.y2[i]};
+        bool drawn = next < occlusion.draw.size() && occlusion.draw[next] == i;
+        if (drawn) next++;
+        else if (covered.count(window, 0) != 0) {
+            printf("%s: window %zu is culled but not hidden\n", name, windows.id[i]);
+            return false;
+        }
+        if (windows.flags[i] & OPAQUE) covered.fill(window, 1);
+    }
+    if (next != occlusion.draw.size()) {
+        printf("%s: the draw list is not in front to back order\n", name);
+        return false;
+    }
+    return true;
+}
+
+// two full screen windows with 20 small ones between them and one on top, the top full screen
+// window is opaque so only it and the one above it are drawn
+bool check_cull_23_windows() {
+    const int size = 1000;
+    WINDOW_LIST windows;
+    size_t id = 0;
+    WINDOW_LIST_add(windows, id++, 0, 0, size, size);
+    for (int i = 0; i < 20; i++) WINDOW_LIST_add(windows, id++, i * 50, i * 50, i * 50 + 50, i * 50 + 50);
+    WINDOW_LIST_add(windows, id, 0, 0, size, size);
+    WINDOW_LIST_set_flags(windows, id++, OPAQUE);
+    WINDOW_LIST_add(windows, id++, 100, 100, 150, 150);
+    COMPOSITOR_occlusion occlusion;
+    COMPOSITOR_occlusion_cull(occlusion, windows, OPAQUE, size, size);
+    if (occlusion.draw.size() != 2 || occlusion.culled != 21 ||
+        occlusion.fragments != 1002500 || occlusion.unculled_fragments != 2052500) {
+        printf("23 windows: drew %zu, culled %zu, %llu fragments of %llu, expected 2, 21, "
+               "1002500 of 2052500\n", occlusion.draw.size(), occlusion.culled,
+               static_cast<unsigned long long>(occlusion.fragments),
+               static_cast<unsigned long long>(occlusion.unculled_fragments));
+        return false;
+    }
+    if (!check_culled_windows_are_hidden("23 windows", windows, occlusion, size, size))
+        return false;
+    printf("23 windows: drew 2, culled 21\n");
+    return true;
+}
+
+// a third of 1000 random windows are opaque, culling stops growing the covered area at
+// COMPOSITOR_OCCLUSION_MAX_RECTS so not every hidden window is culled, but every culled one
+// must be hidden
+bool check_cull_1000_windows() {
+    const int width = 1920;
+    const int height = 1080;
+    WINDOW_LIST windows;
+    for (size_t i = 0; i < 1000; i++) {
+        int x = random_below(width - 120);
+        int y = random_below(height - 80);
+        WINDOW_LIST_add(windows, i, x, y, x + 50 + random_below(300), y + 50 + random_below(300));
+        if (random_below(3) == 0) WINDOW_LIST_set_flags(windows, i, OPAQUE);
+    }
+    COMPOSITOR_occlusion occlusion;
+    const int frames = 100;
+    uint64_t start = TRACE_now();
+    for (int i = 0; i < frames; i++)
+        COMPOSITOR_occlusion_cull(occlusion, windows, OPAQUE, width, height);
+    double us = (TRACE_now() - start) / 1000.0 / frames;
+    if (occlusion.culled == 0 || occlusion.fragments >= occlusion.unculled_fragments) {
+        printf("1000 windows: nothing was culled\n");
+        return false;
+    }
+    if (!check_culled_windows_are_hidden("1000 windows", windows, occlusion, width, height))
+        return false;
+    printf("1000 windows: drew %zu, culled %zu, overdraw %.1f against %.1f, %.0f us per cull\n",
+           occlusion.draw.size(), occlusion.culled,
+           static_cast<double>(occlusion.fragments) / (width * height),
+           static_cast<double>(occlusion.unculled_fragments) / (width * height), us);
+    return true;
+}
+
+// percentiles of values spread over many magnitudes against the sorted values
+bool check_histogram() {
+    HISTOGRAM histogram;
+    std::vector<uint64_t> values;
+    for (int i = 0; i < 100000; i++) {
+        uint64_t value = random_next() >> (random_next() % 60);
+        values.push_back(value);
+        HISTOGRAM_record(histogram, value);
+    }
+    std::sort(values.begin(), values.end());
+    const double percentiles[] = {1, 10, 50, 90, 99, 99.9, 100};
+    for (double percentile : percentiles) {
+        uint64_t wanted = static_cast<uint64_t>(percentile / 100.0 * values.size() + 0.5);
+        if (wanted == 0) wanted = 1;
+        uint64_t exact = values[wanted - 1];
+        uint64_t reported = HISTOGRAM_percentile(histogram, percentile);
+        // a bucket holds values within 1/32 of each other
+        if (reported < exact || reported - exact > exact / HISTOGRAM_SUB_BUCKETS) {
+            printf("histogram: p%G is %llu, the exact value is %llu\n", percentile,
+                   static_cast<unsigned long long>(reported),
+                   static_cast<unsigned long long>(exact));
+            return false;
+        }
+    }
+    if (HISTOGRAM_percentile(histogram, 100) != values.back()) {
+        printf("histogram: the maximum is not reported exactly\n");
+        return false;
+    }
+    printf("histogram: percentiles of %zu values are within 1/%llu\n", values.size(),
+           static_cast<unsigned long long>(HISTOGRAM_SUB_BUCKETS));
+    return true;
+}
+
+// every column has an entry per window and position finds each of them
+bool check_window_list_consistent(const WINDOW_LIST &windows, const std::vector<size_t> &ids) {
+    size_t count = WINDOW_LIST_count(windows);
+    if (count != ids.size() || windows.x1.size() != count || windows.y1.size() != count ||
+        windows.x2.size() != count || windows.y2.size() != count ||
+        windows.texture.size() != count || windows.flags.size() != count)
+        return false;
+    for (size_t i = 0; i < count; i++) {
+        size_t id = ids[i];
+        if (windows.id[i] != id || WINDOW_LIST_find(windows, id) != i) return false;
+        // every column was filled from the id, see check_window_list
+        if (windows.x1[i] != static_cast<int>(id) || windows.y2[i] != static_cast<int>(id) + 4 ||
+            windows.texture[i] != id || windows.flags[i] != (id & 1))
+            return false;
+    }
+    for (size_t id = 0; id < windows.position.size(); id++)
+        if (std::find(ids.begin(), ids.end(), id) == ids.end() &&
+            WINDOW_LIST_find(windows, id) != WINDOW_LIST_NONE)
+            return false;
+    return true;
+}
+
+// removing windows from the middle keeps the order of the rest and every column in step
+bool check_window_list() {
+    WINDOW_LIST windows;
+    std::vector<size_t> ids;
+    for (size_t id = 0; id < 64; id++) {
+        int v = static_cast<int>(id);
+        WINDOW_LIST_add(windows, id, v, v + 1, v + 2, v + 4);
+        WINDOW_LIST_set_texture(windows, id, static_cast<uint32_t>(id));
+        WINDOW_LIST_set_flags(windows, id, static_cast<uint32_t>(id & 1));
+        ids.push_back(id);
+    }
+    while (ids.size() > 1) {
+        size_t id = ids[ids.size() / 2];
+        WINDOW_LIST_remove(windows, id);
+        ids.erase(std::find(ids.begin(), ids.end(), id));
+        if (!check_window_list_consistent(windows, ids)) {
+            printf("window list: inconsistent after removing window %zu\n", id);
+            return false;
+        }
+    }
+    // a removed id can be added again, on top
+    WINDOW_LIST_add(windows, 32, 32, 33, 34, 36);
+    WINDOW_LIST_set_texture(windows, 32, 32);
+    ids.push_back(32);
+    if (!check_window_list_consistent(windows, ids)) {
+        printf("window list: inconsistent after adding a removed window again\n");
+        return false;
+    }
+    printf("window list: consistent after 63 removals from the middle\n");
+    return true;
+}
+
+struct check_fixed {
+    int32_t a;
+    int64_t b;
+};
+
+// a stream holding an int followed by a check_fixed, field is set to where the check_fixed
+// starts
+void check_serializer_stream(serializer &S, size_t &field) {
+    S.reset();
+    S.add<int>(7);
+    field = S.stream.data_len;
+    S.add_fixed<check_fixed>({1, 2});
+    S.cursor = field;
+}
+
+// overwrites the header of the field at field, as a peer could
+void check_serializer_forge(serializer &S, size_t field, int8_t type_size, size_t data_len) {
+    S.stream.data[field] = type_size;
+    memcpy(&S.stream.data[field + sizeof(int8_t)], &data_len, sizeof(size_t));
+}
+
+// a field is refused, and the cursor left where it was, if it is not exactly what it is read
+// into or its header claims more bytes than the stream holds
+bool check_serializer() {
+    serializer S(SERIALIZER_MODE.arena);
+    size_t field = 0;
+    check_serializer_stream(S, field);
+    S.cursor = 0;
+    int value = 0;
+    check_fixed fixed = {0, 0};
+    if (!S.get<int>(&value) || value != 7 || !S.get_fixed<check_fixed>(&fixed) ||
+        fixed.a != 1 || fixed.b != 2 || S.get<int>(&value)) {
+        printf("serializer: a well formed stream does not read back\n");
+        return false;
+    }
+    struct {
+        const char *name;
+        int8_t type_size;
+        size_t data_len;
+        size_t cut; // bytes dropped off the end of the stream
+    } cases[] = {
+        {"one byte longer than the stream", 1, sizeof(check_fixed) + 1, 0},
+        {"as long as a size_t can say", 1, SIZE_MAX, 0},
+        {"overflowing once multiplied by its type size", 8, SIZE_MAX / 4, 0},
+        {"a zero type size", 0, sizeof(check_fixed), 0},
+        {"a negative type size", -1, sizeof(check_fixed), 0},
+        {"cut short", 1, sizeof(check_fixed), 1},
+        {"cut inside its header", 1, sizeof(check_fixed), sizeof(check_fixed) + 1},
+    };
+    for (auto &c : cases) {
+        check_serializer_stream(S, field);
+        check_serializer_forge(S, field, c.type_size, c.data_len);
+        S.stream.data_len -= c.cut;
+        if (S.get_fixed<check_fixed>(&fixed) || S.get<int64_t>(&fixed.b) || S.cursor != field) {
+            printf("serializer: a field %s is not refused\n", c.name);
+            return false;
+        }
+    }
+    // a well formed field that is not the size of what it is read into
+    check_serializer_stream(S, field);
+    struct {
+        int64_t a;
+        int64_t b;
+        int64_t c;
+    } larger;
+    if (S.get_fixed(&larger) || S.get<int>(&value)) {
+        printf("serializer: a field of the wrong size is not refused\n");
+        return false;
+    }
+    printf("serializer: %zu malformed fields are refused\n",
+           sizeof(cases) / sizeof(cases[0]) + 1);
+    return true;
+}
+
+class check_node : public MPSC_QUEUE_NODE {
+    public:
+        int producer = 0;
+        int sequence = 0;
+};
+
+// nodes from every producer come out once each, and in the order their producer pushed them
+bool check_mpsc_queue() {
+    MPSC_QUEUE queue;
+    if (MPSC_QUEUE_pop(queue) != nullptr) {
+        printf("mpsc queue: an empty queue pops a node\n");
+        return false;
+    }
+    const int producers = 4;
+    const int pushes = 100000;
+    std::vector<std::vector<check_node>> nodes(producers, std::vector<check_node>(pushes));
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+        threads.emplace_back([&nodes, &queue, p] {
+            for (int i = 0; i < pushes; i++) {
+                nodes[p][i].producer = p;
+                nodes[p][i].sequence = i;
+                MPSC_QUEUE_push(queue, &nodes[p][i]);
+            }
+        });
+    std::vector<int> next(producers, 0);
+    bool ok = true;
+    for (int popped = 0; popped < producers * pushes;) {
+        check_node *node = static_cast<check_node *>(MPSC_QUEUE_pop(queue));
+        if (node == nullptr) continue; // empty, or a push is halfway through
+        popped++;
+        if (node->sequence != next[node->producer]++) ok = false;
+    }
+    for (std::thread &thread : threads) thread.join();
+    if (!ok || MPSC_QUEUE_pop(queue) != nullptr) {
+        printf("mpsc queue: nodes were lost, repeated or reordered\n");
+        return false;
+    }
+    printf("mpsc queue: %d producers pushed %d nodes each in order\n", producers, pushes);
+    return true;
+}
+
+#ifdef __ANDROID__
+bool check_frame_slot_state(GLIS_frame_slots &frames, int32_t slot, int32_t state,
+                            const char *when) {
+    int32_t actual = __atomic_load_n(&frames.header->slots[slot].state, __ATOMIC_ACQUIRE);
+    if (actual == state) return true;
+    printf("frame slots: slot %d is in state %d %s, expected %d\n", slot, actual, when, state);
+    return false;
+}
+
+// walks slots through the mailbox, then has the client get a latched frame wrong in every
+// way the compositor must catch
+bool check_frame_slots() {
+    const GLint size = 16;
+    GLIS_frame_slots frames;
+    if (!GLIS_frame_slots_create(frames, 3, size * size * sizeof(GLuint))) {
+        printf("frame slots: failed to create the slots\n");
+        return false;
+    }
+    GLIS_frame_slots_header *header = frames.header;
+    bool ok = false;
+    do {
+        int32_t a = GLIS_frame_slots_acquire(frames);
+        if (!check_frame_slot_state(frames, a, GLIS_frame_slot_rendering, "once acquired"))
+            break;
+        GLIS_frame_slots_publish(frames, a, size, size);
+        if (!check_frame_slot_state(frames, a, GLIS_frame_slot_published, "once published"))
+            break;
+        if (GLIS_frame_slots_latch(frames) != a || GLIS_frame_slots_latch(frames) != -1) {
+            printf("frame slots: a published slot is not latched exactly once\n");
+            break;
+        }
+        if (!check_frame_slot_state(frames, a, GLIS_frame_slot_latched, "once latched")) break;
+        // publishing over a slot that was never latched hands it straight back
+        int32_t b = GLIS_frame_slots_acquire(frames);
+        GLIS_frame_slots_publish(frames, b, size, size);
+        int32_t c = GLIS_frame_slots_acquire(frames);
+        GLIS_frame_slots_publish(frames, c, size, size);
+        if (!check_frame_slot_state(frames, b, GLIS_frame_slot_free, "once published over"))
+            break;
+        int32_t released = header->released;
+        if (GLIS_frame_slots_latch(frames) != c || header->released != released + 1 ||
+            !check_frame_slot_state(frames, a, GLIS_frame_slot_free, "once latched over"))
+            break;
+        // a client can take its frame back until the compositor latches it
+        int32_t d = GLIS_frame_slots_acquire(frames);
+        GLIS_frame_slots_publish(frames, d, size, size);
+        if (GLIS_frame_slots_reclaim(frames) != d || GLIS_frame_slots_latch(frames) != -1) {
+            printf("frame slots: a published slot can not be reclaimed\n");
+            break;
+        }
+        GLIS_frame_slots_release(frames, d);
+        d = GLIS_frame_slots_acquire(frames);
+        GLIS_damage_rect damage = {4, 4, 8, 8};
+        GLIS_frame_slots_add_damage(frames, d, &damage, 1);
+        GLIS_frame_slots_publish_damage(frames, d, size, size);
+        GLIS_frame_slot frame;
+        if (GLIS_frame_slots_latch(frames) != d ||
+            !GLIS_frame_slots_latched_frame(frames, d, frame) || frame.damage_count != 1 ||
+            frame.damage[0].x != 4 || frame.damage[0].width != 8) {
+            printf("frame slots: a damaged frame does not latch as it was published\n");
+            break;
+        }
+        // everything the client writes about a frame is checked once latched
+        GLIS_frame_slot &shared = header->slots[d];
+        struct {
+            const char *name;
+            GLint width;
+            GLint height;
+            int32_t damage_count;
+            GLIS_damage_rect damage;
+        } cases[] = {
+            {"larger than the slot", static_cast<GLint>(frames.slot_size / sizeof(GLuint)) + 1, 1,
+             1, {0, 0, 1, 1}},
+            {"with no width", 0, size, 1, {0, 0, 1, 1}},
+            {"with a negative height", size, -size, 1, {0, 0, 1, 1}},
+            {"with too many damaged rectangles", size, size, GLIS_FRAME_DAMAGE_MAX + 1,
+             {0, 0, 1, 1}},
+            {"with a negative damage count", size, size, -1, {0, 0, 1, 1}},
+            {"damaged outside of the frame", size, size, 1, {8, 8, 9, 1}},
+            {"damaged at a negative offset", size, size, 1, {-1, 0, 1, 1}},
+            {"damaged past INT_MAX", size, size, 1, {1, 0, INT_MAX, 1}},
+        };
+        ok = true;
+        for (auto &c : cases) {
+            shared.width = c.width;
+            shared.height = c.height;
+            shared.damage_count = c.damage_count;
+            shared.damage[0] = c.damage;
+            if (GLIS_frame_slots_latched_frame(frames, d, frame)) {
+                printf("frame slots: a frame %s is not refused\n", c.name);
+                ok = false;
+                break;
+            }
+        }
+        if (!ok) break;
+        ok = false;
+        // so is the slot a client publishes
+        __atomic_store_n(&header->published, 7, __ATOMIC_RELEASE);
+        if (GLIS_frame_slots_latch(frames) != -1 || frames.latched != d) {
+            printf("frame slots: a slot that does not exist is latched\n");
+            break;
+        }
+        printf("frame slots: the mailbox hands slots back, %zu malformed frames are refused\n",
+               sizeof(cases) / sizeof(cases[0]));
+        ok = true;
+    } while (false);
+    GLIS_frame_slots_free(frames);
+    return ok;
+}
+
+// encodes a batch header for count commands, the commands are added after it
+void check_batch_begin(serializer &S, uint32_t count) {
+    S.reset();
+    GLIS_MESSAGE_batch::encode(S, {count});
+}
+
+// reads the header as the compositor does and validates what follows, the cursor must be left
+// at the first command either way
+bool check_batch_case(const char *name, serializer &S, uint32_t count,
+                      const WINDOW_LIST &windows, bool textures, bool expected) {
+    int command = -1;
+    GLIS_batch_payload payload;
+    if (!S.get<int>(&command) || !GLIS_MESSAGE_batch::decode(S, payload)) {
+        printf("batch: the header of %s does not decode\n", name);
+        return false;
+    }
+    size_t cursor = S.cursor;
+    bool valid = GLIS_batch_validate(S, count, windows, textures);
+    if (valid != expected || S.cursor != cursor) {
+        printf("batch: %s is %s\n", name, valid ? "accepted" : "refused");
+        return false;
+    }
+    return true;
+}
+
+// only a batch of commands a batch may hold, that all decode and refer to windows that
+// exist, is applied
+bool check_batch() {
+    WINDOW_LIST windows;
+    WINDOW_LIST_add(windows, 3, 0, 0, 10, 10);
+    serializer S;
+    check_batch_begin(S, 3);
+    GLIS_MESSAGE_new_window::encode(S, {{0, 0, 5, 5}});
+    GLIS_MESSAGE_modify_window::encode(S, {GLIS_batch_window(0), {1, 1, 2, 2}});
+    GLIS_MESSAGE_close_window::encode(S, {3});
+    if (!check_batch_case("a well formed batch", S, 3, windows, false, true)) return false;
+    S.cursor = 0;
+    if (!check_batch_case("a count one past its commands", S, 4, windows, false, false))
+        return false;
+    S.cursor = 0;
+    if (!check_batch_case("a count of UINT32_MAX", S, UINT32_MAX, windows, false, false))
+        return false;
+    S.stream.data_len--;
+    S.cursor = 0;
+    if (!check_batch_case("a batch cut short", S, 3, windows, false, false)) return false;
+
+    check_batch_begin(S, 1);
+    S.add<int>(GLIS_SERVER_COMMANDS.modify_window);
+    S.add_fixed<GLIS_close_window_payload>({3});
+    if (!check_batch_case("a command with the payload of another", S, 1, windows, false, false))
+        return false;
+
+    check_batch_begin(S, 1);
+    GLIS_MESSAGE_batch::encode(S, {0});
+    if (!check_batch_case("a nested batch", S, 1, windows, false, false)) return false;
+
+    check_batch_begin(S, 1);
+    GLIS_MESSAGE_register_window_frames::encode(S, {3, 4096});
+    if (!check_batch_case("a batch holding a command that takes an fd", S, 1, windows, false,
+                          false))
+        return false;
+
+    check_batch_begin(S, 1);
+    GLIS_MESSAGE_texture::encode(S, {3, 1, 1});
+    if (!check_batch_case("a texture without frame slots", S, 1, windows, false, false))
+        return false;
+    S.cursor = 0;
+    if (!check_batch_case("a texture with frame slots", S, 1, windows, true, true)) return false;
+
+    check_batch_begin(S, 2);
+    GLIS_MESSAGE_close_window::encode(S, {3});
+    GLIS_MESSAGE_modify_window::encode(S, {3, {1, 1, 2, 2}});
+    if (!check_batch_case("a window used after it is closed", S, 2, windows, false, false))
+        return false;
+
+    check_batch_begin(S, 2);
+    GLIS_MESSAGE_modify_window::encode(S, {GLIS_batch_window(0), {1, 1, 2, 2}});
+    GLIS_MESSAGE_new_window::encode(S, {{0, 0, 5, 5}});
+    if (!check_batch_case("a window used before it is created", S, 2, windows, false, false))
+        return false;
+
+    check_batch_begin(S, 1);
+    GLIS_MESSAGE_close_window::encode(S, {4});
+    if (!check_batch_case("a window that does not exist", S, 1, windows, false, false))
+        return false;
+    printf("batch: only well formed batches are applied\n");
+    return true;
+}
+#endif
+
+int main() {
+    bool ok = check_region(2000) && check_cull_23_windows() && check_cull_1000_windows() &&
+              check_histogram() && check_window_list() && check_serializer() &&
+              check_mpsc_queue();
+#ifdef __ANDROID__
+    ok = ok && check_frame_slots() && check_batch();
+#endif
+    printf(ok ? "all checks passed\n" : "a check failed\n");
+    return ok ? 0 : 1;
+}
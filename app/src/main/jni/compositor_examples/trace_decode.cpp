@@ -0,0 +1,144 @@
+//
+// formats a dump written by TRACE_dump, in the order the records were written
+// usage: trace_decode <dump>
+//
+// only depends on trace.h so it can be built for the host to read dumps pulled off a device
+// of the same word size
+//
+
+#include "../trace.h"
+#include <map>
+#include <string>
+
+std::map<uint64_t, std::string> strings;
+
+class decoded_record {
+    public:
+        uint32_t thread;
+        TRACE_record record;
+};
+
+const char *level_name(uint8_t level) {
+    if (level == TRACE_LEVEL_ERROR) return "E";
+    if (level == TRACE_LEVEL_INFO) return "I";
+    if (level == TRACE_LEVEL_VERBOSE) return "V";
+    return "?";
+}
+
+const char *string_at(uint64_t address) {
+    std::map<uint64_t, std::string>::iterator found = strings.find(address);
+    return found == strings.end() ? "(unknown string)" : found->second.c_str();
+}
+
+// printf's length modifiers are dropped and every argument is passed at its recorded width
+std::string format_record(const TRACE_record &record) {
+    std::string out;
+    const char *format = string_at(reinterpret_cast<uintptr_t>(record.format));
+    uint8_t argument = 0;
+    char buffer[512];
+    for (const char *c = format; *c != '\0'; c++) {
+        if (*c != '%') {
+            out += *c;
+            continue;
+        }
+        if (c[1] == '%') {
+            out += '%';
+            c++;
+            continue;
+        }
+        std::string spec = "%";
+        c++;
+        while (*c != '\0' && strchr("-+ #0123456789.", *c) != nullptr) spec += *c++;
+        while (*c != '\0' && strchr("hlLqjzt", *c) != nullptr) c++;
+        if (*c == '\0') break;
+        if (argument >= record.count) {
+            out += "(missing)";
+            continue;
+        }
+        uint8_t type = record.types[argument];
+        uint64_t value = record.arguments[argument++];
+        double d;
+        memcpy(&d, &value, sizeof(double));
+        char conversion = *c;
+        if (strchr("fFeEgGaA", conversion) != nullptr) {
+            if (type != TRACE_ARGUMENT_DOUBLE) d = static_cast<double>(value);
+            snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(), d);
+        } else if (conversion == 's') {
+            snprintf(buffer, sizeof(buffer), (spec + 's').c_str(),
+                     type == TRACE_ARGUMENT_STRING ? string_at(value) : "(not a string)");
+        } else if (conversion == 'p') {
+            snprintf(buffer, sizeof(buffer), "0x%llx", static_cast<unsigned long long>(value));
+        } else if (conversion == 'd' || conversion == 'i') {
+            snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(),
+                     static_cast<long long>(value));
+        } else if (conversion == 'c') {
+            snprintf(buffer, sizeof(buffer), (spec + 'c').c_str(), static_cast<int>(value));
+        } else {
+            snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(),
+                     static_cast<unsigned long long>(value));
+        }
+        out += buffer;
+    }
+    // LOG_INFO style formats often end with a new line, every record gets its own anyway
+    while (!out.empty() && out.back() == '\n') out.pop_back();
+    return out;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <dump>\n", argv[0]);
+        return 1;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (file == nullptr) {
+        perror(argv[1]);
+        return 1;
+    }
+    char magic[sizeof(TRACE_DUMP_MAGIC)];
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, TRACE_DUMP_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a trace dump\n", argv[1]);
+        return 1;
+    }
+    std::vector<decoded_record> records;
+    for (;;) {
+        uint32_t kind = 0;
+        if (fread(&kind, sizeof(kind), 1, file) != 1 || kind == TRACE_DUMP_END) break;
+        if (kind == TRACE_DUMP_STRING) {
+            uint32_t length;
+            uint64_t address;
+            if (fread(&length, sizeof(length), 1, file) != 1 ||
+                fread(&address, sizeof(address), 1, file) != 1)
+                break;
+            std::string string(length, '\0');
+            if (length != 0 && fread(&string[0], 1, length, file) != length) break;
+            strings[address] = string;
+        } else if (kind == TRACE_DUMP_RING) {
+            uint32_t thread;
+            uint64_t count;
+            if (fread(&thread, sizeof(thread), 1, file) != 1 ||
+                fread(&count, sizeof(count), 1, file) != 1)
+                break;
+            for (uint64_t i = 0; i < count; i++) {
+                decoded_record r;
+                r.thread = thread;
+                if (fread(&r.record, sizeof(TRACE_record), 1, file) != 1) break;
+                if (r.record.count > TRACE_ARGUMENTS_MAX) r.record.count = TRACE_ARGUMENTS_MAX;
+                records.push_back(r);
+            }
+        } else {
+            fprintf(stderr, "unknown block %u, the dump is truncated\n", kind);
+            break;
+        }
+    }
+    fclose(file);
+    std::stable_sort(records.begin(), records.end(),
+                     [](const decoded_record &a, const decoded_record &b) {
+                         return a.record.time < b.record.time;
+                     });
+    uint64_t first = records.empty() ? 0 : records[0].record.time;
+    for (decoded_record &r : records)
+        printf("%14.6f ms %6u %s %s\n", static_cast<double>(r.record.time - first) / 1000000.0,
+               r.thread, level_name(r.record.level), format_record(r.record).c_str());
+    return 0;
+}
@@ -0,0 +1,43 @@
+//
+// thin wrappers around the futex system call
+//
+
+#ifndef GLNE_FUTEX_H
+#define GLNE_FUTEX_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// these use the shared (non private) futex operations so the word may live in
+// memory that is mapped MAP_SHARED by several processes, such as an ashmem region
+// they are inline as this header is reached from more than one translation unit through shm.h
+
+// sleeps while *addr == expected, or until timeout (relative, nullptr to wait forever)
+// returns 0 when woken, otherwise -1 with errno set to
+// EAGAIN if *addr != expected, ETIMEDOUT if the timeout expired, or EINTR
+inline int futex_wait(int32_t *addr, int32_t expected, const struct timespec *timeout) {
+    return static_cast<int>(syscall(SYS_futex, addr, FUTEX_WAIT, expected, timeout, nullptr, 0));
+}
+
+// wakes at most count waiters sleeping on addr, returns the number woken
+inline int futex_wake(int32_t *addr, int count) {
+    return static_cast<int>(syscall(SYS_futex, addr, FUTEX_WAKE, count, nullptr, nullptr, 0));
+}
+
+inline int futex_wake_all(int32_t *addr) {
+    return futex_wake(addr, INT_MAX);
+}
+
+inline struct timespec futex_timeout_ms(int milliseconds) {
+    struct timespec timeout;
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_nsec = static_cast<long>(milliseconds % 1000) * 1000000L;
+    return timeout;
+}
+
+#endif //GLNE_FUTEX_H
@@ -12,6 +12,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <sys/socket.h>
@@ -0,0 +1,72 @@
+//
+// a log-linear histogram of 64 bit values, in the style of HdrHistogram
+//
+
+#ifndef GLNE_HISTOGRAM_H
+#define GLNE_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// values below 2^HISTOGRAM_PRECISION_BITS are counted exactly, every power of two above that is
+// split into 2^(HISTOGRAM_PRECISION_BITS - 1) buckets, so a reported value is within 1/32 of
+// what was recorded whatever its magnitude, recording is a count of leading zeros, a shift and
+// an increment
+// inline as this header is reached from more than one translation unit
+const int HISTOGRAM_PRECISION_BITS = 6;
+const uint64_t HISTOGRAM_SUB_BUCKETS = 1ULL << (HISTOGRAM_PRECISION_BITS - 1);
+const size_t HISTOGRAM_BUCKETS = (66 - HISTOGRAM_PRECISION_BITS) * HISTOGRAM_SUB_BUCKETS;
+
+class HISTOGRAM {
+    public:
+        uint64_t counts[HISTOGRAM_BUCKETS] = {0};
+        uint64_t count = 0;
+        uint64_t total = 0;
+        uint64_t max = 0;
+};
+
+inline size_t HISTOGRAM_index(uint64_t value) {
+    if (value < (HISTOGRAM_SUB_BUCKETS << 1)) return static_cast<size_t>(value);
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_PRECISION_BITS + 1;
+    return static_cast<size_t>(shift * HISTOGRAM_SUB_BUCKETS + (value >> shift));
+}
+
+// the smallest value counted in index
+inline uint64_t HISTOGRAM_lowest(size_t index) {
+    if (index < (HISTOGRAM_SUB_BUCKETS << 1)) return index;
+    uint64_t shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    return (index - shift * HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+inline void HISTOGRAM_record(HISTOGRAM &histogram, uint64_t value) {
+    histogram.counts[HISTOGRAM_index(value)]++;
+    histogram.count++;
+    histogram.total += value;
+    if (value > histogram.max) histogram.max = value;
+}
+
+// returns the largest value that is counted in the same bucket as the value percentile
+// percent of the recorded values are at or below, 0 if nothing has been recorded
+inline uint64_t HISTOGRAM_percentile(const HISTOGRAM &histogram, double percentile) {
+    if (histogram.count == 0) return 0;
+    uint64_t wanted = static_cast<uint64_t>(percentile / 100.0 * histogram.count + 0.5);
+    if (wanted == 0) wanted = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram.counts[i];
+        if (seen >= wanted) {
+            uint64_t highest = HISTOGRAM_lowest(i + 1) - 1;
+            return highest < histogram.max ? highest : histogram.max;
+        }
+    }
+    return histogram.max;
+}
+
+inline void HISTOGRAM_reset(HISTOGRAM &histogram) {
+    memset(histogram.counts, 0, sizeof(histogram.counts));
+    histogram.count = 0;
+    histogram.total = 0;
+    histogram.max = 0;
+}
+
+#endif //GLNE_HISTOGRAM_H
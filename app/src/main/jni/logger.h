@@ -18,6 +18,7 @@
 #define LOGGER_H
 
 #include <stdio.h>
+#include "trace.h"
 
 #ifndef __ANDROID__
     #define LOG_INFO printf
@@ -0,0 +1,61 @@
+//
+// an intrusive lock-free multi-producer single-consumer queue
+//
+
+#ifndef GLNE_MPSC_QUEUE_H
+#define GLNE_MPSC_QUEUE_H
+
+#include <stddef.h>
+
+// any number of threads may push, a single thread pops, pushing is one atomic exchange and
+// never waits on other producers or the consumer, nodes are popped in the order each producer
+// pushed them, the queue does not own its nodes
+// based on Dmitry Vyukov's intrusive MPSC node-based queue
+
+// embed as the first base of whatever is queued
+class MPSC_QUEUE_NODE {
+    public:
+        MPSC_QUEUE_NODE *next = nullptr;
+};
+
+class MPSC_QUEUE {
+    public:
+        MPSC_QUEUE_NODE stub;
+        // producers side, the last node pushed
+        MPSC_QUEUE_NODE *head = &stub;
+        // consumer side, the next node to pop
+        MPSC_QUEUE_NODE *tail = &stub;
+};
+
+inline void MPSC_QUEUE_push(MPSC_QUEUE &queue, MPSC_QUEUE_NODE *node) {
+    __atomic_store_n(&node->next, nullptr, __ATOMIC_RELAXED);
+    MPSC_QUEUE_NODE *previous = __atomic_exchange_n(&queue.head, node, __ATOMIC_ACQ_REL);
+    // until this store the consumer can not see node or anything pushed after it
+    __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+}
+
+// returns nullptr if the queue is empty, or if a producer is midway through a push, in which
+// case its node is popped once the push completes
+inline MPSC_QUEUE_NODE *MPSC_QUEUE_pop(MPSC_QUEUE &queue) {
+    MPSC_QUEUE_NODE *tail = queue.tail;
+    MPSC_QUEUE_NODE *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &queue.stub) {
+        if (next == nullptr) return nullptr;
+        queue.tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != nullptr) {
+        queue.tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE)) return nullptr;
+    // tail is the last node, the stub takes its place so it can be handed out
+    MPSC_QUEUE_push(queue, &queue.stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next == nullptr) return nullptr;
+    queue.tail = next;
+    return tail;
+}
+
+#endif //GLNE_MPSC_QUEUE_H
@@ -0,0 +1,108 @@
+//
+// which windows are hidden behind opaque windows
+//
+
+#ifndef GLNE_OCCLUSION_H
+#define GLNE_OCCLUSION_H
+
+#include "logger.h"
+#include "region.h"
+#include "window_list.h"
+
+// skip drawing the windows that opaque windows in front of them hide completely, turned off
+// every window is drawn and only the statistics are kept
+bool COMPOSITOR_OCCLUSION_CULLING = true;
+
+// every window is checked against every rectangle of the covered area, once it is made of this
+// many rectangles opaque windows stop adding to it, culling less but keeping the pass cheap
+// however many windows overlap
+size_t COMPOSITOR_OCCLUSION_MAX_RECTS = 512;
+
+// fragments are counted as the on screen area of every window drawn, a window that is partly
+// visible is still drawn whole, the clear is not counted
+class COMPOSITOR_occlusion {
+    public:
+        // the indices into the window list of the windows to draw, front to back
+        std::vector<size_t> draw;
+        // the screen area hidden by the opaque windows visited so far
+        REGION covered;
+        REGION visible;
+        std::vector<REGION_rect> scratch;
+        // the last frame
+        size_t culled = 0;
+        uint64_t fragments = 0;
+        uint64_t unculled_fragments = 0; // what drawing every window would have cost
+        // every frame since the last COMPOSITOR_occlusion_log
+        size_t frames = 0;
+        size_t total_culled = 0;
+        uint64_t total_fragments = 0;
+        uint64_t total_unculled_fragments = 0;
+};
+
+// visits the windows front to back, taking what the windows with an opaque flag set cover away
+// from the area of every window under them, a window with nothing left is not drawn
+// once the opaque windows cover the whole screen every window below them is culled without
+// looking at its region
+void COMPOSITOR_occlusion_cull(COMPOSITOR_occlusion &occlusion, const WINDOW_LIST &windows,
+                               uint32_t opaque, int width, int height) {
+    occlusion.draw.clear();
+    REGION_clear(occlusion.covered);
+    occlusion.culled = 0;
+    occlusion.fragments = 0;
+    occlusion.unculled_fragments = 0;
+    REGION_rect screen = {0, 0, width, height};
+    uint64_t screen_area = REGION_rect_area(screen);
+    uint64_t covered_area = 0;
+    for (size_t i = WINDOW_LIST_count(windows); i-- > 0;) {
+        REGION_rect window = {windows.x1[i], windows.y1[i], windows.x2[i], windows.y2[i]};
+        window = REGION_rect_intersect(window, screen);
+        uint64_t area = REGION_rect_area(window);
+        occlusion.unculled_fragments += area;
+        if (!COMPOSITOR_OCCLUSION_CULLING) {
+            occlusion.draw.push_back(i);
+            occlusion.fragments += area;
+            continue;
+        }
+        if (area == 0 || covered_area >= screen_area) {
+            occlusion.culled++;
+            continue;
+        }
+        REGION_set(occlusion.visible, window);
+        REGION_subtract(occlusion.visible, occlusion.covered, occlusion.scratch);
+        if (REGION_empty(occlusion.visible)) {
+            occlusion.culled++;
+            continue;
+        }
+        occlusion.draw.push_back(i);
+        occlusion.fragments += area;
+        if ((windows.flags[i] & opaque) &&
+            occlusion.covered.rects.size() < COMPOSITOR_OCCLUSION_MAX_RECTS) {
+            REGION_add_disjoint(occlusion.covered, occlusion.visible);
+            covered_area += REGION_area(occlusion.visible);
+        }
+    }
+    occlusion.frames++;
+    occlusion.total_culled += occlusion.culled;
+    occlusion.total_fragments += occlusion.fragments;
+    occlusion.total_unculled_fragments += occlusion.unculled_fragments;
+}
+
+// logs what culling saved since the last call and resets it
+void COMPOSITOR_occlusion_log(COMPOSITOR_occlusion &occlusion, int width, int height) {
+    if (occlusion.frames != 0 && width > 0 && height > 0) {
+        double frames = static_cast<double>(occlusion.frames);
+        double screen = static_cast<double>(width) * height;
+        LOG_INFO("culled %G windows per frame over %zu frames, %G fragments per frame "
+                 "(%G overdraw) against %G (%G overdraw) without culling",
+                 occlusion.total_culled / frames, occlusion.frames,
+                 occlusion.total_fragments / frames, occlusion.total_fragments / frames / screen,
+                 occlusion.total_unculled_fragments / frames,
+                 occlusion.total_unculled_fragments / frames / screen);
+    }
+    occlusion.frames = 0;
+    occlusion.total_culled = 0;
+    occlusion.total_fragments = 0;
+    occlusion.total_unculled_fragments = 0;
+}
+
+#endif //GLNE_OCCLUSION_H
@@ -0,0 +1,121 @@
+//
+// areas of the screen as sets of rectangles
+//
+
+#ifndef GLNE_REGION_H
+#define GLNE_REGION_H
+
+#include <stdint.h>
+#include <vector>
+
+// a rectangle covers the points x1 <= x < x2, y1 <= y < y2, the corners the clients send
+// windows as, a rectangle with x2 <= x1 or y2 <= y1 is empty
+// the rectangles of a region never overlap, so its area is the sum of theirs
+// inline as this header is reached from more than one translation unit
+
+class REGION_rect {
+    public:
+        int x1;
+        int y1;
+        int x2;
+        int y2;
+};
+
+class REGION {
+    public:
+        std::vector<REGION_rect> rects;
+};
+
+inline bool REGION_rect_empty(const REGION_rect &r) {
+    return r.x2 <= r.x1 || r.y2 <= r.y1;
+}
+
+inline uint64_t REGION_rect_area(const REGION_rect &r) {
+    if (REGION_rect_empty(r)) return 0;
+    return static_cast<uint64_t>(r.x2 - r.x1) * static_cast<uint64_t>(r.y2 - r.y1);
+}
+
+inline REGION_rect REGION_rect_intersect(const REGION_rect &a, const REGION_rect &b) {
+    REGION_rect r;
+    r.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+    r.y1 = a.y1 > b.y1 ? a.y1 : b.y1;
+    r.x2 = a.x2 < b.x2 ? a.x2 : b.x2;
+    r.y2 = a.y2 < b.y2 ? a.y2 : b.y2;
+    return r;
+}
+
+inline bool REGION_empty(const REGION &region) {
+    return region.rects.empty();
+}
+
+inline uint64_t REGION_area(const REGION &region) {
+    uint64_t area = 0;
+    for (const REGION_rect &r : region.rects) area += REGION_rect_area(r);
+    return area;
+}
+
+inline void REGION_clear(REGION &region) {
+    region.rects.clear();
+}
+
+inline void REGION_set(REGION &region, const REGION_rect &r) {
+    region.rects.clear();
+    if (!REGION_rect_empty(r)) region.rects.push_back(r);
+}
+
+// appends the parts of from that lie outside cut to out, at most four rectangles, a band
+// above and below cut spanning the width of from and the parts left and right of it
+inline void REGION_rect_subtract(const REGION_rect &from, const REGION_rect &cut,
+                                 std::vector<REGION_rect> &out) {
+    REGION_rect overlap = REGION_rect_intersect(from, cut);
+    if (REGION_rect_empty(overlap)) {
+        out.push_back(from);
+        return;
+    }
+    if (from.y1 < overlap.y1) out.push_back({from.x1, from.y1, from.x2, overlap.y1});
+    if (overlap.y2 < from.y2) out.push_back({from.x1, overlap.y2, from.x2, from.y2});
+    if (from.x1 < overlap.x1) out.push_back({from.x1, overlap.y1, overlap.x1, overlap.y2});
+    if (overlap.x2 < from.x2) out.push_back({overlap.x2, overlap.y1, from.x2, overlap.y2});
+}
+
+// removes cut from region, scratch is only used to avoid an allocation per call
+inline void REGION_subtract_rect(REGION &region, const REGION_rect &cut,
+                                 std::vector<REGION_rect> &scratch) {
+    scratch.clear();
+    for (const REGION_rect &r : region.rects) REGION_rect_subtract(r, cut, scratch);
+    region.rects.swap(scratch);
+}
+
+// the smallest rectangle containing all of region
+inline REGION_rect REGION_bounds(const REGION &region) {
+    if (REGION_empty(region)) return {0, 0, 0, 0};
+    REGION_rect bounds = region.rects[0];
+    for (const REGION_rect &r : region.rects) {
+        if (r.x1 < bounds.x1) bounds.x1 = r.x1;
+        if (r.y1 < bounds.y1) bounds.y1 = r.y1;
+        if (r.x2 > bounds.x2) bounds.x2 = r.x2;
+        if (r.y2 > bounds.y2) bounds.y2 = r.y2;
+    }
+    return bounds;
+}
+
+// removes every rectangle of cut from region, stopping early once nothing is left
+// region only shrinks, so the rectangles of cut outside its starting bounds are passed over
+// without touching it
+inline void REGION_subtract(REGION &region, const REGION &cut,
+                            std::vector<REGION_rect> &scratch) {
+    REGION_rect bounds = REGION_bounds(region);
+    for (const REGION_rect &r : cut.rects) {
+        if (REGION_empty(region)) return;
+        if (REGION_rect_empty(REGION_rect_intersect(bounds, r))) continue;
+        REGION_subtract_rect(region, r, scratch);
+    }
+}
+
+// adds region to into, region must not overlap into, as is the case for the part of an area
+// left over after subtracting into from it
+inline void REGION_add_disjoint(REGION &into, const REGION &region) {
+    into.rects.insert(into.rects.end(), region.rects.begin(), region.rects.end());
+}
+
+#endif //GLNE_REGION_H
@@ -20,6 +20,7 @@
 
 #include <deque> // std::deque
 #include <vector> // std::vector
+#include <type_traits> // std::is_trivially_copyable
 #include <memory> // std::unique_ptr
 #include <cassert> // assert
 #include <stdio.h> // printf
@@ -28,6 +29,37 @@
 #include <cerrno> // errno, errors
 #include <stdlib.h> // malloc/realloc/free
 #include <limits.h> // *_MAX
+#include <string> // std::string
+#include <time.h> // clock_gettime
+#include <sys/uio.h> // struct iovec
+#include <utility> // std::swap
+
+class SERIALIZER_MODE {
+    public:
+        // every add/add_pointer is copied into its own heap chunk and queued in `in`,
+        // construct() then concatenates the queue into `stream`
+        int deque = 0;
+        // every add/add_pointer is encoded directly into `stream`, which grows geometrically
+        // and keeps its capacity across reset(), construct() has nothing left to do
+        int arena = 1;
+} SERIALIZER_MODE;
+
+int SERIALIZER_DEFAULT_MODE = SERIALIZER_MODE.arena;
+
+// the smallest capacity a growing stream will allocate, large enough for most commands
+size_t SERIALIZER_STREAM_MINIMUM_CAPACITY = 64;
+
+// incremented on every malloc/realloc/new[] made by the serializer itself, serializers are used
+// from several threads at once so it is only accessed atomically, relaxed as it is only a count
+size_t SERIALIZER_ALLOCATIONS = 0;
+
+inline void SERIALIZER_count_allocation() {
+    __atomic_fetch_add(&SERIALIZER_ALLOCATIONS, 1, __ATOMIC_RELAXED);
+}
+
+inline size_t SERIALIZER_allocations() {
+    return __atomic_load_n(&SERIALIZER_ALLOCATIONS, __ATOMIC_RELAXED);
+}
 
 struct serializer_data {
     int8_t type_size;
@@ -39,28 +71,44 @@ class serializer_stream {
     public:
         int8_t *data = nullptr;
         size_t data_len = 0;
+        size_t capacity = 0;
 
         bool allocate(size_t len) {
             if (data == nullptr) {
                 data = static_cast<int8_t *>(malloc(len));
                 if (data == NULL) if (errno == ENOMEM) return false;
+                SERIALIZER_count_allocation();
                 data_len = len;
+                capacity = len;
                 memset(data, 0, data_len);
             }
             return true;
         }
 
-        bool resize(size_t len) {
-            if (data == nullptr && len != 0) return allocate(len);
-            if (data_len == len && data != nullptr && len != 0) return true;
-            int8_t *data_tmp = static_cast<int8_t *>(realloc(data, len));
+        // grows the capacity geometrically, data_len is left untouched
+        bool reserve(size_t len) {
+            if (len <= capacity) return true;
+            size_t new_capacity = capacity < SERIALIZER_STREAM_MINIMUM_CAPACITY
+                                  ? SERIALIZER_STREAM_MINIMUM_CAPACITY : capacity;
+            while (new_capacity < len) new_capacity *= 2;
+            int8_t *data_tmp = static_cast<int8_t *>(realloc(data, new_capacity));
             if (data_tmp == NULL) if (errno == ENOMEM) return false;
+            SERIALIZER_count_allocation();
             data = data_tmp;
-            data_len = len;
-            if (data_len == 0 && data != 0) {
-                free(data);
+            capacity = new_capacity;
+            return true;
+        }
+
+        bool resize(size_t len) {
+            if (len == 0) {
+                if (data != nullptr) free(data);
                 data = nullptr;
+                data_len = 0;
+                capacity = 0;
+                return true;
             }
+            if (!reserve(len)) return false;
+            data_len = len;
             return true;
         }
 
@@ -68,6 +116,11 @@ class serializer_stream {
             return resize(static_cast<size_t>(0));
         }
 
+        // empties the stream but keeps its capacity for the next message
+        void clear() {
+            data_len = 0;
+        }
+
         bool append(size_t len) {
             return resize(data_len + len);
         }
@@ -93,15 +146,26 @@ class serializer_stream {
 
 typedef std::deque<struct serializer_data> Serial;
 
+// a field whose data is not copied into the stream, it is referenced in place and must stay
+// alive until the serializer has been sent
+struct serializer_borrowed {
+    // index in the stream at which the data belongs
+    size_t offset;
+    const void *data;
+    size_t data_len;
+};
+
 class serializer {
     private:
         template<typename type, typename matches>
         bool add_if_matches(type *data, size_t data_len) {
             int8_t ts = sizeof(type);
             if (ts == sizeof(matches)) {
+                if (mode == SERIALIZER_MODE.arena) return encode(ts, data, data_len);
                 struct serializer_data s;
                 s.type_size = ts;
                 s.data = new char[sizeof(matches) * data_len];
+                SERIALIZER_count_allocation();
                 memcpy(s.data, data, sizeof(matches) * data_len);
                 s.data_len = data_len;
                 in.push_back(s);
@@ -110,55 +174,152 @@ class serializer {
             return false;
         }
 
+        // type_size (1), data length (8), data (*)
+        bool encode(int8_t type_size, const void *data, size_t data_len) {
+            size_t index = stream.data_len;
+            size_t bytes = type_size * data_len;
+            if (!stream.append(sizeof(int8_t) + sizeof(size_t) + bytes)) return false;
+            stream.data[index++] = type_size;
+            memcpy(&stream.data[index], &data_len, sizeof(size_t));
+            index += sizeof(size_t);
+            memcpy(&stream.data[index], data, bytes);
+            return true;
+        }
+
+        // reads the field at cursor without copying it, returns false once the stream is
+        // exhausted or if the field would run past the end of the stream
+        bool decode(int8_t &type_size, size_t &data_len, int8_t **data) {
+            size_t header = sizeof(int8_t) + sizeof(size_t);
+            if (cursor > stream.data_len || stream.data_len - cursor < header) return false;
+            size_t remaining = stream.data_len - cursor - header;
+            type_size = stream.data[cursor];
+            memcpy(&data_len, &stream.data[cursor + sizeof(int8_t)], sizeof(size_t));
+            if (type_size <= 0 || data_len > remaining / type_size) {
+                LOG_ERROR_serializer("field at index %zu is truncated: type size %d, length %zu, %zu bytes remaining\n",
+                                     cursor, type_size, data_len, remaining);
+                return false;
+            }
+            *data = &stream.data[cursor + header];
+            cursor += header + type_size * data_len;
+            return true;
+        }
+
+        // the type size and length of a received field come from the peer, a field is only
+        // copied out if its elements are the size of the ones it is copied into, and, when the
+        // destination holds a single element, if it holds exactly one
+        static bool field_fits(int8_t type_size, size_t data_len, size_t expected_type_size,
+                               bool single) {
+            if (type_size != static_cast<int8_t>(expected_type_size) ||
+                (single && data_len != 1)) {
+                LOG_ERROR_serializer("field does not match its destination: type size %d, "
+                                     "length %zu, expected type size %zu%s\n",
+                                     type_size, data_len, expected_type_size,
+                                     single ? ", length 1" : "");
+                return false;
+            }
+            return true;
+        }
+
         template<typename type, typename matches>
         bool remove_if_matches(type *data) {
-            if (out.empty()) return false;
             int ts = sizeof(type);
-            if (ts == sizeof(matches)) {
-                struct serializer_data data_ = out.front();
-                out.pop_front();
-                memcpy(data, reinterpret_cast<matches *>(data_.data),
-                       sizeof(matches) * data_.data_len);
-                delete[] data_.data;
+            if (ts != sizeof(matches)) return false;
+            if (mode == SERIALIZER_MODE.arena) {
+                size_t at = cursor;
+                int8_t type_size;
+                size_t data_len;
+                int8_t *view;
+                if (!decode(type_size, data_len, &view)) return false;
+                if (!field_fits(type_size, data_len, sizeof(matches), true)) {
+                    cursor = at;
+                    return false;
+                }
+                memcpy(data, view, sizeof(matches));
                 return true;
             }
-            return false;
+            if (out.empty()) return false;
+            if (!field_fits(out.front().type_size, out.front().data_len, sizeof(matches), true))
+                return false;
+            struct serializer_data data_ = out.front();
+            out.pop_front();
+            memcpy(data, reinterpret_cast<matches *>(data_.data), sizeof(matches));
+            delete[] data_.data;
+            return true;
         }
 
         template<typename type, typename matches>
         size_t remove_raw_pointer_if_matches(type **data) {
-            if (out.empty()) return 0;
             int ts = sizeof(type);
-            if (ts == sizeof(matches)) {
-                struct serializer_data data_ = out.front();
-                out.pop_front();
-                *static_cast<type **>(data) = new type[data_.data_len];
-                memcpy(*data, reinterpret_cast<type *>(data_.data), sizeof(type) * data_.data_len);
-                delete[] data_.data;
-                return data_.data_len;
+            if (ts != sizeof(matches)) return 0;
+            if (mode == SERIALIZER_MODE.arena) {
+                size_t at = cursor;
+                int8_t type_size;
+                size_t data_len;
+                int8_t *view;
+                if (!decode(type_size, data_len, &view)) return 0;
+                if (!field_fits(type_size, data_len, sizeof(type), false)) {
+                    cursor = at;
+                    return 0;
+                }
+                *static_cast<type **>(data) = new type[data_len];
+                SERIALIZER_count_allocation();
+                memcpy(*data, view, sizeof(type) * data_len);
+                return data_len;
             }
-            return 0;
+            if (out.empty()) return 0;
+            if (!field_fits(out.front().type_size, out.front().data_len, sizeof(type), false))
+                return 0;
+            struct serializer_data data_ = out.front();
+            out.pop_front();
+            *static_cast<type **>(data) = new type[data_.data_len];
+            SERIALIZER_count_allocation();
+            memcpy(*data, reinterpret_cast<type *>(data_.data), sizeof(type) * data_.data_len);
+            delete[] data_.data;
+            return data_.data_len;
         }
 
         template<typename type, typename matches>
         size_t remove_vector_pointer_if_matches(std::vector<type> &data) {
-            if (out.empty()) return 0;
             int ts = sizeof(type);
-            if (ts == sizeof(matches)) {
-                struct serializer_data data_ = out.front();
-                out.pop_front();
-                data.resize(data_.data_len);
-                memcpy(data.data(), reinterpret_cast<type *>(data_.data),
-                       sizeof(type) * data_.data_len);
-                delete[] data_.data;
-                return data_.data_len;
+            if (ts != sizeof(matches)) return 0;
+            if (mode == SERIALIZER_MODE.arena) {
+                size_t at = cursor;
+                int8_t type_size;
+                size_t data_len;
+                int8_t *view;
+                if (!decode(type_size, data_len, &view)) return 0;
+                if (!field_fits(type_size, data_len, sizeof(type), false)) {
+                    cursor = at;
+                    return 0;
+                }
+                data.resize(data_len);
+                memcpy(data.data(), view, sizeof(type) * data_len);
+                return data_len;
             }
-            return 0;
+            if (out.empty()) return 0;
+            if (!field_fits(out.front().type_size, out.front().data_len, sizeof(type), false))
+                return 0;
+            struct serializer_data data_ = out.front();
+            out.pop_front();
+            data.resize(data_.data_len);
+            memcpy(data.data(), reinterpret_cast<type *>(data_.data),
+                   sizeof(type) * data_.data_len);
+            delete[] data_.data;
+            return data_.data_len;
         }
     public:
+        int mode = SERIALIZER_DEFAULT_MODE;
         Serial in;
         struct serializer_stream stream;
         Serial out;
+        // read position of the next field in stream, used in arena mode
+        size_t cursor = 0;
+        std::vector<struct serializer_borrowed> borrowed;
+
+        serializer() {}
+
+        serializer(int mode) : mode(mode) {}
+
         template<typename TYPE>
         bool add(TYPE data) {
             return add_pointer<TYPE>(&data, static_cast<size_t>(1));
@@ -176,6 +337,16 @@ class serializer {
             return false;
         }
 
+        // like get but leaves the field to be read again, arena mode only
+        template<typename TYPE>
+        bool peek(TYPE *data) {
+            assert(mode == SERIALIZER_MODE.arena);
+            size_t at = cursor;
+            bool ret = get<TYPE>(data);
+            cursor = at;
+            return ret;
+        }
+
         template<typename TYPE>
         bool add_pointer(TYPE *data, size_t index_count) {
             if (add_if_matches<TYPE, int8_t>(data, index_count)) return true;
@@ -224,7 +395,154 @@ class serializer {
             return 0;
         }
 
+        // like add_pointer but only the field header is written to the stream, the data itself is
+        // referenced in place by to_iovec(), in deque mode this falls back to add_pointer
+        template<typename TYPE>
+        bool add_pointer_borrowed(const TYPE *data, size_t index_count) {
+            if (mode != SERIALIZER_MODE.arena) return add_pointer<const TYPE>(data, index_count);
+            int8_t type_size = sizeof(TYPE);
+            size_t index = stream.data_len;
+            if (!stream.append(sizeof(int8_t) + sizeof(size_t))) return false;
+            stream.data[index++] = type_size;
+            memcpy(&stream.data[index], &index_count, sizeof(size_t));
+            struct serializer_borrowed b;
+            b.offset = stream.data_len;
+            b.data = data;
+            b.data_len = type_size * index_count;
+            borrowed.push_back(b);
+            return true;
+        }
+
+        // total encoded length including borrowed data
+        size_t length() {
+            size_t len = stream.data_len;
+            for (struct serializer_borrowed &b : borrowed) len += b.data_len;
+            return len;
+        }
+
+        // appends the encoded message to io as a list of segments pointing at the stream and at
+        // the borrowed buffers, nothing is copied
+        void to_iovec(std::vector<struct iovec> &io) {
+            if (!in.empty()) construct();
+            size_t index = 0;
+            for (struct serializer_borrowed &b : borrowed) {
+                if (b.offset > index) io.push_back({&stream.data[index], b.offset - index});
+                if (b.data_len != 0) io.push_back({const_cast<void *>(b.data), b.data_len});
+                index = b.offset;
+            }
+            if (stream.data_len > index)
+                io.push_back({&stream.data[index], stream.data_len - index});
+        }
+
+        // encoded size of a field holding `bytes` bytes of data
+        static constexpr size_t field_size(size_t bytes) {
+            return sizeof(int8_t) + sizeof(size_t) + bytes;
+        }
+
+        // encodes a fixed layout struct as a single byte field
+        template<typename TYPE>
+        bool add_fixed(const TYPE &data) {
+            static_assert(std::is_trivially_copyable<TYPE>::value,
+                          "fixed fields must be trivially copyable");
+            return add_pointer<const int8_t>(reinterpret_cast<const int8_t *>(&data),
+                                             sizeof(TYPE));
+        }
+
+        // decodes a field written by add_fixed with one bounds check and one memcpy
+        template<typename TYPE>
+        bool get_fixed(TYPE *data) {
+            static_assert(std::is_trivially_copyable<TYPE>::value,
+                          "fixed fields must be trivially copyable");
+            int8_t type_size;
+            size_t data_len;
+            int8_t *view;
+            if (mode == SERIALIZER_MODE.arena) {
+                if (!decode(type_size, data_len, &view)) return false;
+            } else {
+                if (out.empty()) return false;
+                type_size = out.front().type_size;
+                data_len = out.front().data_len;
+                view = reinterpret_cast<int8_t *>(out.front().data);
+            }
+            if (type_size != sizeof(int8_t) || data_len != sizeof(TYPE)) {
+                LOG_ERROR_serializer("fixed field size mismatch, expected %zu bytes, got %zu",
+                                     sizeof(TYPE), type_size * data_len);
+                return false;
+            }
+            memcpy(data, view, sizeof(TYPE));
+            if (mode != SERIALIZER_MODE.arena) {
+                delete[] out.front().data;
+                out.pop_front();
+            }
+            return true;
+        }
+
+        // arena mode only, overwrites the field add_fixed encoded at offset, the length of the
+        // stream before it was added, so a header can be filled in once what follows is known
+        template<typename TYPE>
+        bool patch_fixed(size_t offset, const TYPE &data) {
+            static_assert(std::is_trivially_copyable<TYPE>::value,
+                          "fixed fields must be trivially copyable");
+            assert(mode == SERIALIZER_MODE.arena);
+            size_t header = sizeof(int8_t) + sizeof(size_t);
+            if (offset > stream.data_len || stream.data_len - offset < header + sizeof(TYPE)) {
+                LOG_ERROR_serializer("no field of %zu bytes at index %zu\n", sizeof(TYPE),
+                                     offset);
+                return false;
+            }
+            size_t data_len;
+            memcpy(&data_len, &stream.data[offset + sizeof(int8_t)], sizeof(size_t));
+            if (stream.data[offset] != sizeof(int8_t) || data_len != sizeof(TYPE)) {
+                LOG_ERROR_serializer("fixed field size mismatch at index %zu, expected %zu "
+                                     "bytes\n", offset, sizeof(TYPE));
+                return false;
+            }
+            memcpy(&stream.data[offset + header], &data, sizeof(TYPE));
+            return true;
+        }
+
+        // like get_raw_pointer but returns a pointer into the received stream instead of a copy,
+        // the pointer stays valid until the serializer is reset or destroyed and is not
+        // necessarily aligned for TYPE, only supported in arena mode
+        template<typename TYPE>
+        size_t get_raw_pointer_view(TYPE **data) {
+            if (mode != SERIALIZER_MODE.arena) {
+                LOG_ERROR_serializer("get_raw_pointer_view is only supported in arena mode");
+                return 0;
+            }
+            int8_t type_size;
+            size_t data_len;
+            int8_t *view;
+            if (!decode(type_size, data_len, &view)) return 0;
+            if (type_size != sizeof(TYPE)) {
+                LOG_ERROR_serializer("type size mismatch, expected %zu, got %d", sizeof(TYPE),
+                                     type_size);
+                return 0;
+            }
+            *data = reinterpret_cast<TYPE *>(view);
+            return data_len;
+        }
+
         void construct() {
+            if (!borrowed.empty()) {
+                // copy borrowed data in so the stream holds the whole message
+                serializer_stream flat;
+                if (!flat.reserve(length())) return;
+                size_t index = 0;
+                for (struct serializer_borrowed &b : borrowed) {
+                    memcpy(&flat.data[flat.data_len], &stream.data[index], b.offset - index);
+                    flat.data_len += b.offset - index;
+                    memcpy(&flat.data[flat.data_len], b.data, b.data_len);
+                    flat.data_len += b.data_len;
+                    index = b.offset;
+                }
+                memcpy(&flat.data[flat.data_len], &stream.data[index], stream.data_len - index);
+                flat.data_len += stream.data_len - index;
+                std::swap(stream.data, flat.data);
+                std::swap(stream.data_len, flat.data_len);
+                std::swap(stream.capacity, flat.capacity);
+                borrowed.clear();
+            }
             size_t index = 0;
             while (in.size() != 0) {
                 // type_size (1), data length (8), data (*)
@@ -243,6 +561,10 @@ class serializer {
         }
 
         bool constructAndMerge(int8_t ** out, size_t * out_length) {
+            if (mode == SERIALIZER_MODE.arena) {
+                LOG_ERROR_serializer("constructAndMerge is not supported in arena mode");
+                return false;
+            }
             size_t index = 0;
             size_t offset_index = 0;
             struct serializer_data first;
@@ -294,23 +616,25 @@ class serializer {
             return true;
         }
 
+        // arena mode decodes lazily: the received stream is walked in place by the get functions,
+        // deque mode copies every field into out in a single pass
         void deconstruct() {
-            while (stream.data_len != 0) {
+            cursor = 0;
+            if (mode == SERIALIZER_MODE.arena) return;
+            int8_t type_size;
+            size_t data_len;
+            int8_t *view;
+            while (decode(type_size, data_len, &view)) {
                 struct serializer_data data2;
-                // type_size (1), data length (8), data (*)
-                serializer_stream type = stream.retract_from_front(sizeof(int8_t) * 1);
-                memcpy(&data2.type_size, type.data, type.data_len);
-                type.deallocate();
-                serializer_stream len = stream.retract_from_front(sizeof(size_t) * 1);
-                memcpy(&data2.data_len, len.data, len.data_len);
-                len.deallocate();
-                serializer_stream data = stream.retract_from_front(
-                    data2.type_size * data2.data_len);
-                data2.data = new char[data2.type_size * data2.data_len];
-                memcpy(data2.data, data.data, data2.type_size * data2.data_len);
-                data.deallocate();
+                data2.type_size = type_size;
+                data2.data_len = data_len;
+                data2.data = new char[type_size * data_len];
+                SERIALIZER_count_allocation();
+                memcpy(data2.data, view, type_size * data_len);
                 out.push_back(data2);
             }
+            cursor = 0;
+            stream.deallocate();
         }
 
         void free__() {
@@ -328,6 +652,24 @@ class serializer {
             }
         }
 
+        // prepares the serializer for another message, the stream keeps its capacity
+        void reset() {
+            free__();
+            stream.clear();
+            cursor = 0;
+            borrowed.clear();
+        }
+
+        // exchanges the messages held by two arena mode serializers without copying them
+        void swap(serializer &other) {
+            assert(mode == SERIALIZER_MODE.arena && other.mode == SERIALIZER_MODE.arena);
+            std::swap(stream.data, other.stream.data);
+            std::swap(stream.data_len, other.stream.data_len);
+            std::swap(stream.capacity, other.stream.capacity);
+            std::swap(cursor, other.cursor);
+            borrowed.swap(other.borrowed);
+        }
+
         ~serializer() {
             free__();
         }
@@ -434,5 +776,4 @@ void serializer_demo() {
     // vectors get deleted automatically
 }
 
-
 #endif //GLNE_SERIALIZER_H
@@ -6,6 +6,7 @@
 #define GLNE_SERVER_H
 
 #include "header.h"
+#include "trace.h"
 
 #ifndef __ANDROID__
     #define LOG_INFO_SERVER printf
@@ -2,6 +2,7 @@
 // Created by konek on 8/13/2019.
 //
 #include "serializer.h"
+#include "sync_variable.h"
 #include "WINAPI/SDK/include/Windows/Kernel/WindowsAPIKernel.h"
 
 #ifndef GLNE_SERVER_CORE_H
@@ -9,17 +10,127 @@
 
 bool SERVER_LOG_TRANSFER_INFO = false;
 
+// the type of socket servers and clients are created with, both ends must agree
+// a stream socket frames every message with its length and sends every fd in a message of its
+// own, a seqpacket socket keeps message boundaries so a message travels as a single datagram
+// with its fds attached, see SOCKET_SEND_DATAGRAMS
+const int SOCKET_TRANSPORT_STREAM = 0;
+const int SOCKET_TRANSPORT_SEQPACKET = 1;
+#ifdef SOCKET_SEQPACKET
+int SOCKET_TRANSPORT = SOCKET_TRANSPORT_SEQPACKET;
+#else
+int SOCKET_TRANSPORT = SOCKET_TRANSPORT_STREAM;
+#endif
+
+int SOCKET_TRANSPORT_type(int transport) {
+    return transport == SOCKET_TRANSPORT_SEQPACKET ? SOCK_SEQPACKET : SOCK_STREAM;
+}
+
+// how long starting or shutting down a server waits before logging that it is still waiting
+int SOCKET_SERVER_WAIT_WARNING_MS = 1000;
+
+// how long a session may leave a request half sent before it is closed, the server reads
+// every session from a single thread so a client that stalls mid message would stall the rest
+int SOCKET_SESSION_TIMEOUT_MS = 1000;
+
+// the length of the queue of connections waiting to be accepted, given to every server
+// created after it is changed, see SOCKET_SERVER::backlog
+int SOCKET_SERVER_DEFAULT_BACKLOG = SOMAXCONN;
+
+// the most events a single socket_wait collects, anything beyond is picked up by the next call
+const int SOCKET_SERVER_EPOLL_EVENTS = 64;
+
+// what an epoll event of a SOCKET_SERVER refers to, kept in the upper half of its data
+enum SOCKET_SERVER_EVENT : uint64_t {
+    SOCKET_SERVER_EVENT_LISTENER = 1,
+    SOCKET_SERVER_EVENT_SHUTDOWN = 2,
+    SOCKET_SERVER_EVENT_SESSION = 3,
+    SOCKET_SERVER_EVENT_WATCHED = 4,
+};
+
 class SOCKET_DATA_TRANSFER_INFO {
     public:
         size_t total_wrote = 0;
         size_t total_sent = 0;
+        size_t reads = 0; // recvmsg calls made by SOCKET_READER_receive
+        size_t waits = 0; // times SOCKET_READER_receive had to poll for data
+};
+
+// the most a SOCKET_READER reads ahead of what has been asked of it
+const size_t SOCKET_READER_CAPACITY = 16 * 1024;
+
+// the most fds a single recvmsg can pass to a SOCKET_READER
+const int SOCKET_READER_FDS_MAX = 16;
+
+// over a seqpacket socket, the most a datagram following the first datagram of a message
+// carries, it has to stay below the socket's send buffer size
+const size_t SOCKET_SEQPACKET_FRAGMENT = 64 * 1024;
+
+// the largest message a receiver accepts, the length comes from the other side so it is
+// checked before anything is allocated for it, large enough for a full screen texture
+size_t SOCKET_MESSAGE_MAX = 64 * 1024 * 1024;
+
+// sizes S's stream for an incoming message of length bytes, false if the length is out of
+// bounds or the stream could not grow
+bool SOCKET_MESSAGE_ALLOCATE(const char *TAG, serializer &S, size_t length) {
+    if (length == 0 || length > SOCKET_MESSAGE_MAX) {
+        LOG_ERROR_SERVER("%srefusing a message of %zu bytes, at most %zu are accepted\n", TAG,
+                         length, SOCKET_MESSAGE_MAX);
+        return false;
+    }
+    if (!S.stream.resize(length)) {
+        LOG_ERROR_SERVER("%scould not allocate %zu bytes for a message\n", TAG, length);
+        return false;
+    }
+    return true;
+}
+
+// buffers one connection, each recvmsg pulls in as much as the socket holds so the length
+// header and the body of a message usually arrive together, fds sent along with the data
+// are queued until they are asked for
+class SOCKET_READER {
+    public:
+        std::vector<int8_t> buffer;
+        size_t start = 0; // the next byte to hand out
+        size_t end = 0; // one past the last byte read
+        std::deque<int> fds;
+        // set while the connection is lent to another thread, see SOCKET_SERVER::session_suspend
+        bool suspended = false;
+        // while waiting for the rest of a message, give up once stop_fd is readable or nothing
+        // has arrived for timeout_ms, -1 for either waits on the connection alone as long as
+        // it takes
+        int stop_fd = -1;
+        int timeout_ms = -1;
+
+        size_t buffered() { return end - start; }
+
+        // drops whatever has been read ahead, the connection is going away
+        void clear() {
+            start = 0;
+            end = 0;
+            for (int fd : fds) close(fd);
+            fds.clear();
+        }
 };
 
+// returns true if data is waiting on the connection, read ahead or not
+bool SOCKET_READER_has_data(SOCKET_READER &reader, int fd) {
+    if (reader.buffered() != 0) return true;
+    struct pollfd connection = {0};
+    connection.fd = fd;
+    connection.events = POLLIN;
+    return poll(&connection, 1, 0) > 0 && (connection.revents & POLLIN);
+}
+
 class SOCKET_SERVER_DATA {
     public:
-        bool server_CAN_CONNECT = false;
-        bool server_should_close = false;
-        bool server_closed = false;
+        // each is 0 until it becomes true, waited on by the thread that started the server
+        SYNC_VARIABLE server_CAN_CONNECT;
+        SYNC_VARIABLE server_should_close;
+        SYNC_VARIABLE server_closed;
+        // readable once the server has been asked to shut down, it is never read from so
+        // every thread waiting on the server sees it
+        int shutdown_fd = -1;
         struct sockaddr_un server_addr = {0};
         char socket_name[108] = {0}; // 108 sun_path length max
         SOCKET_DATA_TRANSFER_INFO DATA_TRANSFER_INFO;
@@ -39,7 +150,7 @@ class SERVER_MESSAGES {
 } SERVER_MESSAGES;
 
 void SERVER_SHUTDOWN(char * server_name, SOCKET_SERVER_DATA * & internaldata) {
-    if (internaldata->server_closed) {
+    if (SYNC_VARIABLE_get(internaldata->server_closed)) {
         LOG_ERROR_SERVER(
             "SERVER: SERVER_SHUTDOWN attempting to close server %s but server has already been closed\n",
             server_name);
@@ -47,8 +158,13 @@ void SERVER_SHUTDOWN(char * server_name, SOCKET_SERVER_DATA * & internaldata) {
         internaldata = nullptr;
         return;
     }
-    internaldata->server_should_close = true;
-    while (!internaldata->server_closed);
+    SYNC_VARIABLE_set(internaldata->server_should_close, 1);
+    eventfd_write(internaldata->shutdown_fd, 1);
+    // the server thread still uses internaldata until it has closed
+    while (!SYNC_VARIABLE_wait(internaldata->server_closed, 1, SOCKET_SERVER_WAIT_WARNING_MS))
+        LOG_ERROR_SERVER("SERVER: server %s has not closed after %d milliseconds\n", server_name,
+                         SOCKET_SERVER_WAIT_WARNING_MS);
+    close(internaldata->shutdown_fd);
     delete internaldata;
     internaldata = nullptr;
 }
@@ -67,55 +183,120 @@ double now_ms(void) {
     return tv.tv_sec * 1000. + tv.tv_usec / 1000.;
 }
 
-char *str_humanise_bytes(off_t bytes) {
-    char *data = new char[1024];
-    if (bytes > 1 << 30) {
-        sprintf(data, "%u.%2.2u Gigabytes",
-                (int) (bytes >> 30),
-                (int) (bytes & ((1 << 30) - 1)) / 10737419);
-    } else if (bytes > 1 << 20) {
-        int x = bytes + 5243;  /* for rounding */
-        sprintf(data, "%u.%2.2u Megabytes",
-                x >> 20, ((x & ((1 << 20) - 1)) * 100) >> 20);
-    } else if (bytes > 1 << 10) {
-        int x = bytes + 5;  /* for rounding */
-        sprintf(data, "%u.%2.2u Kilobytes",
-                x >> 10, ((x & ((1 << 10) - 1)) * 100) >> 10);
-    } else {
-        sprintf(data, "%u bytes", (int) bytes);
+// reads into iov with a single recvmsg, sleeping in poll while nothing is available, fds that
+// arrive with the data are queued on reader
+// the recvmsg never blocks, even on a blocking connection, so the wait always honours the
+// reader's stop_fd and timeout_ms
+// returns the number of bytes read, or -1 if the connection was closed, an error occurred or
+// the wait was cut short by the reader's stop_fd or timeout_ms
+ssize_t SOCKET_READER_receive(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG,
+                              SOCKET_READER &reader, int &socket_data_fd, struct iovec *iov,
+                              size_t iovcnt, int *flags = nullptr) {
+    char control[CMSG_SPACE(sizeof(int) * SOCKET_READER_FDS_MAX)];
+    for (;;) {
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t ret = recvmsg(socket_data_fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+        s.reads++;
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // poll ignores a negative fd, so without a stop_fd this waits on the
+                // connection alone
+                struct pollfd fds[2] = {{0}, {0}};
+                fds[0].fd = socket_data_fd;
+                fds[0].events = POLLIN;
+                fds[1].fd = reader.stop_fd;
+                fds[1].events = POLLIN;
+                int ready = poll(fds, 2, reader.timeout_ms);
+                s.waits++;
+                if (ready < 0) continue; // EINTR, recvmsg reports anything else
+                if (ready == 0) {
+                    LOG_ERROR_SERVER("%sfd %d: nothing received for %d milliseconds\n", TAG,
+                                     socket_data_fd, reader.timeout_ms);
+                    return -1;
+                }
+                if (fds[1].revents & POLLIN) {
+                    LOG_INFO_SERVER("%sfd %d: stopped waiting for data\n", TAG,
+                                    socket_data_fd);
+                    return -1;
+                }
+                continue;
+            }
+            LOG_ERROR_SERVER("%srecvmsg: (errno: %2d) %s\n", TAG, errno, strerror(errno));
+            return -1;
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                reader.fds.push_back(fd);
+            }
+        }
+        if (msg.msg_flags & MSG_CTRUNC)
+            LOG_ERROR_SERVER("%smore than %d fds were sent at once, some were dropped\n", TAG,
+                             SOCKET_READER_FDS_MAX);
+        if (flags != nullptr) *flags = msg.msg_flags;
+        if (ret == 0) {
+            // if recvmsg returns zero, that means the connection has been closed
+            LOG_INFO_SERVER("%sClient has closed the connection\n", TAG);
+            return -1;
+        }
+        return ret;
     }
-    return data;
 }
 
-// returns false if an error has occurred otherwise true
-bool SOCKET_READ(const char *TAG, ssize_t *ret, int &socket_data_fd, void *__buf, size_t __count,
-                 int flags, ssize_t total) {
-    for (;;) { // implement blocking
-        *ret = recv(socket_data_fd, static_cast<void *>(static_cast<uint8_t *>(__buf) + total),
-                    __count - total, flags);
-        if (*ret < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
-            else break;
+// copies __count bytes out of reader, what it has not read ahead yet is received straight into
+// __buf along with as much of what follows as fits in reader's buffer
+bool
+SOCKET_GET(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, SOCKET_READER &reader,
+           int &socket_data_fd, void *__buf, size_t __count, char *server_name) {
+    assert(__count != 0);
+    TRACE_INFO_START(start);
+    uint8_t *buf = static_cast<uint8_t *>(__buf);
+    size_t total = reader.buffered() < __count ? reader.buffered() : __count;
+    memcpy(buf, reader.buffer.data() + reader.start, total);
+    reader.start += total;
+    if (reader.buffer.size() != SOCKET_READER_CAPACITY)
+        reader.buffer.resize(SOCKET_READER_CAPACITY);
+    while (total != __count) {
+        // the buffer is empty at this point
+        reader.start = 0;
+        reader.end = 0;
+        struct iovec io[2];
+        io[0].iov_base = buf + total;
+        io[0].iov_len = __count - total;
+        io[1].iov_base = reader.buffer.data();
+        io[1].iov_len = reader.buffer.size();
+        ssize_t ret = SOCKET_READER_receive(s, TAG, reader, socket_data_fd, io, 2);
+        if (ret < 0) return false;
+        size_t received = static_cast<size_t>(ret);
+        if (received > __count - total) {
+            reader.end = received - (__count - total);
+            received = __count - total;
         }
-        break;
-    }
-    if (*ret == 0) {
-        // if recv returns zero, that means the connection has been closed
-        LOG_INFO_SERVER("%sClient has closed the connection\n", TAG);
-        return false;
-    } else if (*ret < 0) {
-        LOG_ERROR_SERVER("%srecv: (errno: %2d) %s\n", TAG, errno, strerror(errno));
-        return false;
+        total += received;
+        if (SERVER_LOG_TRANSFER_INFO)
+            TRACE_VERBOSE("fd %d: recv %zu/%zu bytes", socket_data_fd, total, __count);
     }
+    s.total_wrote += __count;
+    TRACE_INFO("fd %d: received %zu bytes in %G milliseconds, %zu bytes received in total",
+               socket_data_fd, __count, TRACE_ms_since(start), s.total_wrote);
     return true;
 }
 
 // returns false if an error has occurred otherwise true
 bool
 SOCKET_WRITE(const char *TAG, ssize_t *ret, int &socket_data_fd, const void *__buf, size_t __count,
-             int flags, ssize_t total) {
+             int flags, size_t total) {
     for (;;) { // implement blocking
-        LOG_INFO_SERVER("sending message to fd %d", socket_data_fd);
+        TRACE_VERBOSE("fd %d: sending message", socket_data_fd);
         *ret = send(socket_data_fd,
                     static_cast<const void *>(static_cast<const uint8_t *>(__buf) + total),
                     __count - total, flags);
@@ -129,91 +310,30 @@ SOCKET_WRITE(const char *TAG, ssize_t *ret, int &socket_data_fd, const void *__b
     return true;
 }
 
-bool
-SOCKET_GET(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd, void *__buf,
-           size_t __count, char *server_name) {
-    assert(__count != 0);
-    ssize_t total = 0;
-    double start = now_ms();
-    while (total != __count) {
-        ssize_t ret = 0;
-        if (SOCKET_READ(TAG, &ret, socket_data_fd, __buf, __count, MSG_PEEK | MSG_DONTWAIT,
-                        total)) {
-            if (SOCKET_READ(TAG, &ret, socket_data_fd, __buf, __count, 0, total)) {
-                total += ret;
-                if (SERVER_LOG_TRANSFER_INFO)
-                    LOG_INFO_SERVER("%srecv %zu/%zu size", TAG, total, __count);
-            } else return false; // an error occurred
-        } else return false; // an error occurred
-    }
-    double end = now_ms();
-    s.total_wrote += __count;
-    char *n = str_humanise_bytes(__count);
-    char *t = str_humanise_bytes(s.total_wrote);
-    LOG_INFO_SERVER("%sObtained %s of data in %G milliseconds (Total obtained: %s of data)", TAG, n,
-                    end - start, t);
-    delete n;
-    delete t;
-    return true;
-}
-
 bool
 SOCKET_SEND(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd, const void *__buf,
             size_t __count, char *server_name) {
     assert(__count != 0);
-    ssize_t total = 0;
-    double start = now_ms();
+    size_t total = 0;
+    TRACE_INFO_START(start);
     while (total != __count) {
         ssize_t ret = 0;
         if (SOCKET_WRITE(TAG, &ret, socket_data_fd, __buf, __count, 0, total)) {
-            total += ret;
+            // SOCKET_WRITE only succeeds once ret is not negative
+            total += static_cast<size_t>(ret);
             if (SERVER_LOG_TRANSFER_INFO)
-                LOG_INFO_SERVER("%ssend %zu/%zu size", TAG, total, __count);
+                TRACE_VERBOSE("fd %d: send %zu/%zu bytes", socket_data_fd, total, __count);
         } else return false; // an error occurred
     }
-    double end = now_ms();
     s.total_wrote += __count;
-    char *n = str_humanise_bytes(__count);
-    char *t = str_humanise_bytes(s.total_wrote);
-    LOG_INFO_SERVER("%sWrote %s of data in %G milliseconds (Total sent: %s of data)", TAG, n,
-                    end - start, t);
-    delete n;
-    delete t;
-    return true;
-}
-
-// returns false if an error has occurred otherwise true
-bool SOCKET_READ_MESSAGE(const char *TAG, ssize_t *ret, int &socket_data_fd, msghdr *__msg,
-                         int flags, ssize_t total) {
-    for (;;) { // implement blocking
-        if (total > 0) {
-            struct msghdr msg = {0};
-            memcpy(&msg, __msg, sizeof(*__msg));
-//            msg.msg_control = static_cast<void *>(static_cast<uint8_t *>(__msg->msg_control) +
-//                                                  total);
-//            msg.msg_controllen -= total;
-            *ret = recvmsg(socket_data_fd, &msg, flags);
-        } else *ret = recvmsg(socket_data_fd, __msg, flags);
-        if (*ret < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
-            else break;
-        }
-        break;
-    }
-    if (*ret == 0) {
-        // if recv returns zero, that means the connection has been closed
-        LOG_INFO_SERVER("%sClient has closed the connection\n", TAG);
-        return false;
-    } else if (*ret < 0) {
-        LOG_ERROR_SERVER("%srecvmsg: (errno: %2d) %s\n", TAG, errno, strerror(errno));
-        return false;
-    }
+    TRACE_INFO("fd %d: sent %zu bytes in %G milliseconds, %zu bytes sent in total",
+               socket_data_fd, __count, TRACE_ms_since(start), s.total_wrote);
     return true;
 }
 
 // returns false if an error has occurred otherwise true
 bool SOCKET_WRITE_MESSAGE(const char *TAG, ssize_t *ret, int &socket_data_fd, const msghdr *__msg,
-                          int flags, ssize_t total) {
+                          int flags, size_t total) {
     for (;;) { // implement blocking
         if (total > 0) {
             struct msghdr msg = {0};
@@ -234,86 +354,232 @@ bool SOCKET_WRITE_MESSAGE(const char *TAG, ssize_t *ret, int &socket_data_fd, co
 }
 
 bool
-SOCKET_GET_MESSAGE(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd,
-                   msghdr *__msg,
-                   size_t __count, char *server_name) {
+SOCKET_SEND_MESSAGE(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd,
+                    const msghdr *__msg,
+                    size_t __count, char *server_name) {
     assert(__count != 0);
-    ssize_t total = 0;
-    double start = now_ms();
-    while (total != __count) {
+    size_t total = 0;
+    TRACE_INFO_START(start);
+    while(total != __count) {
         ssize_t ret = 0;
-        if (SOCKET_READ_MESSAGE(TAG, &ret, socket_data_fd, __msg, MSG_PEEK | MSG_DONTWAIT, total)) {
-            if (SOCKET_READ_MESSAGE(TAG, &ret, socket_data_fd, __msg, 0, total)) {
-                total += ret;
-                if (SERVER_LOG_TRANSFER_INFO)
-                    LOG_INFO_SERVER("%srecvmsg %zu/%zu size", TAG, total, __count);
-            } else return false; // an error occurred
+        if (SOCKET_WRITE_MESSAGE(TAG, &ret, socket_data_fd, __msg, 0, total)) {
+            // SOCKET_WRITE_MESSAGE only succeeds once ret is not negative
+            total += static_cast<size_t>(ret);
+            if (SERVER_LOG_TRANSFER_INFO)
+                TRACE_VERBOSE("fd %d: sendmsg %zu/%zu bytes", socket_data_fd, total, __count);
         } else return false; // an error occurred
     }
-    double end = now_ms();
     s.total_wrote += __count;
-    char *n = str_humanise_bytes(__count);
-    char *t = str_humanise_bytes(s.total_wrote);
-    LOG_INFO_SERVER("%sObtained %s of data in %G milliseconds (Total obtained: %s of data)", TAG, n,
-                    end - start, t);
-    delete n;
-    delete t;
+    TRACE_INFO("fd %d: sent %zu bytes in %G milliseconds, %zu bytes sent in total",
+               socket_data_fd, __count, TRACE_ms_since(start), s.total_wrote);
     return true;
 }
 
+// sends every segment of iov with as few sendmsg calls as possible, iov is advanced in place
 bool
-SOCKET_SEND_MESSAGE(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd,
-                    const msghdr *__msg,
-                    size_t __count, char *server_name) {
+SOCKET_SEND_IOVEC(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd,
+                  struct iovec *iov, size_t iovcnt, char *server_name) {
+    size_t __count = 0;
+    for (size_t i = 0; i < iovcnt; i++) __count += iov[i].iov_len;
     assert(__count != 0);
-    ssize_t total = 0;
-    double start = now_ms();
-    while(total != __count) {
+    size_t total = 0;
+    TRACE_INFO_START(start);
+    while (iovcnt != 0) {
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
         ssize_t ret = 0;
-        if (SOCKET_WRITE_MESSAGE(TAG, &ret, socket_data_fd, __msg, 0, total)) {
-            total += ret;
+        if (SOCKET_WRITE_MESSAGE(TAG, &ret, socket_data_fd, &msg, 0, 0)) {
+            total += static_cast<size_t>(ret);
             if (SERVER_LOG_TRANSFER_INFO)
-                LOG_INFO_SERVER("%ssendmsg %zu/%zu size", TAG, total, __count);
+                TRACE_VERBOSE("fd %d: sendmsg %zu/%zu bytes", socket_data_fd, total, __count);
         } else return false; // an error occurred
+        // skip the segments that have been fully sent and advance into a partially sent one
+        size_t sent = static_cast<size_t>(ret);
+        while (iovcnt != 0 && sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt != 0) {
+            iov->iov_base = static_cast<uint8_t *>(iov->iov_base) + sent;
+            iov->iov_len -= sent;
+        }
     }
-    double end = now_ms();
     s.total_wrote += __count;
-    char *n = str_humanise_bytes(__count);
-    char *t = str_humanise_bytes(s.total_wrote);
-    LOG_INFO_SERVER("%sWrote %s of data in %G milliseconds (Total sent: %s of data)", TAG, n,
-                    end - start, t);
-    delete n;
-    delete t;
+    TRACE_INFO("fd %d: sent %zu bytes in %G milliseconds, %zu bytes sent in total",
+               socket_data_fd, __count, TRACE_ms_since(start), s.total_wrote);
     return true;
 }
 
+void SOCKET_SEND_FD(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd, int &fd,
+                    char *server_name, int transport = SOCKET_TRANSPORT_STREAM);
+
+// sends the bytes of iov over a seqpacket socket, as a single datagram if they fit in the
+// receiver's SOCKET_READER, otherwise as a first datagram that does followed by fragments of at
+// most SOCKET_SEQPACKET_FRAGMENT bytes, fds are attached to the first datagram
+// iov is advanced in place
+bool
+SOCKET_SEND_DATAGRAMS(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd,
+                      struct iovec *iov, size_t iovcnt, const int *fds, size_t fd_count) {
+    assert(fd_count <= SOCKET_READER_FDS_MAX);
+    size_t __count = 0;
+    for (size_t i = 0; i < iovcnt; i++) __count += iov[i].iov_len;
+    char control[CMSG_SPACE(sizeof(int) * SOCKET_READER_FDS_MAX)];
+    std::vector<struct iovec> datagram;
+    size_t limit = SOCKET_READER_CAPACITY;
+    size_t total = 0;
+    TRACE_INFO_START(start);
+    while (iovcnt != 0) {
+        datagram.clear();
+        size_t left = limit;
+        while (iovcnt != 0 && left != 0 && datagram.size() < IOV_MAX) {
+            size_t take = iov->iov_len < left ? iov->iov_len : left;
+            datagram.push_back({iov->iov_base, take});
+            left -= take;
+            if (take == iov->iov_len) {
+                iov++;
+                iovcnt--;
+            } else {
+                iov->iov_base = static_cast<uint8_t *>(iov->iov_base) + take;
+                iov->iov_len -= take;
+            }
+        }
+        struct msghdr msg = {0};
+        msg.msg_iov = datagram.data();
+        msg.msg_iovlen = datagram.size();
+        if (total == 0 && fd_count != 0) {
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+            memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+        }
+        ssize_t ret = 0;
+        if (!SOCKET_WRITE_MESSAGE(TAG, &ret, socket_data_fd, &msg, 0, 0)) return false;
+        total += static_cast<size_t>(ret);
+        if (SERVER_LOG_TRANSFER_INFO)
+            TRACE_VERBOSE("fd %d: sendmsg %zu/%zu bytes", socket_data_fd, total, __count);
+        limit = SOCKET_SEQPACKET_FRAGMENT;
+    }
+    s.total_wrote += __count;
+    TRACE_INFO("fd %d: sent %zu bytes in %G milliseconds, %zu bytes sent in total",
+               socket_data_fd, __count, TRACE_ms_since(start), s.total_wrote);
+    return true;
+}
+
+// the length header and every field, including borrowed ones, go out in a single sendmsg
+// fds are sent along with the message, over a stream socket each follows it in a message of
+// its own, over a seqpacket socket they are attached to it
+// either way the receiver gets them with SOCKET_GET_FD after SOCKET_GET_SERIAL
 bool
 SOCKET_SEND_SERIAL(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd,
                    serializer &S,
-                   char *server_name) {
-    S.construct();
-    SOCKET_SEND(s, TAG, socket_data_fd, &S.stream.data_len, sizeof(size_t), server_name);
-    SOCKET_SEND(s, TAG, socket_data_fd, S.stream.data, S.stream.data_len, server_name);
-    S.stream.deallocate();
+                   char *server_name, int transport = SOCKET_TRANSPORT_STREAM,
+                   const int *fds = nullptr, size_t fd_count = 0) {
+    size_t length = 0;
+    std::vector<struct iovec> io;
+    io.push_back({&length, sizeof(size_t)});
+    S.to_iovec(io);
+    length = S.length();
+    bool ret;
+    if (transport == SOCKET_TRANSPORT_SEQPACKET)
+        ret = SOCKET_SEND_DATAGRAMS(s, TAG, socket_data_fd, io.data(), io.size(), fds, fd_count);
+    else {
+        ret = SOCKET_SEND_IOVEC(s, TAG, socket_data_fd, io.data(), io.size(), server_name);
+        for (size_t i = 0; ret && i < fd_count; i++) {
+            int fd = fds[i];
+            SOCKET_SEND_FD(s, TAG, socket_data_fd, fd, server_name, transport);
+        }
+    }
+    // the stream keeps its capacity for the next message
+    S.reset();
+    return ret;
+}
+
+bool
+SOCKET_GET_DATAGRAMS(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, SOCKET_READER &reader,
+                     int &socket_data_fd, serializer &S, char *server_name) {
+    if (reader.buffer.size() != SOCKET_READER_CAPACITY)
+        reader.buffer.resize(SOCKET_READER_CAPACITY);
+    TRACE_INFO_START(start);
+    int flags = 0;
+    struct iovec io = {reader.buffer.data(), reader.buffer.size()};
+    ssize_t ret = SOCKET_READER_receive(s, TAG, reader, socket_data_fd, &io, 1, &flags);
+    if (ret < 0) return false;
+    size_t length = 0;
+    if (static_cast<size_t>(ret) < sizeof(size_t) || (flags & MSG_TRUNC)) {
+        LOG_ERROR_SERVER("%sreceived a malformed datagram of %zd bytes\n", TAG, ret);
+        return false;
+    }
+    memcpy(&length, reader.buffer.data(), sizeof(size_t));
+    size_t total = static_cast<size_t>(ret) - sizeof(size_t);
+    if (length == 0 || total > length) {
+        LOG_ERROR_SERVER("%sexpected a message of %zu bytes, got %zu\n", TAG, length, total);
+        return false;
+    }
+    if (!SOCKET_MESSAGE_ALLOCATE(TAG, S, length)) return false;
+    memcpy(S.stream.data, reader.buffer.data() + sizeof(size_t), total);
+    // the fragments are received in place
+    while (total != length) {
+        io.iov_base = S.stream.data + total;
+        io.iov_len = length - total;
+        ret = SOCKET_READER_receive(s, TAG, reader, socket_data_fd, &io, 1, &flags);
+        if (ret < 0) {
+            S.stream.deallocate();
+            return false;
+        }
+        // a fragment is never longer than SOCKET_SEQPACKET_FRAGMENT and never runs past the
+        // end of the message, one that does belongs to something else and the session can no
+        // longer be trusted to be in step
+        if ((flags & MSG_TRUNC) || static_cast<size_t>(ret) > SOCKET_SEQPACKET_FRAGMENT) {
+            LOG_ERROR_SERVER("%sreceived a malformed fragment of %zd bytes at %zu/%zu bytes\n",
+                             TAG, ret, total, length);
+            S.stream.deallocate();
+            return false;
+        }
+        total += static_cast<size_t>(ret);
+        if (SERVER_LOG_TRANSFER_INFO)
+            TRACE_VERBOSE("fd %d: recvmsg %zu/%zu bytes", socket_data_fd, total, length);
+    }
+    S.deconstruct();
+    s.total_wrote += length;
+    TRACE_INFO("fd %d: received %zu bytes in %G milliseconds, %zu bytes received in total",
+               socket_data_fd, length, TRACE_ms_since(start), s.total_wrote);
     return true;
 }
 
 bool
-SOCKET_GET_SERIAL(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd, serializer &S,
-                  char *server_name) {
-    if (SOCKET_GET(s, TAG, socket_data_fd, &S.stream.data_len, sizeof(size_t), server_name)) {
-        S.stream.allocate(S.stream.data_len);
-        if (SOCKET_GET(s, TAG, socket_data_fd, S.stream.data, S.stream.data_len, server_name)) {
-            S.deconstruct();
-            return true;
-        } else S.stream.deallocate();
+SOCKET_GET_SERIAL(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, SOCKET_READER &reader,
+                  int &socket_data_fd, serializer &S, char *server_name,
+                  int transport = SOCKET_TRANSPORT_STREAM) {
+    if (transport == SOCKET_TRANSPORT_SEQPACKET)
+        return SOCKET_GET_DATAGRAMS(s, TAG, reader, socket_data_fd, S, server_name);
+    size_t length = 0;
+    if (!SOCKET_GET(s, TAG, reader, socket_data_fd, &length, sizeof(size_t), server_name))
+        return false;
+    if (!SOCKET_MESSAGE_ALLOCATE(TAG, S, length)) return false;
+    if (!SOCKET_GET(s, TAG, reader, socket_data_fd, S.stream.data, length, server_name)) {
+        S.stream.deallocate();
+        return false;
     }
-    return false;
+    S.deconstruct();
+    return true;
 }
 
 void SOCKET_SEND_FD(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd, int &fd,
-                    char *server_name)  // send fd by socket
+                    char *server_name, int transport)  // send fd by socket
 {
+    if (transport == SOCKET_TRANSPORT_SEQPACKET) {
+        // a datagram holding an empty message
+        size_t length = 0;
+        struct iovec io = {&length, sizeof(size_t)};
+        SOCKET_SEND_DATAGRAMS(s, TAG, socket_data_fd, &io, 1, &fd, 1);
+        return;
+    }
     struct msghdr msg = {0};
     char buf[CMSG_SPACE(sizeof(fd))];
     memset(buf, '\0', sizeof(buf));
@@ -337,37 +603,50 @@ void SOCKET_SEND_FD(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_d
 
     msg.msg_controllen = CMSG_SPACE(sizeof(fd));
 
+    // announces how many bytes carry the fd, they are sent once, with the fd attached
     serializer m;
-    m.add<size_t>(sizeof(msg));
+    m.add<size_t>(io.iov_len);
     SOCKET_SEND_SERIAL(s, TAG, socket_data_fd, m, server_name);
-    SOCKET_SEND_MESSAGE(s, TAG, socket_data_fd, &msg, sizeof(msg), server_name);
+    SOCKET_SEND_MESSAGE(s, TAG, socket_data_fd, &msg, io.iov_len, server_name);
 }
 
-void SOCKET_GET_FD(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, int &socket_data_fd, int &fd,
-                   char *server_name)  // receive fd from socket
+void SOCKET_GET_FD(SOCKET_DATA_TRANSFER_INFO &s, const char *TAG, SOCKET_READER &reader,
+                   int &socket_data_fd, int &fd, char *server_name,
+                   int transport = SOCKET_TRANSPORT_STREAM)  // receive fd from socket
 {
-    struct msghdr msg = {0};
-
-    /* On Mac OS X, the struct iovec is needed, even if it points to minimal data */
-    char m_buffer[1];
-    struct iovec io = {.iov_base = m_buffer, .iov_len = sizeof(m_buffer)};
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
-
-    char c_buffer[256];
-    msg.msg_control = c_buffer;
-    msg.msg_controllen = sizeof(c_buffer);
+    fd = -1;
+    if (transport == SOCKET_TRANSPORT_SEQPACKET) {
+        // the fds of a message arrive with it, only an fd sent on its own needs a datagram read
+        if (reader.fds.empty()) {
+            if (reader.buffer.size() != SOCKET_READER_CAPACITY)
+                reader.buffer.resize(SOCKET_READER_CAPACITY);
+            struct iovec io = {reader.buffer.data(), reader.buffer.size()};
+            if (SOCKET_READER_receive(s, TAG, reader, socket_data_fd, &io, 1) < 0) return;
+        }
+        if (reader.fds.empty()) {
+            LOG_ERROR_SERVER("%sexpected an fd but none was received\n", TAG);
+            return;
+        }
+        fd = reader.fds.front();
+        reader.fds.pop_front();
+        return;
+    }
     serializer m;
-    SOCKET_GET_SERIAL(s, TAG, socket_data_fd, m, server_name);
-    size_t __count;
+    if (!SOCKET_GET_SERIAL(s, TAG, reader, socket_data_fd, m, server_name)) return;
+    size_t __count = 0;
     m.get<size_t>(&__count);
-    SOCKET_GET_MESSAGE(s, TAG, socket_data_fd, &msg, __count, server_name);
-
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-
-    LOG_INFO_SERVER("About to extract fd\n");
-    memmove(&fd, CMSG_DATA(cmsg), sizeof(fd));
-    LOG_INFO_SERVER("Extracted fd %d\n", fd);
+    // the fd is queued by the reader as soon as the bytes carrying it have been read, whether
+    // here or already while reading ahead
+    char bytes[16];
+    assert(__count != 0 && __count <= sizeof(bytes));
+    if (!SOCKET_GET(s, TAG, reader, socket_data_fd, bytes, __count, server_name)) return;
+    if (reader.fds.empty()) {
+        LOG_ERROR_SERVER("%sexpected an fd but none was received\n", TAG);
+        return;
+    }
+    fd = reader.fds.front();
+    reader.fds.pop_front();
+    TRACE_VERBOSE("fd %d: extracted fd %d", socket_data_fd, fd);
 }
 
 bool SOCKET_CLOSE(const char *TAG, int & socket_fd) {
@@ -398,22 +677,41 @@ class SOCKET_SERVER {
         SOCKET_SERVER_DATA *internaldata = nullptr;
         int socket_fd = 0;
         int socket_data_fd = 0;
+        // connections that stay open across commands, accepted by socket_wait
+        std::vector<int> sessions;
+        // the single wait point for the listener, every session, shutdown and watched fds
+        int epoll_fd = -1;
+        // what has been read ahead on each connection, indexed by fd, a reader stays where it
+        // is for as long as its connection is open so it can be handed to another thread
+        std::vector<SOCKET_READER *> readers;
+        // the length of the queue of connections waiting to be accepted, see socket_listen
+        int backlog = SOCKET_SERVER_DEFAULT_BACKLOG;
+        // the SOCKET_TRANSPORT the server was started with
+        int transport = SOCKET_TRANSPORT_STREAM;
 
         void startServer(void *(*SERVER_MAIN)(void *)) {
             if (internaldata != nullptr) {
                 LOG_ERROR_SERVER("%sattempting to start server while running\n", TAG);
                 return;
             }
+            transport = SOCKET_TRANSPORT;
             internaldata = new SOCKET_SERVER_DATA;
-            internaldata->server_CAN_CONNECT = false;
-            internaldata->server_should_close = false;
-            internaldata->server_closed = false;
             memset(internaldata->socket_name, 0, 108);
             // NDK needs abstract namespace by leading with '\0'
             internaldata->socket_name[0] = '\0';
             memcpy(&internaldata->socket_name[1], server_name, 107);
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_fd < 0)
+                LOG_ERROR_SERVER("%sepoll_create1: %d (%s)\n", TAG, errno, strerror(errno));
+            internaldata->shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (internaldata->shutdown_fd < 0)
+                LOG_ERROR_SERVER("%seventfd: %d (%s)\n", TAG, errno, strerror(errno));
+            socket_watch(internaldata->shutdown_fd, SOCKET_SERVER_EVENT_SHUTDOWN);
             pthread_create(&server_thread, NULL, SERVER_MAIN, this);
-            while (!internaldata->server_CAN_CONNECT) {}
+            while (!SYNC_VARIABLE_wait(internaldata->server_CAN_CONNECT, 1,
+                                       SOCKET_SERVER_WAIT_WARNING_MS))
+                LOG_ERROR_SERVER("%sserver is not listening after %d milliseconds\n", TAG,
+                                 SOCKET_SERVER_WAIT_WARNING_MS);
         }
 
         void shutdownServer() {
@@ -423,7 +721,7 @@ class SOCKET_SERVER {
                     TAG);
                 return;
             }
-            if (internaldata->server_closed) {
+            if (SYNC_VARIABLE_get(internaldata->server_closed)) {
                 LOG_ERROR_SERVER(
                     "%sshutdownServer internaldata->server_closed attempting to close serverbut server has already been closed\n",
                     TAG);
@@ -519,7 +817,8 @@ class SOCKET_SERVER {
                 exit(EXIT_FAILURE);
             }
             LOG_INFO_SERVER("%sSocket listening for packages\n", TAG);
-            internaldata->server_CAN_CONNECT = true;
+            socket_watch(socket_fd, SOCKET_SERVER_EVENT_LISTENER);
+            SYNC_VARIABLE_set(internaldata->server_CAN_CONNECT, 1);
             return true;
         }
 
@@ -527,11 +826,21 @@ class SOCKET_SERVER {
         // otherwise returns true upon a successful accept attempt
         bool socket_accept(int &socket_fd, int &socket_data_fd) {
             for (;;) {
-                if (internaldata->server_should_close) return false;
-                socket_data_fd = accept(socket_fd, NULL, NULL);
+                if (SYNC_VARIABLE_get(internaldata->server_should_close)) return false;
+                socket_data_fd = accept4(socket_fd, NULL, NULL, SOCK_CLOEXEC);
                 if (socket_data_fd < 0) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
-                    else break;
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        // sleep until a connection is pending or the server is shut down
+                        struct pollfd fds[2] = {{0}, {0}};
+                        fds[0].fd = socket_fd;
+                        fds[0].events = POLLIN;
+                        fds[1].fd = internaldata->shutdown_fd;
+                        fds[1].events = POLLIN;
+                        poll(fds, 2, -1);
+                        continue;
+                    }
+                    break;
                 }
                 break;
             }
@@ -546,8 +855,8 @@ class SOCKET_SERVER {
         // or upon a failure to connect
         // otherwise returns true upon a successful accept attempt
         bool socket_accept_non_blocking(int &socket_fd, int &socket_data_fd) {
-            if (internaldata->server_should_close) return false;
-            socket_data_fd = accept(socket_fd, NULL, NULL);
+            if (SYNC_VARIABLE_get(internaldata->server_should_close)) return false;
+            socket_data_fd = accept4(socket_fd, NULL, NULL, SOCK_CLOEXEC);
             if (socket_data_fd < 0) {
                 if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return false;
                 LOG_ERROR_SERVER("%saccept: %d (%s)\n", TAG, errno, strerror(errno));
@@ -556,7 +865,28 @@ class SOCKET_SERVER {
             return true;
         }
 
+        // blocks until a connection is pending on socket_fd or timeout_ms has elapsed
+        // returns true if a connection is ready to be accepted
+        bool socket_wait_for_connection(int &socket_fd, int timeout_ms) {
+            struct pollfd listener = {0};
+            listener.fd = socket_fd;
+            listener.events = POLLIN;
+            int ret = poll(&listener, 1, timeout_ms);
+            if (ret < 0) {
+                if (errno != EINTR) LOG_ERROR_SERVER("%spoll: %d (%s)\n", TAG, errno, strerror(errno));
+                return false;
+            }
+            return ret > 0 && (listener.revents & POLLIN);
+        }
+
+        SOCKET_READER &reader(int fd) {
+            if (readers.size() <= static_cast<size_t>(fd)) readers.resize(fd + 1, nullptr);
+            if (readers[fd] == nullptr) readers[fd] = new SOCKET_READER;
+            return *readers[fd];
+        }
+
         bool socket_unaccept(int &socket_data_fd) {
+            reader(socket_data_fd).clear();
             return SOCKET_CLOSE(TAG, socket_data_fd);
         }
 
@@ -611,8 +941,21 @@ class SOCKET_SERVER {
         }
 
         void socket_close(int &socket_fd, int &socket_data_fd) {
-            if (SOCKET_CLOSE(TAG, socket_data_fd) && SOCKET_CLOSE(TAG, socket_fd))
-                internaldata->server_closed = true;
+            // socket_data_fd is the last session accepted or selected, it is closed with the
+            // sessions and must not be closed again, the fd may already belong to another file
+            for (int &session : sessions) {
+                if (session == socket_data_fd) socket_data_fd = -1;
+                SOCKET_CLOSE(TAG, session);
+            }
+            sessions.clear();
+            for (SOCKET_READER *r : readers) delete r;
+            readers.clear();
+            if (epoll_fd >= 0) SOCKET_CLOSE(TAG, epoll_fd);
+            epoll_fd = -1;
+            bool closed = socket_data_fd < 0 || SOCKET_CLOSE(TAG, socket_data_fd);
+            socket_data_fd = -1;
+            if (closed && SOCKET_CLOSE(TAG, socket_fd))
+                SYNC_VARIABLE_set(internaldata->server_closed, 1);
         }
 
         bool socket_create(__kernel_sa_family_t __af, int __type, int __protocol) {
@@ -644,6 +987,12 @@ class SOCKET_SERVER {
             return socket_accept_non_blocking(socket_fd, socket_data_fd);
         }
 
+        // blocks until a connection is pending or timeout_ms has elapsed
+        // returns true if a connection is ready to be accepted
+        bool socket_wait_for_connection(int timeout_ms) {
+            return socket_wait_for_connection(socket_fd, timeout_ms);
+        }
+
         bool socket_unaccept() { return socket_unaccept(socket_data_fd); }
 
         bool connection_is_alive() { return connection_is_alive(socket_data_fd); }
@@ -654,18 +1003,160 @@ class SOCKET_SERVER {
 
         void socket_close() { socket_close(socket_fd, socket_data_fd); }
 
+        // adds fd to the server's wait point, event says what it is
+        bool socket_watch(int fd, uint64_t event) {
+            struct epoll_event watch = {0};
+            watch.events = EPOLLIN;
+            watch.data.u64 = (event << 32) | static_cast<uint32_t>(fd);
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &watch) < 0) {
+                LOG_ERROR_SERVER("%sepoll_ctl: %d (%s)\n", TAG, errno, strerror(errno));
+                return false;
+            }
+            return true;
+        }
+
+        // has socket_wait report fd in watched whenever it is readable
+        bool socket_watch(int fd) { return socket_watch(fd, SOCKET_SERVER_EVENT_WATCHED); }
+
+        // must be called before a watched fd is closed, the file it refers to may outlive it,
+        // for example once it has been sent to another process
+        void socket_unwatch(int fd) {
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) < 0)
+                LOG_ERROR_SERVER("%sepoll_ctl: %d (%s)\n", TAG, errno, strerror(errno));
+        }
+
+        // the server's single wait point, blocks until a connection is pending, a session or a
+        // watched fd can be read from, the server is shut down, or timeout_ms has elapsed
+        // pending connections are accepted as new sessions, ready receives every session that
+        // has a request pending or has been closed by its client, and watched every watched
+        // fd that is readable
+        void socket_wait(std::vector<int> &ready, std::vector<int> &watched, int timeout_ms) {
+            struct epoll_event events[SOCKET_SERVER_EPOLL_EVENTS];
+            ready.clear();
+            watched.clear();
+            // requests that were read ahead are already waiting, the socket may not say so
+            for (int session : sessions) {
+                SOCKET_READER &r = reader(session);
+                if (!r.suspended && r.buffered() != 0) ready.push_back(session);
+            }
+            if (!ready.empty()) timeout_ms = 0;
+            int count = epoll_wait(epoll_fd, events, SOCKET_SERVER_EPOLL_EVENTS, timeout_ms);
+            if (count < 0) {
+                if (errno != EINTR)
+                    LOG_ERROR_SERVER("%sepoll_wait: %d (%s)\n", TAG, errno, strerror(errno));
+                return;
+            }
+            for (int i = 0; i < count; i++) {
+                int fd = static_cast<int>(events[i].data.u64 & UINT32_MAX);
+                switch (events[i].data.u64 >> 32) {
+                    case SOCKET_SERVER_EVENT_LISTENER:
+                        while (socket_accept_non_blocking(socket_fd, socket_data_fd)) {
+                            if (!socket_watch(socket_data_fd, SOCKET_SERVER_EVENT_SESSION)) {
+                                SOCKET_CLOSE(TAG, socket_data_fd);
+                                continue;
+                            }
+                            SOCKET_READER &r = reader(socket_data_fd);
+                            r.clear();
+                            // a request that stops halfway must not hold up the other sessions
+                            r.stop_fd = internaldata->shutdown_fd;
+                            r.timeout_ms = SOCKET_SESSION_TIMEOUT_MS;
+                            sessions.push_back(socket_data_fd);
+                            LOG_INFO_SERVER("%saccepted session %d, %zu open\n", TAG,
+                                            socket_data_fd, sessions.size());
+                        }
+                        break;
+                    case SOCKET_SERVER_EVENT_SESSION:
+                        if (reader(fd).buffered() == 0) ready.push_back(fd);
+                        break;
+                    case SOCKET_SERVER_EVENT_WATCHED:
+                        watched.push_back(fd);
+                        break;
+                    default:
+                        // shutdown, internaldata->server_should_close is already set
+                        break;
+                }
+            }
+        }
+
+        void sessions_wait(std::vector<int> &ready, int timeout_ms) {
+            static std::vector<int> watched;
+            socket_wait(ready, watched, timeout_ms);
+        }
+
+        // replies sent through socket_put_serial and socket_put_fd go to the selected session
+        void session_select(int session) { socket_data_fd = session; }
+
+        // returns true if another request is already waiting on the session
+        bool session_has_request(int session) {
+            return SOCKET_READER_has_data(reader(session), session);
+        }
+
+        // stops socket_wait reporting the session until session_resume, so another thread can
+        // read from it with reader(session) while this one keeps waiting and replying
+        void session_suspend(int session) {
+            struct epoll_event watch = {0};
+            watch.data.u64 = (SOCKET_SERVER_EVENT_SESSION << 32) | static_cast<uint32_t>(session);
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session, &watch) < 0)
+                LOG_ERROR_SERVER("%sepoll_ctl: %d (%s)\n", TAG, errno, strerror(errno));
+            reader(session).suspended = true;
+        }
+
+        void session_resume(int session) {
+            struct epoll_event watch = {0};
+            watch.events = EPOLLIN;
+            watch.data.u64 = (SOCKET_SERVER_EVENT_SESSION << 32) | static_cast<uint32_t>(session);
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session, &watch) < 0)
+                LOG_ERROR_SERVER("%sepoll_ctl: %d (%s)\n", TAG, errno, strerror(errno));
+            reader(session).suspended = false;
+        }
+
+        void session_close(int session) {
+            socket_unwatch(session);
+            reader(session).clear();
+            reader(session).suspended = false;
+            // the fd number is reused by the next file opened
+            if (socket_data_fd == session) socket_data_fd = -1;
+            SOCKET_CLOSE(TAG, session);
+            for (size_t i = 0; i < sessions.size(); i++)
+                if (sessions[i] == session) {
+                    sessions.erase(sessions.begin() + i);
+                    break;
+                }
+        }
+
+        // blocks until the server is asked to shut down
+        void wait_for_shutdown() {
+            struct pollfd shutdown = {0};
+            shutdown.fd = internaldata->shutdown_fd;
+            shutdown.events = POLLIN;
+            while (!SYNC_VARIABLE_get(internaldata->server_should_close)) poll(&shutdown, 1, -1);
+        }
+
         bool socket_put_serial(serializer &S) {
             return SOCKET_SEND_SERIAL(internaldata->DATA_TRANSFER_INFO, TAG, socket_data_fd, S,
-                                      server_name);
+                                      server_name, transport);
+        }
+
+        // fds sent with a message are received with socket_get_fd after socket_get_serial
+        bool socket_put_serial(serializer &S, const int *fds, size_t fd_count) {
+            return SOCKET_SEND_SERIAL(internaldata->DATA_TRANSFER_INFO, TAG, socket_data_fd, S,
+                                      server_name, transport, fds, fd_count);
         }
 
         bool socket_get_serial(serializer &S) {
-            return SOCKET_GET_SERIAL(internaldata->DATA_TRANSFER_INFO, TAG, socket_data_fd, S,
-                                     server_name);
+            return SOCKET_GET_SERIAL(internaldata->DATA_TRANSFER_INFO, TAG,
+                                     reader(socket_data_fd), socket_data_fd, S, server_name,
+                                     transport);
         }
 
         void socket_put_fd(int &fd) {
-            SOCKET_SEND_FD(internaldata->DATA_TRANSFER_INFO, TAG, socket_data_fd, fd, server_name);
+            SOCKET_SEND_FD(internaldata->DATA_TRANSFER_INFO, TAG, socket_data_fd, fd, server_name,
+                           transport);
+        }
+
+        void socket_get_fd(int &fd) {
+            SOCKET_GET_FD(internaldata->DATA_TRANSFER_INFO, TAG, reader(socket_data_fd),
+                          socket_data_fd, fd, server_name, transport);
         }
 
         char server_name[107];
@@ -687,10 +1178,11 @@ char *SERVER_allocate_new_server(size_t &id) { return SERVER_allocate_new_server
 void *SERVER_START_REPLY_MANUALLY(void *na) {
     assert(na != nullptr);
     SOCKET_SERVER *server = static_cast<SOCKET_SERVER *>(na);
-    server->socket_create(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    server->socket_create(AF_UNIX, SOCKET_TRANSPORT_type(server->transport) | SOCK_NONBLOCK, 0);
     server->socket_bind(AF_UNIX);
-    server->socket_listen(1);
-    while (!server->internaldata->server_should_close);
+    server->socket_listen(server->backlog);
+    // the owner of the server accepts and replies to connections itself
+    server->wait_for_shutdown();
     server->socket_close();
     return NULL;
 }
@@ -707,6 +1199,9 @@ class SOCKET_CLIENT {
         const size_t default_client_name_length = strlen(default_client_name);
         char * TAG = nullptr;
         SOCKET_DATA_TRANSFER_INFO DATA_TRANSFER_INFO;
+        SOCKET_READER reader;
+        // the SOCKET_TRANSPORT of the last connection
+        int transport = SOCKET_TRANSPORT_STREAM;
         void set_name(const char * name) {
             char socket_name[108]; // 108 sun_path length max
             memset(&socket_name, 0, 108);
@@ -752,20 +1247,27 @@ class SOCKET_CLIENT {
 
         bool socket_put_serial(serializer &S) {
             return SOCKET_SEND_SERIAL(DATA_TRANSFER_INFO, TAG, socket_data_fd, S,
-                                      &server_addr.sun_path[1]);
+                                      &server_addr.sun_path[1], transport);
+        }
+
+        bool socket_put_serial(serializer &S, const int *fds, size_t fd_count) {
+            return SOCKET_SEND_SERIAL(DATA_TRANSFER_INFO, TAG, socket_data_fd, S,
+                                      &server_addr.sun_path[1], transport, fds, fd_count);
         }
 
         bool socket_get_serial(serializer &S) {
-            return SOCKET_GET_SERIAL(DATA_TRANSFER_INFO, TAG, socket_data_fd, S,
-                                     &server_addr.sun_path[1]);
+            return SOCKET_GET_SERIAL(DATA_TRANSFER_INFO, TAG, reader, socket_data_fd, S,
+                                     &server_addr.sun_path[1], transport);
         }
 
         void socket_get_fd(int &fd) {
-            SOCKET_GET_FD(DATA_TRANSFER_INFO, TAG, socket_data_fd, fd, &server_addr.sun_path[1]);
+            SOCKET_GET_FD(DATA_TRANSFER_INFO, TAG, reader, socket_data_fd, fd,
+                          &server_addr.sun_path[1], transport);
         }
 
         bool connect_to_server() {
-            socket_data_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            transport = SOCKET_TRANSPORT;
+            socket_data_fd = socket(AF_UNIX, SOCKET_TRANSPORT_type(transport), 0);
             if (socket_data_fd < 0) {
                 LOG_ERROR_SERVER("%ssocket: %d (%s)\n", TAG, errno, strerror(errno));
                 return false;
@@ -787,6 +1289,7 @@ class SOCKET_CLIENT {
 
         bool disconnect_from_server() {
             LOG_INFO_SERVER("%sclosing connection to server\n", TAG);
+            reader.clear();
             assert(SOCKET_CLOSE(TAG, socket_data_fd));
             LOG_INFO_SERVER("%sclosed connection to server\n", TAG);
             if (SERVER_LOG_TRANSFER_INFO) LOG_INFO_SERVER("%sReturning response\n", TAG);
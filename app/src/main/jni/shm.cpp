@@ -4,6 +4,34 @@
 
 #include "shm.h"
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <linux/falloc.h>
+#if defined(__BIONIC__)
+#include <sys/ioctl.h>
+#endif
+
+// older headers lack the sealing constants
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_GET_SEALS (1024 + 10)
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+#if defined(SHM_MEMFD) || !defined(__ANDROID__)
+int SHM_BACKEND = SHM_BACKEND_MEMFD;
+#else
+int SHM_BACKEND = SHM_BACKEND_ASHMEM;
+#endif
+
+bool SHM_HUGETLB = true;
+size_t SHM_HUGETLB_MIN_SIZE = 2 * 1024 * 1024;
+const size_t SHM_HUGETLB_PAGE_SIZE = 2 * 1024 * 1024;
+
+bool SHM_PREFAULT = true;
 
 char *SHM_str_humanise_bytes(off_t bytes) {
     char *data = new char[1024];
@@ -25,10 +53,66 @@ char *SHM_str_humanise_bytes(off_t bytes) {
     return data;
 }
 
-bool SHM_create(int &fd, int8_t **data, size_t size) {
+// bionic only gained a memfd_create wrapper in api 30
+int SHM_memfd_create(const char *name, unsigned int flags) {
+    return static_cast<int>(syscall(__NR_memfd_create, name, flags));
+}
+
+// ashmem regions do not support sealing, so a valid F_GET_SEALS means memfd
+bool SHM_is_memfd(int fd) {
+    return fcntl(fd, F_GET_SEALS) >= 0;
+}
+
+int8_t *SHM_map(int fd, size_t size) {
+    int flags = MAP_SHARED;
+    if (SHM_PREFAULT) flags |= MAP_POPULATE;
+    return static_cast<int8_t *>(mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0));
+}
+
+bool SHM_create_memfd(int &fd, int8_t **data, size_t &size) {
+    if (SHM_HUGETLB && size >= SHM_HUGETLB_MIN_SIZE) {
+        size_t rounded = (size + SHM_HUGETLB_PAGE_SIZE - 1) & ~(SHM_HUGETLB_PAGE_SIZE - 1);
+        fd = SHM_memfd_create("my_shm_region", MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB);
+        if (fd >= 0) {
+            // huge pages are reserved when the region is mapped, so this is what fails
+            // when none are available
+            if (ftruncate(fd, rounded) == 0) {
+                *data = SHM_map(fd, rounded);
+                if (*data != MAP_FAILED) {
+                    LOG_INFO_SHM("region created with %zu size, backed by huge pages", rounded);
+                    size = rounded;
+                    return true;
+                }
+            }
+            close(fd);
+        }
+        LOG_INFO_SHM("huge pages unavailable: errno: %d (%s), using normal pages", errno,
+                     strerror(errno));
+    }
+    fd = SHM_memfd_create("my_shm_region", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        LOG_ERROR_SHM("memfd_create: errno: %d (%s)", errno, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, size) < 0) {
+        LOG_ERROR_SHM("ftruncate: errno: %d (%s)", errno, strerror(errno));
+        close(fd);
+        return false;
+    }
+    LOG_INFO_SHM("region created with %zu size", size);
+    *data = SHM_map(fd, size);
+    if (*data == MAP_FAILED) {
+        LOG_ERROR_SHM("mmap: errno: %d (%s)", errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool SHM_create(int &fd, int8_t **data, size_t &size) {
     char *b = SHM_str_humanise_bytes(static_cast<off_t>(size));
     LOG_INFO_SHM("requesting %zu bytes (%s) of memory", size, b);
     free(b);
+    if (SHM_BACKEND == SHM_BACKEND_MEMFD) return SHM_create_memfd(fd, data, size);
     fd = ashmem_create_region("my_shm_region", size);
     if(fd < 0) {
         LOG_ERROR_SHM("ashmem_create_region: errno: %d (%s)", errno, strerror(errno));
@@ -45,7 +129,7 @@ bool SHM_create(int &fd, int8_t **data, size_t size) {
     assert(region_size == size);
 
     // Use fd to mmap from offset "0" to size mentioned below,
-    *data = static_cast<int8_t *>(mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    *data = SHM_map(fd, size);
     if (*data == MAP_FAILED) {
         LOG_ERROR_SHM("mmap: errno: %d (%s)", errno, strerror(errno));
         return false;
@@ -53,13 +137,94 @@ bool SHM_create(int &fd, int8_t **data, size_t size) {
     return true;
 }
 
-bool SHM_resize(int &fd, size_t size) {
+bool SHM_resize(int &fd, size_t &size) {
+    if (SHM_is_memfd(fd)) {
+        // regions backed by huge pages report the huge page size as their block size
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_blksize) > 4096)
+            size = (size + st.st_blksize - 1) & ~(static_cast<size_t>(st.st_blksize) - 1);
+        if (ftruncate(fd, size) < 0) {
+            LOG_ERROR_SHM("ftruncate: errno: %d (%s)", errno, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+#if defined(__BIONIC__)
     int ret = TEMP_FAILURE_RETRY(ioctl(fd, ASHMEM_SET_SIZE, size));
     if (ret < 0) {
         LOG_ERROR_SHM("ioctl: errno: %d (%s)", errno, strerror(errno));
         return false;
     }
     return true;
+#else
+    // ASHMEM_SET_SIZE comes from bionic's linux/ashmem.h, without it only memfd is usable
+    LOG_ERROR_SHM("fd %d: ashmem regions can not be resized in this build", fd);
+    return false;
+#endif
+}
+
+bool SHM_unpin(int &fd, size_t offset, size_t len) {
+    if (SHM_is_memfd(fd)) {
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) < 0) {
+            LOG_ERROR_SHM("fallocate: errno: %d (%s)", errno, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+    if (ashmem_unpin_region(fd, offset, len) < 0) {
+        LOG_ERROR_SHM("ashmem_unpin_region: errno: %d (%s)", errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool SHM_pin(int &fd, size_t offset, size_t len) {
+    if (SHM_is_memfd(fd)) return true;
+    if (ashmem_pin_region(fd, offset, len) < 0) {
+        LOG_ERROR_SHM("ashmem_pin_region: errno: %d (%s)", errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool SHM_seal(int &fd, bool growable) {
+    if (!SHM_is_memfd(fd)) return true;
+    if (fcntl(fd, F_ADD_SEALS, growable ? F_SEAL_SHRINK : F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        LOG_ERROR_SHM("fcntl: errno: %d (%s)", errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool SHM_sealed(int &fd, size_t size) {
+    if (SHM_is_memfd(fd)) {
+        int seals = fcntl(fd, F_GET_SEALS);
+        if (!(seals & F_SEAL_SHRINK)) {
+            LOG_ERROR_SHM("fd %d is not sealed against shrinking", fd);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            LOG_ERROR_SHM("fstat: errno: %d (%s)", errno, strerror(errno));
+            return false;
+        }
+        if (static_cast<uint64_t>(st.st_size) < size) {
+            LOG_ERROR_SHM("fd %d holds %lld bytes, %zu were expected", fd,
+                          static_cast<long long>(st.st_size), size);
+            return false;
+        }
+        return true;
+    }
+    if (!ashmem_valid(fd)) {
+        LOG_ERROR_SHM("ashmem_valid: errno: %d (%s)", errno, strerror(errno));
+        return false;
+    }
+    int region_size = ashmem_get_size_region(fd);
+    if (region_size < 0 || static_cast<size_t>(region_size) < size) {
+        LOG_ERROR_SHM("fd %d holds %d bytes, %zu were expected", fd, region_size, size);
+        return false;
+    }
+    return true;
 }
 
 bool SHM_close(int &fd) {
@@ -74,11 +239,11 @@ bool SHM_close(int &fd) {
 bool SHM_open(int &fd, int8_t **data, size_t size) {
     // fd and size should be sent from the process calling SHM_create, to the process calling SHM_open
     // Use fd to mmap from offset "0" to size mentioned below,
-    if (!ashmem_valid(fd)) {
+    if (!SHM_is_memfd(fd) && !ashmem_valid(fd)) {
         LOG_ERROR_SHM("ashmem_valid: errno: %d (%s)", errno, strerror(errno));
         return false;
     }
-    *data = static_cast<int8_t *>(mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    *data = SHM_map(fd, size);
     if (*data == MAP_FAILED) {
         LOG_ERROR_SHM("mmap: errno: %d (%s)", errno, strerror(errno));
         return false;
@@ -7,15 +7,65 @@
 
 #include "header.h"
 #include "ashmem.h"
-#define LOG_TAG_SHM "ANDROID SHARED MEMORY"
-#define LOG_INFO_SHM(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG_SHM, __VA_ARGS__)
-#define LOG_ERROR_SHM(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG_SHM, __VA_ARGS__)
+#include "futex.h"
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
-bool SHM_create(int &fd, int8_t **data, size_t size);
+#ifndef __ANDROID__
+    #define LOG_INFO_SHM printf
+    #define LOG_ERROR_SHM printf
+#else
+    #include <android/log.h>
+
+    #define LOG_TAG_SHM "ANDROID SHARED MEMORY"
+    #define LOG_INFO_SHM(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG_SHM, __VA_ARGS__)
+    #define LOG_ERROR_SHM(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG_SHM, __VA_ARGS__)
+#endif
+
+// shared memory is backed either by ashmem or by memfd, ashmem is only available on android,
+// memfd works on any linux kernel from 3.17, building with SHM_MEMFD defined makes memfd
+// the default, as does building for anything other than android, SHM_BACKEND may also be
+// changed at run time before any region is created
+// a region is always opened with the backend it was created with
+const int SHM_BACKEND_ASHMEM = 0;
+const int SHM_BACKEND_MEMFD = 1;
+extern int SHM_BACKEND;
+
+// memfd only, back regions of at least SHM_HUGETLB_MIN_SIZE bytes with huge pages,
+// falls back to normal pages if none are available
+extern bool SHM_HUGETLB;
+extern size_t SHM_HUGETLB_MIN_SIZE;
+
+// map regions with MAP_POPULATE so their pages are faulted in up front instead of on first touch
+extern bool SHM_PREFAULT;
+
+// size may be rounded up (to a whole number of huge pages), the rounded size is the one
+// the region must be opened and unmapped with
+bool SHM_create(int &fd, int8_t **data, size_t &size);
 
 bool SHM_open(int &fd, int8_t **data, size_t size);
 
-bool SHM_resize(int &fd, size_t size);
+// size may be rounded up the same way SHM_create rounds it, ashmem regions can not be
+// resized once they have been mapped
+bool SHM_resize(int &fd, size_t &size);
+
+// marks a page aligned range of a region as purgeable so the kernel may reclaim its pages,
+// ashmem reclaims them under memory pressure, memfd releases them straight away,
+// either way the range must be pinned again before it is reused and reads back as zeroes
+// if it was reclaimed
+bool SHM_unpin(int &fd, size_t offset, size_t len);
+
+bool SHM_pin(int &fd, size_t offset, size_t len);
+
+// memfd only, forbids the region from ever changing size so a process mapping it can never
+// be faulted by the other side shrinking it, a no-op for ashmem
+// a growable region may still grow in place, it is replaced instead of shrunk
+bool SHM_seal(int &fd, bool growable = false);
+
+// a process mapping a region the other side created checks this first, true if the region
+// holds at least size bytes and can never shrink, a memfd must be sealed against shrinking,
+// an ashmem region can not be resized once mapped
+bool SHM_sealed(int &fd, size_t size);
 
 bool SHM_close(int &fd);
 #endif //GLNE_SHM_H
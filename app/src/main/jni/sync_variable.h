@@ -0,0 +1,92 @@
+//
+// a value threads wait on without spinning
+//
+
+#ifndef GLNE_SYNC_VARIABLE_H
+#define GLNE_SYNC_VARIABLE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "futex.h"
+
+// every access is sequentially consistent, so whatever a thread wrote before a set is visible to
+// the thread a wait returns in, waiters sleep on the value itself through a futex and a set only
+// makes a system call when a thread is sleeping
+// inline as this header is reached from more than one translation unit
+
+class SYNC_VARIABLE {
+    public:
+        int32_t value = 0;
+        // threads inside SYNC_VARIABLE_wait
+        int32_t waiters = 0;
+
+        SYNC_VARIABLE() = default;
+        SYNC_VARIABLE(int32_t value) : value(value) {}
+};
+
+inline int32_t SYNC_VARIABLE_get(SYNC_VARIABLE &variable) {
+    return __atomic_load_n(&variable.value, __ATOMIC_SEQ_CST);
+}
+
+inline void SYNC_VARIABLE_set(SYNC_VARIABLE &variable, int32_t value) {
+    __atomic_store_n(&variable.value, value, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&variable.waiters, __ATOMIC_SEQ_CST) != 0)
+        futex_wake_all(&variable.value);
+}
+
+// sets variable to to only if it holds from, so a transition can not overwrite one another
+// thread made in the meantime
+// returns true if the transition was made
+inline bool SYNC_VARIABLE_transition(SYNC_VARIABLE &variable, int32_t from, int32_t to) {
+    if (!__atomic_compare_exchange_n(&variable.value, &from, to, false, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_SEQ_CST))
+        return false;
+    if (__atomic_load_n(&variable.waiters, __ATOMIC_SEQ_CST) != 0)
+        futex_wake_all(&variable.value);
+    return true;
+}
+
+// sleeps until variable holds value or timeout_ms has elapsed, -1 waits forever
+// returns true if variable holds value, false if the timeout expired first
+inline bool SYNC_VARIABLE_wait(SYNC_VARIABLE &variable, int32_t value, int timeout_ms = -1) {
+    struct timespec deadline = {0, 0};
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += static_cast<long>(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    // counted before the value is checked, a set that lands after the check sees the waiter
+    // and the futex refuses to sleep on a value that has already changed
+    __atomic_add_fetch(&variable.waiters, 1, __ATOMIC_SEQ_CST);
+    bool reached = false;
+    for (;;) {
+        int32_t current = __atomic_load_n(&variable.value, __ATOMIC_SEQ_CST);
+        if (current == value) {
+            reached = true;
+            break;
+        }
+        if (timeout_ms < 0) {
+            futex_wait(&variable.value, current, nullptr);
+            continue;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec remaining;
+        remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+        remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (remaining.tv_nsec < 0) {
+            remaining.tv_sec--;
+            remaining.tv_nsec += 1000000000L;
+        }
+        if (remaining.tv_sec < 0) break;
+        futex_wait(&variable.value, current, &remaining);
+    }
+    __atomic_sub_fetch(&variable.waiters, 1, __ATOMIC_SEQ_CST);
+    return reached;
+}
+
+#endif //GLNE_SYNC_VARIABLE_H
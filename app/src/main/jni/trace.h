@@ -0,0 +1,255 @@
+//
+// binary trace records for hot paths, kept in a ring per thread and formatted offline
+//
+
+#ifndef GLNE_TRACE_H
+#define GLNE_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+
+// records below TRACE_LEVEL compile to nothing, their arguments are not evaluated
+// a record costs a clock read and a copy of its arguments into the calling thread's ring,
+// nothing is formatted until the rings are dumped with TRACE_dump and the dump is decoded by
+// compositor_examples/trace_decode.cpp
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_VERBOSE 3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+// the format is a printf format, string literals only as it is only read when dumped
+// arguments are integers, pointers, floating point values, or strings that outlive the
+// trace, such as literals and server names
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(format, ...) TRACE_write(TRACE_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define TRACE_ERROR(...) ((void) 0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(format, ...) TRACE_write(TRACE_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define TRACE_INFO(...) ((void) 0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+#define TRACE_VERBOSE(format, ...) TRACE_write(TRACE_LEVEL_VERBOSE, format, ##__VA_ARGS__)
+#else
+#define TRACE_VERBOSE(...) ((void) 0)
+#endif
+
+// declares name as the time a record of the level measures from, passed to it as
+// TRACE_ms_since(name), the clock is only read if records of the level are compiled in
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO_START(name) uint64_t name = TRACE_now()
+#else
+#define TRACE_INFO_START(name) ((void) 0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+#define TRACE_VERBOSE_START(name) uint64_t name = TRACE_now()
+#else
+#define TRACE_VERBOSE_START(name) ((void) 0)
+#endif
+
+const int TRACE_ARGUMENTS_MAX = 6;
+// records kept per thread, once a ring is full the oldest records are overwritten
+const uint64_t TRACE_RING_RECORDS = 4096;
+
+const uint8_t TRACE_ARGUMENT_INTEGER = 0;
+const uint8_t TRACE_ARGUMENT_DOUBLE = 1;
+const uint8_t TRACE_ARGUMENT_STRING = 2;
+
+struct TRACE_record {
+    uint64_t time; // CLOCK_MONOTONIC nanoseconds
+    const char *format;
+    uint8_t level;
+    uint8_t count;
+    uint8_t types[TRACE_ARGUMENTS_MAX];
+    uint64_t arguments[TRACE_ARGUMENTS_MAX];
+};
+
+class TRACE_ring {
+    public:
+        TRACE_record records[TRACE_RING_RECORDS];
+        // the number of records ever written, only the owning thread advances it
+        uint64_t written = 0;
+        pid_t thread = 0;
+        TRACE_ring *next = nullptr;
+};
+
+// every ring ever created, rings are never freed so a dump can read the records of threads
+// that have exited
+inline TRACE_ring *&TRACE_rings() {
+    static TRACE_ring *rings = nullptr;
+    return rings;
+}
+
+inline TRACE_ring *TRACE_thread_ring() {
+    static thread_local TRACE_ring *ring = nullptr;
+    if (ring == nullptr) {
+        ring = new TRACE_ring;
+        ring->thread = static_cast<pid_t>(syscall(SYS_gettid));
+        TRACE_ring *&rings = TRACE_rings();
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED));
+    }
+    return ring;
+}
+
+inline uint64_t TRACE_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL +
+           static_cast<uint64_t>(now.tv_nsec);
+}
+
+inline double TRACE_ms_since(uint64_t start) {
+    return (TRACE_now() - start) / 1000000.0;
+}
+
+template<typename TYPE>
+inline void TRACE_argument(TRACE_record &record, TYPE value) {
+    uint8_t i = record.count++;
+    if (std::is_floating_point<TYPE>::value) {
+        double d = static_cast<double>(value);
+        record.types[i] = TRACE_ARGUMENT_DOUBLE;
+        memcpy(&record.arguments[i], &d, sizeof(double));
+    } else {
+        record.types[i] = TRACE_ARGUMENT_INTEGER;
+        record.arguments[i] = static_cast<uint64_t>(value);
+    }
+}
+
+inline void TRACE_argument(TRACE_record &record, const char *value) {
+    uint8_t i = record.count++;
+    record.types[i] = TRACE_ARGUMENT_STRING;
+    record.arguments[i] = reinterpret_cast<uintptr_t>(value);
+}
+
+inline void TRACE_argument(TRACE_record &record, char *value) {
+    TRACE_argument(record, const_cast<const char *>(value));
+}
+
+template<typename TYPE>
+inline void TRACE_argument(TRACE_record &record, TYPE *value) {
+    uint8_t i = record.count++;
+    record.types[i] = TRACE_ARGUMENT_INTEGER;
+    record.arguments[i] = reinterpret_cast<uintptr_t>(value);
+}
+
+inline void TRACE_arguments(TRACE_record &) {}
+
+template<typename FIRST, typename... REST>
+inline void TRACE_arguments(TRACE_record &record, FIRST first, REST... rest) {
+    TRACE_argument(record, first);
+    TRACE_arguments(record, rest...);
+}
+
+// a process that never gets to dump its rings, such as a client that runs until it is killed,
+// can have every record passed on as it is written, with its format and arguments as printf
+// takes them
+typedef void (*TRACE_echo_function)(uint8_t level, const char *format, ...);
+
+inline TRACE_echo_function &TRACE_echo() {
+    static TRACE_echo_function echo = nullptr;
+    return echo;
+}
+
+template<typename... ARGUMENTS>
+inline void TRACE_write(uint8_t level, const char *format, ARGUMENTS... arguments) {
+    static_assert(sizeof...(ARGUMENTS) <= TRACE_ARGUMENTS_MAX, "too many trace arguments");
+    TRACE_ring *ring = TRACE_thread_ring();
+    TRACE_record &record = ring->records[ring->written & (TRACE_RING_RECORDS - 1)];
+    record.time = TRACE_now();
+    record.format = format;
+    record.level = level;
+    record.count = 0;
+    TRACE_arguments(record, arguments...);
+    __atomic_store_n(&ring->written, ring->written + 1, __ATOMIC_RELEASE);
+    TRACE_echo_function echo = TRACE_echo();
+    if (echo != nullptr) echo(level, format, arguments...);
+}
+
+// dump layout, every field in host byte order:
+// "GLTRACE1"
+// for every string:  [uint32 TRACE_DUMP_STRING][uint32 length][uint64 address][length bytes]
+// for every thread:  [uint32 TRACE_DUMP_RING][uint32 thread][uint64 count][count records]
+// [uint32 TRACE_DUMP_END]
+// strings are the formats and string arguments of the records, by the address they had
+const char TRACE_DUMP_MAGIC[8] = {'G', 'L', 'T', 'R', 'A', 'C', 'E', '1'};
+const uint32_t TRACE_DUMP_STRING = 1;
+const uint32_t TRACE_DUMP_RING = 2;
+const uint32_t TRACE_DUMP_END = 3;
+
+inline void TRACE_dump_string(FILE *file, std::vector<const char *> &written, const char *string) {
+    if (string == nullptr || std::find(written.begin(), written.end(), string) != written.end())
+        return;
+    written.push_back(string);
+    uint32_t kind = TRACE_DUMP_STRING;
+    uint32_t length = static_cast<uint32_t>(strlen(string));
+    uint64_t address = reinterpret_cast<uintptr_t>(string);
+    fwrite(&kind, sizeof(kind), 1, file);
+    fwrite(&length, sizeof(length), 1, file);
+    fwrite(&address, sizeof(address), 1, file);
+    fwrite(string, 1, length, file);
+}
+
+// writes the records of every thread to path, threads may keep tracing while this runs,
+// records they overwrite while they are being copied are left out
+// returns the number of records written
+inline size_t TRACE_dump(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) return 0;
+    fwrite(TRACE_DUMP_MAGIC, sizeof(TRACE_DUMP_MAGIC), 1, file);
+    std::vector<const char *> strings;
+    std::vector<TRACE_record> records;
+    size_t total = 0;
+    for (TRACE_ring *ring = __atomic_load_n(&TRACE_rings(), __ATOMIC_ACQUIRE); ring != nullptr;
+         ring = ring->next) {
+        uint64_t end = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+        uint64_t start = end > TRACE_RING_RECORDS ? end - TRACE_RING_RECORDS : 0;
+        records.clear();
+        for (uint64_t i = start; i < end; i++)
+            records.push_back(ring->records[i & (TRACE_RING_RECORDS - 1)]);
+        // anything the thread has written since, or is writing now, may have overwritten the
+        // oldest copies
+        uint64_t now = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE) + 1;
+        size_t skip = 0;
+        if (now > TRACE_RING_RECORDS && now - TRACE_RING_RECORDS > start)
+            skip = static_cast<size_t>(std::min(now - TRACE_RING_RECORDS - start, end - start));
+        for (size_t i = skip; i < records.size(); i++) {
+            TRACE_dump_string(file, strings, records[i].format);
+            for (uint8_t a = 0; a < records[i].count; a++)
+                if (records[i].types[a] == TRACE_ARGUMENT_STRING)
+                    TRACE_dump_string(file, strings,
+                                      reinterpret_cast<const char *>(records[i].arguments[a]));
+        }
+        uint32_t kind = TRACE_DUMP_RING;
+        uint32_t thread = static_cast<uint32_t>(ring->thread);
+        uint64_t count = records.size() - skip;
+        fwrite(&kind, sizeof(kind), 1, file);
+        fwrite(&thread, sizeof(thread), 1, file);
+        fwrite(&count, sizeof(count), 1, file);
+        fwrite(records.data() + skip, sizeof(TRACE_record), count, file);
+        total += count;
+    }
+    uint32_t end = TRACE_DUMP_END;
+    fwrite(&end, sizeof(end), 1, file);
+    fclose(file);
+    return total;
+}
+
+#endif //GLNE_TRACE_H
@@ -0,0 +1,112 @@
+//
+// the windows on screen, back to front, as parallel arrays
+//
+
+#ifndef GLNE_WINDOW_LIST_H
+#define GLNE_WINDOW_LIST_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// the compositor redraws every window each frame, walking the object table for them meant a
+// visit to every slot of every page and a pointer chase per window, here each property a draw
+// reads is its own contiguous array holding only live windows, so a frame touches as many
+// entries as there are windows and nothing else
+// windows are drawn in list order, a new window is placed on top of the others and closing one
+// keeps the order of the rest
+// inline as this header is reached from more than one translation unit
+
+// position holds for no window
+const size_t WINDOW_LIST_NONE = SIZE_MAX;
+
+class WINDOW_LIST {
+    public:
+        // the object table id of each window
+        std::vector<size_t> id;
+        // the corners of each window as the client sends them, x1, y1 at the top left and
+        // x2, y2 at the bottom right, see GLIS_draw_rectangle
+        std::vector<int> x1;
+        std::vector<int> y1;
+        std::vector<int> x2;
+        std::vector<int> y2;
+        // 0 until the first frame of the window has been uploaded
+        std::vector<uint32_t> texture;
+        // the GLIS_WINDOW_FLAG_* hints the client set, 0 for none
+        std::vector<uint32_t> flags;
+        // the index of each id in the arrays above, WINDOW_LIST_NONE if it is not a window
+        std::vector<size_t> position;
+};
+
+inline size_t WINDOW_LIST_count(const WINDOW_LIST &list) {
+    return list.id.size();
+}
+
+inline size_t WINDOW_LIST_find(const WINDOW_LIST &list, size_t id) {
+    return id < list.position.size() ? list.position[id] : WINDOW_LIST_NONE;
+}
+
+// places window id on top of the others
+inline void WINDOW_LIST_add(WINDOW_LIST &list, size_t id, int x1, int y1, int x2, int y2) {
+    if (id >= list.position.size()) list.position.resize(id + 1, WINDOW_LIST_NONE);
+    assert(list.position[id] == WINDOW_LIST_NONE);
+    list.position[id] = list.id.size();
+    list.id.push_back(id);
+    list.x1.push_back(x1);
+    list.y1.push_back(y1);
+    list.x2.push_back(x2);
+    list.y2.push_back(y2);
+    list.texture.push_back(0);
+    list.flags.push_back(0);
+}
+
+inline void WINDOW_LIST_move(WINDOW_LIST &list, size_t id, int x1, int y1, int x2, int y2) {
+    size_t i = WINDOW_LIST_find(list, id);
+    assert(i != WINDOW_LIST_NONE);
+    list.x1[i] = x1;
+    list.y1[i] = y1;
+    list.x2[i] = x2;
+    list.y2[i] = y2;
+}
+
+inline void WINDOW_LIST_set_texture(WINDOW_LIST &list, size_t id, uint32_t texture) {
+    size_t i = WINDOW_LIST_find(list, id);
+    assert(i != WINDOW_LIST_NONE);
+    list.texture[i] = texture;
+}
+
+inline void WINDOW_LIST_set_flags(WINDOW_LIST &list, size_t id, uint32_t flags) {
+    size_t i = WINDOW_LIST_find(list, id);
+    assert(i != WINDOW_LIST_NONE);
+    list.flags[i] = flags;
+}
+
+// the windows above id move down one place, so closing a window costs as much as the number of
+// windows on top of it, which is paid once rather than every frame
+inline void WINDOW_LIST_remove(WINDOW_LIST &list, size_t id) {
+    size_t i = WINDOW_LIST_find(list, id);
+    assert(i != WINDOW_LIST_NONE);
+    list.id.erase(list.id.begin() + i);
+    list.x1.erase(list.x1.begin() + i);
+    list.y1.erase(list.y1.begin() + i);
+    list.x2.erase(list.x2.begin() + i);
+    list.y2.erase(list.y2.begin() + i);
+    list.texture.erase(list.texture.begin() + i);
+    list.flags.erase(list.flags.begin() + i);
+    list.position[id] = WINDOW_LIST_NONE;
+    for (; i < list.id.size(); i++) list.position[list.id[i]] = i;
+}
+
+inline void WINDOW_LIST_clear(WINDOW_LIST &list) {
+    list.id.clear();
+    list.x1.clear();
+    list.y1.clear();
+    list.x2.clear();
+    list.y2.clear();
+    list.texture.clear();
+    list.flags.clear();
+    list.position.clear();
+}
+
+#endif //GLNE_WINDOW_LIST_H